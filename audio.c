@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/soundcard.h>
+#include "chip8.h"
+#include "audio.h"
+#include "timing.h"
+
+#define AUDIO_DEVICE_PATH "/dev/dsp"
+#define WAV_HEADER_SIZE 44
+
+static void put_le(uint8_t *out, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+// Canonical 44 byte header of 16-bit mono PCM, rewritten with the final sizes when the file is closed
+static void write_wav_header(FILE *file_ptr, uint32_t sample_rate, uint64_t samples) {
+    uint8_t header[WAV_HEADER_SIZE];
+    uint32_t data_size = samples * 2 > 0xFFFFFFFF - WAV_HEADER_SIZE ? 0xFFFFFFFF - WAV_HEADER_SIZE : samples * 2;
+
+    memcpy(header, "RIFF", 4);
+    put_le(header + 4, 36 + data_size, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le(header + 16, 16, 4); // Format chunk size
+    put_le(header + 20, 1, 2); // PCM
+    put_le(header + 22, 1, 2); // Mono
+    put_le(header + 24, sample_rate, 4);
+    put_le(header + 28, sample_rate * 2, 4); // Bytes per second
+    put_le(header + 32, 2, 2); // Bytes per frame
+    put_le(header + 34, 16, 2); // Bits per sample
+    memcpy(header + 36, "data", 4);
+    put_le(header + 40, data_size, 4);
+    fseek(file_ptr, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file_ptr);
+    fseek(file_ptr, 0, SEEK_END);
+}
+
+static int open_device(audio_output *audio_ptr) {
+    int format = AFMT_S16_LE, channels = 1, rate = AUDIO_SAMPLE_RATE;
+
+    audio_ptr->device_fd = open(AUDIO_DEVICE_PATH, O_WRONLY);
+    if (audio_ptr->device_fd < 0) {
+        printf("Failed to open the audio device %s.\n", AUDIO_DEVICE_PATH);
+        return -1;
+    }
+    if (ioctl(audio_ptr->device_fd, SNDCTL_DSP_SETFMT, &format) < 0 || format != AFMT_S16_LE ||
+        ioctl(audio_ptr->device_fd, SNDCTL_DSP_CHANNELS, &channels) < 0 || channels != 1 ||
+        ioctl(audio_ptr->device_fd, SNDCTL_DSP_SPEED, &rate) < 0) {
+        printf("The audio device %s does not play 16-bit mono.\n", AUDIO_DEVICE_PATH);
+        close(audio_ptr->device_fd);
+        return -1;
+    }
+    // The device may round the rate, the generator follows what it actually plays
+    audio_ptr->sample_rate = rate;
+    return 0;
+}
+
+static void record_latency(audio_output *audio_ptr, uint64_t queued_samples) {
+    audio_stats *stats_ptr = &audio_ptr->stats;
+    uint64_t latency_us = queued_samples * 1000000 / audio_ptr->sample_rate;
+
+    atomic_fetch_add_explicit(&stats_ptr->latency_us_total, latency_us, memory_order_relaxed);
+    if (latency_us > atomic_load_explicit(&stats_ptr->latency_us_max, memory_order_relaxed)) {
+        atomic_store_explicit(&stats_ptr->latency_us_max, latency_us, memory_order_relaxed);
+    }
+}
+
+static void write_sink(audio_output *audio_ptr, const int16_t *samples, size_t count) {
+    if (audio_ptr->kind == AUDIO_SINK_WAV) {
+        uint8_t buffer[AUDIO_PERIOD_SAMPLES * 2];
+        for (size_t i = 0; i < count; i++) {
+            put_le(buffer + 2 * i, (uint16_t)samples[i], 2);
+        }
+        audio_ptr->wav_samples += fwrite(buffer, 2, count, audio_ptr->wav_ptr);
+    } else if (audio_ptr->kind == AUDIO_SINK_DEVICE) {
+        const uint8_t *bytes = (const uint8_t *)samples;
+        size_t left = count * sizeof(int16_t);
+        // Blocks while the device buffer is full, this is what paces the thread
+        while (left > 0) {
+            ssize_t written = write(audio_ptr->device_fd, bytes, left);
+            if (written <= 0) {
+                break;
+            }
+            bytes += written;
+            left -= written;
+        }
+    }
+}
+
+static void *audio_main(void *arg) {
+    audio_output *audio_ptr = arg;
+    audio_stats *stats_ptr = &audio_ptr->stats;
+    int16_t period[AUDIO_PERIOD_SAMPLES];
+    uint64_t tail = atomic_load_explicit(&audio_ptr->tail, memory_order_relaxed);
+    // A WAV file takes samples as they come, the other sinks consume a period every period like a device
+    int paced = audio_ptr->kind != AUDIO_SINK_WAV;
+    double next_period = now_seconds();
+
+    for (;;) {
+        // Read stop first, so the samples appended before it was set are still drained
+        int stopping = atomic_load_explicit(&audio_ptr->stop, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&audio_ptr->head, memory_order_acquire);
+        uint64_t queued = head - tail;
+
+        if (!paced && queued == 0) {
+            if (stopping) {
+                break;
+            }
+            struct timespec pause = { 0, 1000000 };
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        if (paced && stopping) {
+            break;
+        }
+
+        size_t count = queued < AUDIO_PERIOD_SAMPLES ? queued : AUDIO_PERIOD_SAMPLES;
+        for (size_t i = 0; i < count; i++) {
+            period[i] = audio_ptr->samples[(tail + i) & (AUDIO_RING_SAMPLES - 1)];
+        }
+        // The slots are handed back before the sink write so the emulation never waits on the sink
+        tail += count;
+        atomic_store_explicit(&audio_ptr->tail, tail, memory_order_release);
+
+        // Audio queued ahead of the sink, plus what the device still buffers
+        uint64_t delay = queued - count;
+        int device_delay = 0;
+        if (audio_ptr->kind == AUDIO_SINK_DEVICE && ioctl(audio_ptr->device_fd, SNDCTL_DSP_GETODELAY, &device_delay) == 0) {
+            delay += device_delay / sizeof(int16_t);
+        }
+        record_latency(audio_ptr, delay);
+        atomic_fetch_add_explicit(&stats_ptr->periods, 1, memory_order_relaxed);
+
+        if (paced && count < AUDIO_PERIOD_SAMPLES) {
+            // The sink wants a whole period now, the missing part plays as silence
+            memset(period + count, 0, (AUDIO_PERIOD_SAMPLES - count) * sizeof(int16_t));
+            atomic_fetch_add_explicit(&stats_ptr->underruns, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&stats_ptr->underrun_samples, AUDIO_PERIOD_SAMPLES - count, memory_order_relaxed);
+            count = AUDIO_PERIOD_SAMPLES;
+        }
+        write_sink(audio_ptr, period, count);
+
+        if (audio_ptr->kind == AUDIO_SINK_NULL) {
+            next_period += (double)AUDIO_PERIOD_SAMPLES / audio_ptr->sample_rate;
+            sleep_until(next_period);
+        }
+    }
+
+    return NULL;
+}
+
+audio_output *audio_create(audio_sink_kind kind, const char *path) {
+    audio_output *audio_ptr = calloc(1, sizeof(audio_output));
+
+    if (audio_ptr == NULL) {
+        return NULL;
+    }
+    audio_ptr->kind = kind;
+    audio_ptr->sample_rate = AUDIO_SAMPLE_RATE;
+    audio_ptr->device_fd = -1;
+
+    if (kind == AUDIO_SINK_DEVICE && open_device(audio_ptr) != 0) {
+        free(audio_ptr);
+        return NULL;
+    }
+    if (kind == AUDIO_SINK_WAV) {
+        audio_ptr->wav_ptr = fopen(path, "wb");
+        if (audio_ptr->wav_ptr == NULL) {
+            printf("Failed to create WAV file %s.\n", path);
+            free(audio_ptr);
+            return NULL;
+        }
+        write_wav_header(audio_ptr->wav_ptr, audio_ptr->sample_rate, 0);
+    }
+
+    if (pthread_create(&audio_ptr->thread, NULL, audio_main, audio_ptr) != 0) {
+        printf("Failed to start the audio thread.\n");
+        if (audio_ptr->wav_ptr != NULL) {
+            fclose(audio_ptr->wav_ptr);
+        }
+        if (audio_ptr->device_fd >= 0) {
+            close(audio_ptr->device_fd);
+        }
+        free(audio_ptr);
+        return NULL;
+    }
+    return audio_ptr;
+}
+
+void audio_parse(const char *name, audio_sink_kind *kind_ptr, const char **path_ptr) {
+    *path_ptr = NULL;
+    if (strcmp(name, "null") == 0) {
+        *kind_ptr = AUDIO_SINK_NULL;
+    } else if (strcmp(name, "device") == 0) {
+        *kind_ptr = AUDIO_SINK_DEVICE;
+    } else {
+        *kind_ptr = AUDIO_SINK_WAV;
+        *path_ptr = name;
+    }
+}
+
+void audio_stop(audio_output *audio_ptr) {
+    if (audio_ptr->stopped) {
+        return;
+    }
+
+    audio_ptr->stopped = 1;
+    atomic_store_explicit(&audio_ptr->stop, 1, memory_order_release);
+    pthread_join(audio_ptr->thread, NULL);
+    if (audio_ptr->wav_ptr != NULL) {
+        write_wav_header(audio_ptr->wav_ptr, audio_ptr->sample_rate, audio_ptr->wav_samples);
+        fclose(audio_ptr->wav_ptr);
+    }
+    if (audio_ptr->device_fd >= 0) {
+        close(audio_ptr->device_fd);
+    }
+}
+
+void audio_destroy(audio_output *audio_ptr) {
+    if (audio_ptr != NULL) {
+        audio_stop(audio_ptr);
+        free(audio_ptr);
+    }
+}
+
+void audio_frame(audio_output *audio_ptr, const chip8_cpu *cpu_ptr) {
+    audio_stats *stats_ptr = &audio_ptr->stats;
+    // sample_rate / 60 samples per frame, the remainder carries over so no drift builds up
+    uint32_t progress = audio_ptr->frame_remainder + audio_ptr->sample_rate;
+    uint32_t count = progress / 60;
+    audio_ptr->frame_remainder = progress % 60;
+
+    uint64_t head = atomic_load_explicit(&audio_ptr->head, memory_order_relaxed);
+    uint64_t space = AUDIO_RING_SAMPLES - (head - atomic_load_explicit(&audio_ptr->tail, memory_order_acquire));
+    uint32_t kept = count < space ? count : space;
+    int beeping = cpu_ptr->registers.sound_timer > 0;
+
+    // The square wave keeps its phase across frames and dropped samples, so it never clicks
+    for (uint32_t i = 0; i < count; i++) {
+        audio_ptr->tone_phase += 2 * AUDIO_TONE_HZ;
+        if (audio_ptr->tone_phase >= 2 * audio_ptr->sample_rate) {
+            audio_ptr->tone_phase -= 2 * audio_ptr->sample_rate;
+        }
+        if (i < kept) {
+            int16_t level = audio_ptr->tone_phase < audio_ptr->sample_rate ? AUDIO_AMPLITUDE : -AUDIO_AMPLITUDE;
+            audio_ptr->samples[(head + i) & (AUDIO_RING_SAMPLES - 1)] = beeping ? level : 0;
+        }
+    }
+    atomic_store_explicit(&audio_ptr->head, head + kept, memory_order_release);
+    atomic_fetch_add_explicit(&stats_ptr->produced, count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats_ptr->dropped, count - kept, memory_order_relaxed);
+}
+
+void audio_report(const audio_output *audio_ptr) {
+    const audio_stats *stats_ptr = &audio_ptr->stats;
+    uint64_t periods = atomic_load(&stats_ptr->periods);
+
+    printf("Audio: %llu samples produced, %llu dropped\n", (unsigned long long)atomic_load(&stats_ptr->produced),
+           (unsigned long long)atomic_load(&stats_ptr->dropped));
+    printf("Audio periods: %llu, %llu underruns (%llu samples of silence)\n", (unsigned long long)periods,
+           (unsigned long long)atomic_load(&stats_ptr->underruns), (unsigned long long)atomic_load(&stats_ptr->underrun_samples));
+    printf("Audio latency: %.1f ms average, %.1f ms max\n",
+           periods ? atomic_load(&stats_ptr->latency_us_total) / 1e3 / periods : 0.0,
+           atomic_load(&stats_ptr->latency_us_max) / 1e3);
+}
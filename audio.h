@@ -0,0 +1,73 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "chip8.h"
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_RING_SAMPLES (1 << 14) // Must be a power of two, about 370 ms of mono samples
+#define AUDIO_PERIOD_SAMPLES 512 // Samples the audio thread hands to the sink at once, about 12 ms
+#define AUDIO_TONE_HZ 440 // Pitch of the beeper's square wave
+#define AUDIO_AMPLITUDE 4000
+
+typedef enum {
+    AUDIO_SINK_NULL, // Discards the samples at the pace of a device, for measuring the pipeline
+    AUDIO_SINK_WAV, // Writes every sample to a 16-bit mono WAV file as fast as they arrive
+    AUDIO_SINK_DEVICE // Plays through the OSS device /dev/dsp, whose blocking writes pace the audio thread
+} audio_sink_kind;
+
+// Counters written by one thread each and readable from any thread
+typedef struct {
+    _Atomic uint64_t produced; // Samples the emulation generated
+    _Atomic uint64_t dropped; // Samples lost because the ring was full, the emulation never waits
+    _Atomic uint64_t periods; // Periods handed to the sink
+    _Atomic uint64_t underruns; // Periods a paced sink needed before the emulation had produced them
+    _Atomic uint64_t underrun_samples; // Silence inserted for those periods
+    _Atomic uint64_t latency_us_total; // Sum over the periods of the audio queued ahead of the sink
+    _Atomic uint64_t latency_us_max;
+} audio_stats;
+
+// Single-producer single-consumer ring: the emulation thread generates samples, the audio thread feeds the sink
+typedef struct {
+    int16_t samples[AUDIO_RING_SAMPLES];
+    _Atomic uint64_t head; // Samples appended so far
+    _Atomic uint64_t tail; // Samples taken by the audio thread so far
+    audio_stats stats;
+    // Generator state, emulation thread only
+    uint32_t frame_remainder; // Progress towards the next sample, in 1/60 samples
+    uint32_t tone_phase; // Position in the square wave period, in 1/AUDIO_TONE_HZ samples
+    // Sink state, audio thread only
+    audio_sink_kind kind;
+    uint32_t sample_rate;
+    int device_fd;
+    FILE *wav_ptr;
+    uint64_t wav_samples;
+    pthread_t thread;
+    _Atomic int stop;
+    int stopped; // The thread was joined and the sink closed
+} audio_output;
+
+// Opens the sink (path names the WAV file) and starts the audio thread. Returns NULL on failure.
+audio_output *audio_create(audio_sink_kind kind, const char *path);
+
+// Parses "null", "device" or a WAV file name into a sink kind and path
+void audio_parse(const char *name, audio_sink_kind *kind_ptr, const char **path_ptr);
+
+// Stops the audio thread, after which the counters are final. A WAV file gets every queued sample and its header.
+void audio_stop(audio_output *audio_ptr);
+
+// Stops the audio thread if it still runs and frees the output
+void audio_destroy(audio_output *audio_ptr);
+
+// Generates one emulated frame (1/60 s) of samples, a square wave while the sound timer runs and silence
+// otherwise. Called before the frame runs, the sound timer only changes at the tick that ends it.
+// Never blocks: samples that don't fit in the ring are counted as dropped.
+void audio_frame(audio_output *audio_ptr, const chip8_cpu *cpu_ptr);
+
+// Prints the counters
+void audio_report(const audio_output *audio_ptr);
+
+#endif
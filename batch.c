@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "chip8.h"
+#include "engine.h"
+#include "input_script.h"
+#include "batch.h"
+#include "catalog.h"
+#include "timing.h"
+
+// Each worker owns a deque of job indices: it pops its own work from the tail while idle workers steal from the head
+typedef struct {
+    pthread_mutex_t lock;
+    size_t *jobs;
+    size_t head, tail;
+} job_deque;
+
+typedef struct batch_context batch_context;
+
+// Everything a worker needs is allocated once up front, so running a job never allocates
+typedef struct {
+    int id;
+    batch_context *context_ptr;
+    job_deque deque;
+    chip8_cpu cpu;
+    chip8_engine engine;
+    const rom_image *loaded_ptr; // ROM whose golden image the CPU started the last job from
+    uint64_t executed, idle_cycles, steals, resets;
+    pthread_t thread;
+} batch_worker;
+
+struct batch_context {
+    const batch_list *list_ptr;
+    batch_result *results;
+    batch_worker *workers;
+    int worker_count;
+};
+
+static int read_rom_image(const char *path, rom_image *rom_ptr) {
+    memset(rom_ptr, 0, sizeof(*rom_ptr));
+    if (map_rom(path, &rom_ptr->rom) != 0) {
+        return -1;
+    }
+
+    snprintf(rom_ptr->path, sizeof(rom_ptr->path), "%s", path);
+    rom_ptr->hash = rom_hash(rom_ptr->rom.data, rom_ptr->rom.size);
+    rom_ptr->clock_hz = CHIP8_DEFAULT_CLOCK_HZ;
+    rom_ptr->quirks = QUIRKS_CHIP8;
+    return 0;
+}
+
+static int find_or_add_rom(batch_list *list_ptr, const char *path, size_t *index_ptr) {
+    for (size_t i = 0; i < list_ptr->rom_count; i++) {
+        if (strcmp(list_ptr->roms[i].path, path) == 0) {
+            *index_ptr = i;
+            return 0;
+        }
+    }
+
+    rom_image *roms = realloc(list_ptr->roms, (list_ptr->rom_count + 1) * sizeof(rom_image));
+    if (roms == NULL) {
+        return -1;
+    }
+    list_ptr->roms = roms;
+    if (read_rom_image(path, &roms[list_ptr->rom_count]) != 0) {
+        return -1;
+    }
+    *index_ptr = list_ptr->rom_count++;
+    return 0;
+}
+
+int batch_load(const char *path, batch_list *list_ptr) {
+    FILE *file_ptr = fopen(path, "r");
+    char line[3 * ROM_PATH_MAX];
+    size_t capacity = 0;
+
+    memset(list_ptr, 0, sizeof(*list_ptr));
+
+    if (file_ptr == NULL) {
+        printf("Failed to open job list %s.\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file_ptr) != NULL) {
+        char rom_path[ROM_PATH_MAX], script_path[ROM_PATH_MAX];
+        unsigned long long cycles;
+        char *comment = strchr(line, '#');
+
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        int fields = sscanf(line, "%255s %llu %255s", rom_path, &cycles, script_path);
+        if (fields <= 0) {
+            continue;
+        }
+        if (fields < 2) {
+            printf("Job list %s: expected \"<rom> <cycles> [input script]\".\n", path);
+            goto fail;
+        }
+
+        if (list_ptr->job_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            batch_job *jobs = realloc(list_ptr->jobs, capacity * sizeof(batch_job));
+            if (jobs == NULL) {
+                goto fail;
+            }
+            list_ptr->jobs = jobs;
+        }
+
+        batch_job *job_ptr = &list_ptr->jobs[list_ptr->job_count];
+        job_ptr->cycles = cycles;
+        job_ptr->script.events = NULL;
+        job_ptr->script.count = 0;
+        job_ptr->script.capacity = 0;
+        if (find_or_add_rom(list_ptr, rom_path, &job_ptr->rom_index) != 0) {
+            goto fail;
+        }
+        if (fields == 3 && input_script_load(script_path, &job_ptr->script) != 0) {
+            goto fail;
+        }
+        list_ptr->job_count++;
+    }
+
+    fclose(file_ptr);
+    return 0;
+
+fail:
+    fclose(file_ptr);
+    batch_free(list_ptr);
+    return -1;
+}
+
+void batch_free(batch_list *list_ptr) {
+    for (size_t i = 0; i < list_ptr->job_count; i++) {
+        input_script_free(&list_ptr->jobs[i].script);
+    }
+    for (size_t i = 0; i < list_ptr->rom_count; i++) {
+        unmap_rom(&list_ptr->roms[i].rom);
+        free(list_ptr->roms[i].analysis_ptr);
+    }
+    free(list_ptr->jobs);
+    free(list_ptr->roms);
+    memset(list_ptr, 0, sizeof(*list_ptr));
+}
+
+int batch_use_catalog(batch_list *list_ptr, const char *dir) {
+    for (size_t i = 0; i < list_ptr->rom_count; i++) {
+        rom_image *rom_ptr = &list_ptr->roms[i];
+        rom_metadata metadata;
+
+        if (catalog_add(dir, rom_ptr->path, &rom_ptr->rom, &metadata) != 0) {
+            return -1;
+        }
+        rom_ptr->clock_hz = metadata.clock_hz;
+        if (quirks_parse(metadata.quirks, &rom_ptr->quirks) != 0) {
+            printf("ROM %s: unknown quirk profile %s.\n", rom_ptr->path, metadata.quirks);
+            return -1;
+        }
+        if (rom_ptr->analysis_ptr == NULL && (rom_ptr->analysis_ptr = malloc(sizeof(block_cache))) == NULL) {
+            return -1;
+        }
+        // Blocks are translated from the memory a ROM loads into, not from the ROM alone
+        chip8_cpu cpu = init();
+        load_rom_bytes(&cpu, rom_ptr->rom.data, rom_ptr->rom.size);
+        if (catalog_load_analysis(dir, rom_ptr->hash, cpu.memory, rom_ptr->analysis_ptr) != 0) {
+            free(rom_ptr->analysis_ptr);
+            rom_ptr->analysis_ptr = NULL;
+        }
+    }
+    list_ptr->catalog_dir = dir;
+    return 0;
+}
+
+static int deque_pop(job_deque *deque_ptr, size_t *job_ptr) {
+    int found = 0;
+
+    pthread_mutex_lock(&deque_ptr->lock);
+    if (deque_ptr->head < deque_ptr->tail) {
+        *job_ptr = deque_ptr->jobs[--deque_ptr->tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque_ptr->lock);
+    return found;
+}
+
+static int deque_steal(job_deque *deque_ptr, size_t *job_ptr) {
+    int found = 0;
+
+    pthread_mutex_lock(&deque_ptr->lock);
+    if (deque_ptr->head < deque_ptr->tail) {
+        *job_ptr = deque_ptr->jobs[deque_ptr->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque_ptr->lock);
+    return found;
+}
+
+static void run_job(batch_worker *worker_ptr, size_t index) {
+    const batch_list *list_ptr = worker_ptr->context_ptr->list_ptr;
+    const batch_job *job_ptr = &list_ptr->jobs[index];
+    rom_image *rom_ptr = &list_ptr->roms[job_ptr->rom_index];
+    batch_result *result_ptr = &worker_ptr->context_ptr->results[index];
+    double start = now_seconds();
+
+    // Another job of the same ROM only dirtied a few pages, and the code decoded from the others is still valid
+    if (worker_ptr->loaded_ptr == rom_ptr) {
+        engine_invalidate_pages(&worker_ptr->engine, reset_to_image(&worker_ptr->cpu, &rom_ptr->image));
+        worker_ptr->resets++;
+    } else {
+        worker_ptr->cpu = rom_ptr->image;
+        worker_ptr->loaded_ptr = rom_ptr;
+        engine_reset_from(&worker_ptr->engine, rom_ptr->analysis_ptr);
+    }
+    run_with_script(&worker_ptr->engine, &worker_ptr->cpu, &job_ptr->script, job_ptr->cycles);
+
+    // The image starts both counts at zero, the cycles skipped in idle loops are reported apart
+    result_ptr->executed = worker_ptr->cpu.cycle_count - worker_ptr->cpu.idle_cycles;
+    result_ptr->seconds = now_seconds() - start;
+    result_ptr->display_hash = display_hash(&worker_ptr->cpu);
+    result_ptr->program_counter = worker_ptr->cpu.registers.program_counter;
+    result_ptr->worker = worker_ptr->id;
+    worker_ptr->executed += result_ptr->executed;
+    worker_ptr->idle_cycles += worker_ptr->cpu.idle_cycles;
+
+    // The first job of a ROM the catalog has no blocks for persists the ones it translated, outside the timed part
+    if (list_ptr->catalog_dir != NULL && rom_ptr->analysis_ptr == NULL && worker_ptr->engine.block_cache_ptr != NULL &&
+        atomic_exchange(&rom_ptr->analysis_saved, 1) == 0) {
+        catalog_save_analysis(list_ptr->catalog_dir, rom_ptr->hash, worker_ptr->engine.block_cache_ptr,
+                              worker_ptr->cpu.memory, rom_ptr->image.memory);
+    }
+}
+
+static void *worker_main(void *arg) {
+    batch_worker *worker_ptr = arg;
+    batch_context *context_ptr = worker_ptr->context_ptr;
+    size_t job;
+
+    for (;;) {
+        if (deque_pop(&worker_ptr->deque, &job)) {
+            run_job(worker_ptr, job);
+            continue;
+        }
+
+        // Own queue is empty, try the other workers starting with the next one.
+        // Jobs never create jobs, so once every queue is empty the batch is done.
+        int stolen = 0;
+        for (int i = 1; i < context_ptr->worker_count && !stolen; i++) {
+            batch_worker *victim_ptr = &context_ptr->workers[(worker_ptr->id + i) % context_ptr->worker_count];
+            stolen = deque_steal(&victim_ptr->deque, &job);
+        }
+        if (!stolen) {
+            break;
+        }
+        worker_ptr->steals++;
+        run_job(worker_ptr, job);
+    }
+
+    return NULL;
+}
+
+int batch_run(const batch_list *list_ptr, batch_result *results, int threads, engine_kind kind, batch_stats *stats_ptr) {
+    batch_context context = { list_ptr, results, NULL, threads };
+    size_t *job_indices = malloc((list_ptr->job_count + 1) * sizeof(size_t));
+    int started = 0, status = 0;
+
+    context.workers = calloc(threads, sizeof(batch_worker));
+    if (context.workers == NULL || job_indices == NULL) {
+        free(context.workers);
+        free(job_indices);
+        return -1;
+    }
+
+    for (size_t i = 0; i < list_ptr->rom_count; i++) {
+        rom_image *rom_ptr = &list_ptr->roms[i];
+        chip8_cpu cpu = init();
+        set_clock_hz(&cpu, rom_ptr->clock_hz);
+        set_quirks(&cpu, rom_ptr->quirks);
+        load_rom_bytes(&cpu, rom_ptr->rom.data, rom_ptr->rom.size);
+        capture_image(&cpu, &rom_ptr->image);
+    }
+
+    // Every worker starts with a contiguous slice of the job list
+    for (size_t i = 0; i < list_ptr->job_count; i++) {
+        job_indices[i] = i;
+    }
+    for (int i = 0; i < threads; i++) {
+        batch_worker *worker_ptr = &context.workers[i];
+        worker_ptr->id = i;
+        worker_ptr->context_ptr = &context;
+        worker_ptr->deque.jobs = job_indices;
+        worker_ptr->deque.head = list_ptr->job_count * i / threads;
+        worker_ptr->deque.tail = list_ptr->job_count * (i + 1) / threads;
+        pthread_mutex_init(&worker_ptr->deque.lock, NULL);
+        if (engine_init(&worker_ptr->engine, kind) != 0) {
+            status = -1;
+        }
+    }
+
+    double start = now_seconds();
+    // If some threads fail to start, the running ones steal their jobs so the batch still completes
+    while (status == 0 && started < threads) {
+        if (pthread_create(&context.workers[started].thread, NULL, worker_main, &context.workers[started]) != 0) {
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(context.workers[i].thread, NULL);
+    }
+
+    stats_ptr->seconds = now_seconds() - start;
+    stats_ptr->executed = 0;
+    stats_ptr->idle_cycles = 0;
+    stats_ptr->steals = 0;
+    stats_ptr->resets = 0;
+    for (int i = 0; i < threads; i++) {
+        stats_ptr->executed += context.workers[i].executed;
+        stats_ptr->idle_cycles += context.workers[i].idle_cycles;
+        stats_ptr->steals += context.workers[i].steals;
+        stats_ptr->resets += context.workers[i].resets;
+        engine_free(&context.workers[i].engine);
+        pthread_mutex_destroy(&context.workers[i].deque.lock);
+    }
+
+    free(context.workers);
+    free(job_indices);
+    return started > 0 ? 0 : -1;
+}
@@ -0,0 +1,68 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "chip8.h"
+#include "engine.h"
+#include "input_script.h"
+
+#define ROM_PATH_MAX 256
+
+// A ROM mapped once for every job that runs it
+typedef struct {
+    char path[ROM_PATH_MAX];
+    rom_mapping rom;
+    uint64_t hash;
+    uint32_t clock_hz; // From the catalog metadata, CHIP8_DEFAULT_CLOCK_HZ without a catalog
+    quirk_profile quirks; // From the catalog metadata, QUIRKS_CHIP8 without a catalog
+    block_cache *analysis_ptr; // Blocks persisted by an earlier run, NULL when there are none
+    chip8_cpu image; // Golden image of the ROM loaded with its clock and quirks, captured by batch_run()
+    atomic_int analysis_saved; // Set by the first job that persists the blocks it translated
+} rom_image;
+
+typedef struct {
+    size_t rom_index;
+    uint64_t cycles;
+    input_script script; // Empty when the job runs without input
+} batch_job;
+
+typedef struct {
+    uint64_t executed; // Instructions the job executed, not counting the cycles skipped in idle loops
+    double seconds;
+    uint64_t display_hash;
+    uint16_t program_counter;
+    int worker;
+} batch_result;
+
+typedef struct {
+    rom_image *roms;
+    size_t rom_count;
+    batch_job *jobs;
+    size_t job_count;
+    const char *catalog_dir; // NULL unless batch_use_catalog() was called
+} batch_list;
+
+typedef struct {
+    double seconds; // Wall time of the whole batch
+    uint64_t executed; // Instructions executed over all jobs
+    uint64_t idle_cycles; // Cycles fast-forwarded through idle loops on top of executed
+    uint64_t steals; // Jobs a worker took from another worker's queue
+    uint64_t resets; // Jobs that started by resetting the dirty pages of the ROM's previous job instead of a full copy
+} batch_stats;
+
+// Parses a job list with one "<rom> <cycles> [input script]" job per line, '#' starts a comment.
+// Every distinct ROM is mapped once. Returns 0 on success and -1 on failure.
+int batch_load(const char *path, batch_list *list_ptr);
+void batch_free(batch_list *list_ptr);
+
+// Adds every ROM of the list to the catalog, takes their recommended clock from it and loads their persisted blocks.
+// Jobs of ROMs without blocks persist the ones they translate. Returns 0 on success and -1 on failure.
+int batch_use_catalog(batch_list *list_ptr, const char *dir);
+
+// Runs every job on a pool of worker threads with work stealing, results[i] receives the outcome of job i.
+// Returns 0 on success and -1 if the workers could not be started.
+int batch_run(const batch_list *list_ptr, batch_result *results, int threads, engine_kind kind, batch_stats *stats_ptr);
+
+#endif
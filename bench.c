@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "chip8.h"
+#include "engine.h"
+#include "env_batch.h"
+#include "timing.h"
+
+// Number of instructions executed between two clock reads
+#define BENCH_CHUNK (1 << 16)
+// Opcodes in the loop body of an opcode class microbenchmark, before the jump back to 0x200
+#define CLASS_BODY 64
+
+// A microbenchmark loops over the same few opcodes of one class
+typedef struct {
+    const char *name;
+    uint16_t opcodes[8];
+    int count;
+} opcode_class;
+
+// V0 and V1 stay 0 in the classes that skip or index memory, so every iteration takes the same path
+static const opcode_class classes[] = {
+    { "load/add (6xkk 7xkk)", { 0x6212, 0x7301, 0x6434, 0x7501, 0x6656, 0x7701, 0x6878, 0x7901 }, 8 },
+    { "alu (8xyN)", { 0x8234, 0x8345, 0x8451, 0x8562, 0x8673, 0x8726, 0x882E, 0x8937 }, 8 },
+    { "skip (3xkk 4xkk 5xy0 9xy0)", { 0x3001, 0x6A00, 0x4001, 0x6A00, 0x5010, 0x6A00, 0x9010, 0x6A00 }, 8 },
+    { "call/return (2nnn 00EE)", { 0x2000, 0x2000, 0x2000, 0x2000 }, 4 },
+    { "memory (Fx33 Fx55 Fx65)", { 0xA300, 0xF233, 0xA300, 0xF355, 0xA300, 0xF365 }, 6 },
+    { "sprite (Fx29 Dxyn)", { 0xF029, 0xD015, 0xF129, 0xD015 }, 4 },
+    { "timer/random (Fx07 Fx15 Cxkk)", { 0xF207, 0xF315, 0xC4FF, 0xF518, 0xC6FF }, 5 }
+};
+
+static void usage(const char *program) {
+    printf("Usage: %s [-e interp|threaded|blocks] [-s seconds] [-f frames] [-c clock_hz] [-E instances] [rom...]\n",
+           program);
+    printf("  Times every opcode class with every engine, then every ROM: instructions/sec with the selected engine\n");
+    printf("  and the timers running for the given seconds, and the p50/p99 wall time of emulating the given number\n");
+    printf("  of frames at the clock\n");
+    printf("  -E also steps the ROMs in a batch of environments with random actions and reports frames/sec\n");
+}
+
+// Builds a ROM that runs the opcodes of a class in a loop. Calls go to a 00EE placed after the jump back.
+static size_t build_class_rom(const opcode_class *class_ptr, uint8_t *rom) {
+    uint16_t subroutine = 0x200 + 2 * (CLASS_BODY + 1);
+    size_t size = 0;
+
+    for (int i = 0; i < CLASS_BODY; i++) {
+        uint16_t opcode = class_ptr->opcodes[i % class_ptr->count];
+        if (opcode == 0x2000) {
+            opcode |= subroutine;
+        }
+        rom[size++] = opcode >> 8;
+        rom[size++] = opcode & 0xFF;
+    }
+    rom[size++] = 0x12;
+    rom[size++] = 0x00;
+    rom[size++] = 0x00;
+    rom[size++] = 0xEE;
+    return size;
+}
+
+// Runs the engine for about the given wall time and returns the instructions executed per second. ROMs run with
+// the timers ticking so waits on the delay timer end, and cycles fast-forwarded through idle loops don't count.
+// The opcode class loops never wait, they run without timers so the tick boundaries don't cut them up.
+static double run_timed(chip8_engine *engine_ptr, chip8_cpu *cpu_ptr, double seconds, int timers) {
+    uint64_t executed = 0, idle_start = cpu_ptr->idle_cycles;
+    double start = now_seconds(), elapsed;
+
+    do {
+        if (timers) {
+            executed += engine_run_for_cycles(engine_ptr, cpu_ptr, BENCH_CHUNK);
+        } else {
+            executed += engine_run(engine_ptr, cpu_ptr, BENCH_CHUNK);
+        }
+        elapsed = now_seconds() - start;
+    } while (elapsed < seconds);
+    return (executed - (cpu_ptr->idle_cycles - idle_start)) / elapsed;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_classes(double seconds) {
+    static const engine_kind kinds[] = { ENGINE_INTERPRETER, ENGINE_THREADED, ENGINE_BLOCKS };
+
+    printf("%-32s", "Opcode class (ns/instruction)");
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        printf("%10s", engine_name(kinds[k]));
+    }
+    printf("\n");
+
+    for (size_t c = 0; c < sizeof(classes) / sizeof(classes[0]); c++) {
+        uint8_t rom[2 * (CLASS_BODY + 2)];
+        size_t size = build_class_rom(&classes[c], rom);
+
+        printf("%-32s", classes[c].name);
+        for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+            chip8_engine engine;
+            chip8_cpu cpu = init();
+            if (engine_init(&engine, kinds[k]) != 0) {
+                printf("%10s", "-");
+                continue;
+            }
+            load_rom_bytes(&cpu, rom, size);
+            printf("%10.2f", 1e9 / run_timed(&engine, &cpu, seconds, 0));
+            engine_free(&engine);
+        }
+        printf("\n");
+    }
+}
+
+static int bench_rom(const char *path, engine_kind kind, double seconds, int frames, uint32_t clock_hz) {
+    chip8_engine engine;
+    chip8_cpu image = init(), cpu;
+    double *times = malloc(frames * sizeof(double));
+
+    if (times == NULL || engine_init(&engine, kind) != 0) {
+        free(times);
+        return -1;
+    }
+    set_clock_hz(&image, clock_hz);
+    if (load_rom(&image, path) != 0) {
+        engine_free(&engine);
+        free(times);
+        return -1;
+    }
+
+    cpu = image;
+    double rate = run_timed(&engine, &cpu, seconds, 1);
+
+    // Frame times from a fresh start, the way a frontend runs the ROM: one 60 Hz frame of cycles at a time
+    cpu = image;
+    engine_reset(&engine);
+    uint64_t cycles_per_frame = clock_hz / 60 ? clock_hz / 60 : 1;
+    for (int i = 0; i < frames; i++) {
+        double start = now_seconds();
+        engine_run_for_cycles(&engine, &cpu, cycles_per_frame);
+        times[i] = now_seconds() - start;
+    }
+    qsort(times, frames, sizeof(double), compare_doubles);
+
+    const char *name = strrchr(path, '/');
+    printf("%-24s%14.0f%12.2f%12.2f%12.2f\n", name != NULL ? name + 1 : path, rate, times[frames / 2] * 1e6,
+           times[(int)(frames * 0.99)] * 1e6, times[frames - 1] * 1e6);
+
+    engine_free(&engine);
+    free(times);
+    return 0;
+}
+
+// Steps a batch of environments with random keys for about the given wall time, returns the frames per second
+static int bench_envs(const char *path, size_t count, double seconds, uint32_t clock_hz) {
+    rom_mapping rom;
+    env_batch batch;
+    env_config config;
+    uint64_t *displays = malloc(count * 32 * sizeof(uint64_t));
+    uint16_t *actions = malloc(count * sizeof(uint16_t));
+    uint8_t *done = malloc(count);
+    env_outputs outputs = { displays, NULL, done };
+
+    env_config_default(&config);
+    config.clock_hz = clock_hz;
+    config.max_frames = 60 * 60;
+    if (displays == NULL || actions == NULL || done == NULL || map_rom(path, &rom) != 0) {
+        free(displays);
+        free(actions);
+        free(done);
+        return -1;
+    }
+    int status = env_batch_init(&batch, rom.data, rom.size, count, &config);
+    unmap_rom(&rom);
+    if (status != 0) {
+        free(displays);
+        free(actions);
+        free(done);
+        return -1;
+    }
+
+    uint32_t state = 1;
+    uint64_t steps = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        for (size_t n = 0; n < count; n++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            actions[n] = 1 << (state & 0xF);
+        }
+        env_batch_step(&batch, actions, &outputs);
+        steps++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < seconds);
+
+    const char *name = strrchr(path, '/');
+    printf("%-24s%14.0f%14.0f\n", name != NULL ? name + 1 : path, steps * count * config.frame_skip / elapsed,
+           steps * count / elapsed);
+
+    env_batch_free(&batch);
+    free(displays);
+    free(actions);
+    free(done);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    engine_kind kind = ENGINE_BLOCKS;
+    double seconds = 0.5;
+    int frames = 6000, envs = 0, option, status = 0;
+    uint32_t clock_hz = CHIP8_DEFAULT_CLOCK_HZ;
+
+    while ((option = getopt(argc, argv, "e:s:f:c:E:h")) != -1) {
+        switch (option) {
+            case 'e':
+                if (engine_parse(optarg, &kind) != 0) {
+                    printf("Unknown engine %s.\n", optarg);
+                    return -1;
+                }
+                break;
+            case 's':
+                seconds = atof(optarg);
+                break;
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 'c':
+                clock_hz = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'E':
+                envs = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (frames < 1 || clock_hz == 0 || envs < 0) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    bench_classes(seconds);
+    if (optind == argc) {
+        return 0;
+    }
+
+    printf("\n%-24s%14s%12s%12s%12s\n", "ROM", "instr/sec", "p50 us", "p99 us", "max us");
+    for (int i = optind; i < argc; i++) {
+        if (bench_rom(argv[i], kind, seconds, frames, clock_hz) != 0) {
+            status = -1;
+        }
+    }
+    printf("Engine: %s, frames of %u cycles at %u Hz\n", engine_name(kind), clock_hz / 60, clock_hz);
+    if (envs == 0) {
+        return status;
+    }
+
+    printf("\n%-24s%14s%14s\n", "ROM", "env frames/s", "env steps/s");
+    for (int i = optind; i < argc; i++) {
+        if (bench_envs(argv[i], envs, seconds, clock_hz) != 0) {
+            status = -1;
+        }
+    }
+    printf("Environments: %d, frame skip 4, one thread per core\n", envs);
+    return status;
+}
@@ -0,0 +1,317 @@
+#include <string.h>
+#include <stdint.h>
+#include "chip8.h"
+#include "opcodes.h"
+#include "blocks.h"
+
+// Superinstructions produced by fusing two neighbouring opcodes, numbered after the plain opcodes.
+// 6xkk + 7xkk and 7xkk + 7xkk on the same register fold into a single 6xkk/7xkk with the summed byte.
+enum {
+    UOP_SET_I_ADD = OP_SPECIALIZED_COUNT, // Annn + Fx1E: I = nnn + Vx
+    UOP_COUNT
+};
+
+// Opcodes after which execution may not continue at the next address, run by their full handler
+static int is_terminator(opcode_id id) {
+    switch (id) {
+        case OP_INVALID:
+        case OP_00EE:
+        case OP_1nnn:
+        case OP_2nnn:
+        case OP_3xkk:
+        case OP_4xkk:
+        case OP_5xy0:
+        case OP_9xy0:
+        case OP_Bnnn:
+        case OP_Ex9E:
+        case OP_ExA1:
+        case OP_Fx0A:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+void block_cache_init(block_cache *cache_ptr) {
+    memset(cache_ptr->blocks, 0, sizeof(cache_ptr->blocks));
+    memset(cache_ptr->covered, 0, sizeof(cache_ptr->covered));
+    cache_ptr->pool_used = 0;
+    cache_ptr->quirks = QUIRKS_CHIP8;
+}
+
+int block_cache_check(const block_cache *cache_ptr) {
+    if (cache_ptr->pool_used > BLOCK_POOL_UOPS || cache_ptr->quirks >= QUIRKS_COUNT) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < cache_ptr->pool_used; i++) {
+        const block_uop *uop = &cache_ptr->pool[i];
+        if (uop->kind >= UOP_COUNT || uop->x >= 16 || uop->y >= 16 || uop->nnn > 0xFFF ||
+            uop->instruction_count == 0) {
+            return -1;
+        }
+    }
+    for (int start = 0; start < 4096; start++) {
+        const block_entry *block = &cache_ptr->blocks[start];
+        if (!block->valid) {
+            continue;
+        }
+        // Blocks are only translated in the program area, and invalidation finds them through the covered bytes
+        if (start < 0x200 || block->uop_count == 0 || block->uop_count > block->instruction_count ||
+            block->instruction_count > BLOCK_MAX_INSTRUCTIONS || block->end != start + 2 * block->instruction_count ||
+            block->end > 0x1000 || block->first_uop + block->uop_count > cache_ptr->pool_used ||
+            memchr(&cache_ptr->covered[start], 0, block->end - start) != NULL) {
+            return -1;
+        }
+        // A block stopped part way walks its micro-ops by their instruction counts
+        int count = 0;
+        for (int i = 0; i < block->uop_count; i++) {
+            count += cache_ptr->pool[block->first_uop + i].instruction_count;
+        }
+        if (count != block->instruction_count) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void block_cache_invalidate(block_cache *cache_ptr, uint16_t address, uint16_t length) {
+    // Stores wrap around the end of memory like the handlers do
+    address &= 0xFFF;
+    if (address + length > 4096) {
+        block_cache_invalidate(cache_ptr, 0, address + length - 4096);
+        length = 4096 - address;
+    }
+    for (int byte = address; byte < address + length && byte < 4096; byte++) {
+        if (!cache_ptr->covered[byte]) {
+            continue;
+        }
+        // A block covering this byte can't start more than one maximal block length before it
+        int first = byte - 2 * BLOCK_MAX_INSTRUCTIONS + 1;
+        for (int start = first < 0 ? 0 : first; start <= byte; start++) {
+            block_entry *block = &cache_ptr->blocks[start];
+            if (block->valid && block->end > byte) {
+                block->valid = 0;
+            }
+        }
+    }
+}
+
+static block_entry *compile_block(block_cache *cache_ptr, const chip8_cpu *cpu_ptr, uint16_t start) {
+    if (cache_ptr->pool_used + BLOCK_MAX_INSTRUCTIONS > BLOCK_POOL_UOPS) {
+        block_cache_init(cache_ptr);
+        cache_ptr->quirks = cpu_ptr->quirks;
+    }
+
+    block_entry *block = &cache_ptr->blocks[start];
+    block_uop *first = &cache_ptr->pool[cache_ptr->pool_used];
+    unsigned quirks = quirk_set(cpu_ptr->quirks);
+    uint16_t address = start;
+    int count = 0, uops = 0;
+
+    while (count < BLOCK_MAX_INSTRUCTIONS && address < 0xFFF) {
+        uint16_t opcode = (cpu_ptr->memory[address] << 8) | cpu_ptr->memory[address + 1];
+        opcode_id id = decode_opcode(opcode);
+        uint8_t x = (opcode & 0x0F00) >> 8;
+        count++;
+        address += 2;
+
+        if (uops > 0) {
+            block_uop *previous = &first[uops - 1];
+            if (id == OP_7xkk && (previous->kind == OP_6xkk || previous->kind == OP_7xkk) && previous->x == x) {
+                previous->kk += opcode & 0x00FF;
+                previous->instruction_count++;
+                continue;
+            }
+            if (id == OP_Fx1E && previous->kind == OP_Annn) {
+                previous->kind = UOP_SET_I_ADD;
+                previous->x = x;
+                previous->instruction_count++;
+                continue;
+            }
+        }
+
+        first[uops].kind = specialize_opcode(id, quirks);
+        first[uops].x = x;
+        first[uops].y = (opcode & 0x00F0) >> 4;
+        first[uops].kk = opcode & 0x00FF;
+        first[uops].nnn = opcode & 0x0FFF;
+        first[uops].instruction_count = 1;
+        uops++;
+
+        // Stores end the block as well so a block never runs code it has just overwritten
+        if (is_terminator(id) || id == OP_Fx33 || id == OP_Fx55) {
+            break;
+        }
+    }
+
+    memset(&cache_ptr->covered[start], 1, address - start);
+    block->first_uop = cache_ptr->pool_used;
+    block->uop_count = uops;
+    block->end = address;
+    block->instruction_count = count;
+    block->valid = 1;
+    cache_ptr->pool_used += uops;
+    return block;
+}
+
+// Runs one instruction through the reference interpreter, outside the program area or when a budget ends inside
+// a fused micro-op.
+// Its Fx33 and Fx55 stores still drop the blocks they overwrite like the translated ones do.
+static void execute_uncached(chip8_cpu *cpu_ptr, block_cache *cache_ptr) {
+    uint16_t opcode = fetch_opcode(cpu_ptr), address = cpu_ptr->registers.I;
+
+    execute_instruction(cpu_ptr);
+    if ((opcode & 0xF0FF) == 0xF033) {
+        block_cache_invalidate(cache_ptr, address, 3);
+    } else if ((opcode & 0xF0FF) == 0xF055) {
+        block_cache_invalidate(cache_ptr, address, ((opcode & 0x0F00) >> 8) + 1);
+    }
+}
+
+uint64_t run_blocks(chip8_cpu *cpu_ptr, block_cache *cache_ptr, uint64_t n) {
+    static const void *labels[UOP_COUNT] = {
+        [OP_INVALID] = &&op_invalid,
+        [OP_00E0] = &&op_00E0, [OP_00EE] = &&op_00EE, [OP_1nnn] = &&op_1nnn, [OP_2nnn] = &&op_2nnn,
+        [OP_3xkk] = &&op_3xkk, [OP_4xkk] = &&op_4xkk, [OP_5xy0] = &&op_5xy0, [OP_6xkk] = &&op_6xkk,
+        [OP_7xkk] = &&op_7xkk, [OP_8xy0] = &&op_8xy0, [OP_8xy1] = &&op_8xy1, [OP_8xy2] = &&op_8xy2,
+        [OP_8xy3] = &&op_8xy3, [OP_8xy4] = &&op_8xy4, [OP_8xy5] = &&op_8xy5, [OP_8xy6] = &&op_8xy6,
+        [OP_8xy7] = &&op_8xy7, [OP_8xyE] = &&op_8xyE, [OP_9xy0] = &&op_9xy0, [OP_Annn] = &&op_Annn,
+        [OP_Bnnn] = &&op_Bnnn, [OP_Cxkk] = &&op_Cxkk, [OP_Dxyn] = &&op_Dxyn, [OP_Ex9E] = &&op_Ex9E,
+        [OP_ExA1] = &&op_ExA1, [OP_Fx07] = &&op_Fx07, [OP_Fx0A] = &&op_Fx0A, [OP_Fx15] = &&op_Fx15,
+        [OP_Fx18] = &&op_Fx18, [OP_Fx1E] = &&op_Fx1E, [OP_Fx29] = &&op_Fx29, [OP_Fx33] = &&op_Fx33,
+        [OP_Fx55] = &&op_Fx55, [OP_Fx65] = &&op_Fx65,
+        [OP_8xy1_VF] = &&op_8xy1_VF, [OP_8xy2_VF] = &&op_8xy2_VF, [OP_8xy3_VF] = &&op_8xy3_VF,
+        [OP_8xy6_VY] = &&op_8xy6_VY, [OP_8xyE_VY] = &&op_8xyE_VY, [OP_Bxnn] = &&op_Bxnn,
+        [OP_Dxyn_WRAP] = &&op_Dxyn_WRAP, [OP_Fx55_I] = &&op_Fx55_I, [OP_Fx65_I] = &&op_Fx65_I,
+        [UOP_SET_I_ADD] = &&uop_set_i_add,
+    };
+    uint64_t remaining = n;
+    block_entry *block;
+    block_uop *uop, *last;
+    uint16_t pc, address, end;
+
+    if (cache_ptr->quirks != cpu_ptr->quirks) {
+        block_cache_init(cache_ptr);
+        cache_ptr->quirks = cpu_ptr->quirks;
+    }
+
+    while (remaining > 0) {
+        pc = cpu_ptr->registers.program_counter;
+        if (pc < 0x200 || pc >= 0xFFF) {
+            execute_uncached(cpu_ptr, cache_ptr);
+            remaining--;
+            continue;
+        }
+
+        block = &cache_ptr->blocks[pc];
+        if (!block->valid) {
+            block = compile_block(cache_ptr, cpu_ptr, pc);
+        }
+        uop = &cache_ptr->pool[block->first_uop];
+        last = uop + block->uop_count - 1;
+        end = block->end;
+        if (block->instruction_count > remaining) {
+            // The budget ends inside the block, which the timer ticks make common. The micro-ops that fit run
+            // and the block stops after them: they are all body micro-ops, the terminator or store ending the
+            // block is the one that doesn't fit.
+            uint64_t fit = 0;
+            last = uop - 1;
+            while (fit + last[1].instruction_count <= remaining) {
+                last++;
+                fit += last->instruction_count;
+            }
+            if (fit == 0) {
+                execute_uncached(cpu_ptr, cache_ptr);
+                remaining--;
+                continue;
+            }
+            end = pc + 2 * fit;
+            remaining -= fit;
+        } else {
+            remaining -= block->instruction_count;
+        }
+        goto *labels[uop->kind];
+
+        // Body micro-ops leave the program counter alone, it is set once when the block ends.
+        // Terminators first point it at their own address and then run their full handler.
+#define NEXT() \
+    do { \
+        if (uop == last) { \
+            goto block_end; \
+        } \
+        uop++; \
+        goto *labels[uop->kind]; \
+    } while (0)
+#define TERMINATE() cpu_ptr->registers.program_counter = block->end - 2
+
+op_invalid: TERMINATE(); continue;
+op_00EE: TERMINATE(); _00EE(cpu_ptr); continue;
+op_1nnn: TERMINATE(); _1nnn(cpu_ptr, uop->nnn); continue;
+op_2nnn: TERMINATE(); _2nnn(cpu_ptr, uop->nnn); continue;
+op_3xkk: TERMINATE(); _3xkk(cpu_ptr, uop->x, uop->kk); continue;
+op_4xkk: TERMINATE(); _4xkk(cpu_ptr, uop->x, uop->kk); continue;
+op_5xy0: TERMINATE(); _5xy0(cpu_ptr, uop->x, uop->y); continue;
+op_9xy0: TERMINATE(); _9xy0(cpu_ptr, uop->x, uop->y); continue;
+op_Bnnn: TERMINATE(); _Bnnn(cpu_ptr, uop->nnn, 0); continue;
+op_Bxnn: TERMINATE(); _Bnnn(cpu_ptr, uop->nnn, QUIRK_JUMP_VX); continue;
+op_Ex9E: TERMINATE(); _Ex9E(cpu_ptr, uop->x); continue;
+op_ExA1: TERMINATE(); _ExA1(cpu_ptr, uop->x); continue;
+op_Fx0A: TERMINATE(); _Fx0A(cpu_ptr, uop->x); continue;
+
+op_00E0: _00E0_body(cpu_ptr); NEXT();
+op_6xkk: _6xkk_body(cpu_ptr, uop->x, uop->kk); NEXT();
+op_7xkk: _7xkk_body(cpu_ptr, uop->x, uop->kk); NEXT();
+op_8xy0: _8xy0_body(cpu_ptr, uop->x, uop->y); NEXT();
+op_8xy1: _8xy1_body(cpu_ptr, uop->x, uop->y, 0); NEXT();
+op_8xy2: _8xy2_body(cpu_ptr, uop->x, uop->y, 0); NEXT();
+op_8xy3: _8xy3_body(cpu_ptr, uop->x, uop->y, 0); NEXT();
+op_8xy4: _8xy4_body(cpu_ptr, uop->x, uop->y); NEXT();
+op_8xy5: _8xy5_body(cpu_ptr, uop->x, uop->y); NEXT();
+op_8xy6: _8xy6_body(cpu_ptr, uop->x, uop->y, 0); NEXT();
+op_8xy7: _8xy7_body(cpu_ptr, uop->x, uop->y); NEXT();
+op_8xyE: _8xyE_body(cpu_ptr, uop->x, uop->y, 0); NEXT();
+op_Annn: _Annn_body(cpu_ptr, uop->nnn); NEXT();
+op_Cxkk: _Cxkk_body(cpu_ptr, uop->x, uop->kk); NEXT();
+op_Dxyn: _Dxyn_body(cpu_ptr, uop->x, uop->y, uop->kk & 0xF, 0); NEXT();
+op_Fx07: _Fx07_body(cpu_ptr, uop->x); NEXT();
+op_Fx15: _Fx15_body(cpu_ptr, uop->x); NEXT();
+op_Fx18: _Fx18_body(cpu_ptr, uop->x); NEXT();
+op_Fx1E: _Fx1E_body(cpu_ptr, uop->x); NEXT();
+op_Fx29: _Fx29_body(cpu_ptr, uop->x); NEXT();
+op_Fx33:
+    _Fx33_body(cpu_ptr, uop->x);
+    block_cache_invalidate(cache_ptr, cpu_ptr->registers.I, 3);
+    NEXT();
+op_Fx55:
+    address = cpu_ptr->registers.I;
+    _Fx55_body(cpu_ptr, uop->x, 0);
+    block_cache_invalidate(cache_ptr, address, uop->x + 1);
+    NEXT();
+op_Fx65: _Fx65_body(cpu_ptr, uop->x, 0); NEXT();
+
+// Quirk variants, the translator only picks them when the profile has the quirk
+op_8xy1_VF: _8xy1_body(cpu_ptr, uop->x, uop->y, QUIRK_VF_RESET); NEXT();
+op_8xy2_VF: _8xy2_body(cpu_ptr, uop->x, uop->y, QUIRK_VF_RESET); NEXT();
+op_8xy3_VF: _8xy3_body(cpu_ptr, uop->x, uop->y, QUIRK_VF_RESET); NEXT();
+op_8xy6_VY: _8xy6_body(cpu_ptr, uop->x, uop->y, QUIRK_SHIFT_VY); NEXT();
+op_8xyE_VY: _8xyE_body(cpu_ptr, uop->x, uop->y, QUIRK_SHIFT_VY); NEXT();
+op_Dxyn_WRAP: _Dxyn_body(cpu_ptr, uop->x, uop->y, uop->kk & 0xF, QUIRK_WRAP_SPRITES); NEXT();
+op_Fx55_I:
+    address = cpu_ptr->registers.I;
+    _Fx55_body(cpu_ptr, uop->x, QUIRK_INCREMENT_I);
+    block_cache_invalidate(cache_ptr, address, uop->x + 1);
+    NEXT();
+op_Fx65_I: _Fx65_body(cpu_ptr, uop->x, QUIRK_INCREMENT_I); NEXT();
+uop_set_i_add:
+    cpu_ptr->registers.I = uop->nnn + cpu_ptr->registers.V[uop->x];
+    NEXT();
+
+block_end:
+        cpu_ptr->registers.program_counter = end;
+#undef NEXT
+#undef TERMINATE
+    }
+
+    cpu_ptr->cycle_count += n;
+    return n;
+}
@@ -0,0 +1,51 @@
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+// Longest run of instructions compiled into a single block
+#define BLOCK_MAX_INSTRUCTIONS 32
+// Size of the shared micro-op pool, the whole cache is flushed when it runs out
+#define BLOCK_POOL_UOPS 8192
+
+typedef struct {
+    uint16_t nnn;
+    uint8_t kind, x, y, kk; // kind is the opcode_id of the instruction or a fused superinstruction
+    uint8_t instruction_count; // Instructions the micro-op stands for, more than one when fused
+} block_uop;
+
+typedef struct {
+    uint16_t first_uop, uop_count;
+    uint16_t end; // Address right after the last instruction of the block
+    uint8_t instruction_count; // Instructions the block stands for, fused pairs count twice
+    uint8_t valid;
+} block_entry;
+
+typedef struct {
+    block_entry blocks[4096]; // Indexed by the address the block starts at
+    uint8_t covered[4096]; // Non-zero for bytes some compiled block was built from
+    block_uop pool[BLOCK_POOL_UOPS];
+    uint32_t pool_used;
+    uint8_t quirks; // Profile the blocks were translated for, their micro-ops bake its quirks in
+} block_cache;
+
+// Drops every compiled block, must be called after a ROM is loaded
+void block_cache_init(block_cache *cache_ptr);
+
+// Checks that a cache read from outside this process only holds blocks run_blocks() can execute: micro-ops
+// it has handlers for, registers in range, and entries within the pool and memory. Returns 0 when it does and -1
+// otherwise, a rejected cache has to be reset with block_cache_init().
+int block_cache_check(const block_cache *cache_ptr);
+
+// Drops the blocks built from any of the length bytes written at address
+void block_cache_invalidate(block_cache *cache_ptr, uint16_t address, uint16_t length);
+
+// Executes n instructions by running translated basic blocks. When fewer instructions are left than the next block
+// holds, it runs the micro-ops that fit and stops part way, the reference interpreter only runs an instruction
+// that is half of a fused micro-op.
+// Returns how many were executed and adds them to cycle_count.
+// The cache starts over when the CPU's quirk profile isn't the one it was translated for.
+uint64_t run_blocks(chip8_cpu *cpu_ptr, block_cache *cache_ptr, uint64_t n);
+
+#endif
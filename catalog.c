@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "chip8.h"
+#include "blocks.h"
+#include "catalog.h"
+
+#define ANALYSIS_MAGIC "C8BK"
+// Bumped whenever the block translation or the header changes, together with the cache size it rejects stale files
+#define ANALYSIS_VERSION 4
+// Magic, version, cache size, ROM hash and checksum of the memory the blocks were translated from
+#define ANALYSIS_HEADER_SIZE 28
+
+#define DEFAULT_QUIRKS "chip8"
+
+static void entry_path(const char *dir, uint64_t hash, const char *extension, char path[CATALOG_PATH_MAX]) {
+    snprintf(path, CATALOG_PATH_MAX, "%s/%016llx.%s", dir, (unsigned long long)hash, extension);
+}
+
+// Writes the file under a temporary name and renames it into place, so concurrent instances never read half a file
+static int write_file(const char *path, const void *header, size_t header_size, const void *data, size_t size) {
+    char temporary[CATALOG_PATH_MAX + 32];
+    snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path, (long)getpid());
+
+    FILE *file_ptr = fopen(temporary, "wb");
+    if (file_ptr == NULL) {
+        printf("Failed to create %s.\n", temporary);
+        return -1;
+    }
+    int written = fwrite(header, 1, header_size, file_ptr) == header_size && fwrite(data, 1, size, file_ptr) == size;
+    if (fclose(file_ptr) != 0 || !written || rename(temporary, path) != 0) {
+        printf("Failed to write %s.\n", path);
+        remove(temporary);
+        return -1;
+    }
+    return 0;
+}
+
+static int read_metadata(const char *dir, uint64_t hash, rom_metadata *metadata_ptr) {
+    char path[CATALOG_PATH_MAX], line[256];
+
+    entry_path(dir, hash, "txt", path);
+    FILE *file_ptr = fopen(path, "r");
+    if (file_ptr == NULL) {
+        return -1;
+    }
+
+    metadata_ptr->hash = hash;
+    metadata_ptr->name[0] = '\0';
+    snprintf(metadata_ptr->quirks, sizeof(metadata_ptr->quirks), "%s", DEFAULT_QUIRKS);
+    metadata_ptr->clock_hz = CHIP8_DEFAULT_CLOCK_HZ;
+    while (fgets(line, sizeof(line), file_ptr) != NULL) {
+        char key[32], value[CATALOG_NAME_MAX];
+        char *comment = strchr(line, '#');
+
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        if (sscanf(line, "%31s %63[^\n]", key, value) != 2) {
+            continue;
+        }
+        if (strcmp(key, "name") == 0) {
+            snprintf(metadata_ptr->name, sizeof(metadata_ptr->name), "%s", value);
+        } else if (strcmp(key, "quirks") == 0) {
+            snprintf(metadata_ptr->quirks, sizeof(metadata_ptr->quirks), "%s", value);
+        } else if (strcmp(key, "clock") == 0 && strtoul(value, NULL, 0) > 0) {
+            metadata_ptr->clock_hz = strtoul(value, NULL, 0);
+        }
+    }
+
+    fclose(file_ptr);
+    return 0;
+}
+
+int catalog_parse_hash(const char *name, uint64_t *hash_ptr) {
+    char *end;
+
+    if (strlen(name) != 16) {
+        return -1;
+    }
+    *hash_ptr = strtoull(name, &end, 16);
+    return *end == '\0' ? 0 : -1;
+}
+
+int catalog_add(const char *dir, const char *rom_path, const rom_mapping *rom_ptr, rom_metadata *metadata_ptr) {
+    uint64_t hash = rom_hash(rom_ptr->data, rom_ptr->size);
+    char path[CATALOG_PATH_MAX];
+
+    entry_path(dir, hash, "ch8", path);
+    if (access(path, R_OK) != 0 && write_file(path, "", 0, rom_ptr->data, rom_ptr->size) != 0) {
+        return -1;
+    }
+    if (read_metadata(dir, hash, metadata_ptr) == 0) {
+        return 0;
+    }
+
+    // The name is informational, the hash is what identifies the ROM
+    const char *name = strrchr(rom_path, '/');
+    char text[256];
+    int length = snprintf(text, sizeof(text), "name %.63s\nclock %d\nquirks %s\n",
+                          name != NULL ? name + 1 : rom_path, CHIP8_DEFAULT_CLOCK_HZ, DEFAULT_QUIRKS);
+    entry_path(dir, hash, "txt", path);
+    if (write_file(path, "", 0, text, length) != 0) {
+        return -1;
+    }
+    return read_metadata(dir, hash, metadata_ptr);
+}
+
+int catalog_open(const char *dir, uint64_t hash, rom_mapping *mapping_ptr, rom_metadata *metadata_ptr) {
+    char path[CATALOG_PATH_MAX];
+
+    entry_path(dir, hash, "ch8", path);
+    if (map_rom(path, mapping_ptr) != 0) {
+        return -1;
+    }
+    // An edited or damaged file would run with the blocks and metadata of the ROM it used to be
+    if (rom_hash(mapping_ptr->data, mapping_ptr->size) != hash) {
+        printf("ROM %s doesn't match its hash, it changed since it was cataloged.\n", path);
+        unmap_rom(mapping_ptr);
+        return -1;
+    }
+    if (read_metadata(dir, hash, metadata_ptr) != 0) {
+        printf("ROM %016llx has no metadata in %s.\n", (unsigned long long)hash, dir);
+        unmap_rom(mapping_ptr);
+        return -1;
+    }
+    return 0;
+}
+
+// The header ties the file to the translation that produced it, the layout of the cache in this build and the
+// bytes the blocks were translated from
+static void analysis_header(uint64_t hash, const uint8_t memory[4096], uint8_t header[ANALYSIS_HEADER_SIZE]) {
+    uint32_t version = ANALYSIS_VERSION, size = sizeof(block_cache);
+    uint64_t checksum = rom_hash(memory, 4096);
+
+    memcpy(header, ANALYSIS_MAGIC, 4);
+    memcpy(header + 4, &version, 4);
+    memcpy(header + 8, &size, 4);
+    // The hash catches a file copied to the wrong name, the checksum a ROM or font that changed under it
+    memcpy(header + 12, &hash, 8);
+    memcpy(header + 20, &checksum, 8);
+}
+
+int catalog_load_analysis(const char *dir, uint64_t hash, const uint8_t memory[4096], block_cache *cache_ptr) {
+    char path[CATALOG_PATH_MAX];
+    uint8_t expected[ANALYSIS_HEADER_SIZE], header[ANALYSIS_HEADER_SIZE];
+
+    entry_path(dir, hash, "blocks", path);
+    FILE *file_ptr = fopen(path, "rb");
+    if (file_ptr == NULL) {
+        return -1;
+    }
+
+    analysis_header(hash, memory, expected);
+    int complete = fread(header, 1, sizeof(header), file_ptr) == sizeof(header) &&
+                   memcmp(header, expected, sizeof(header)) == 0 &&
+                   fread(cache_ptr, 1, sizeof(block_cache), file_ptr) == sizeof(block_cache);
+    fclose(file_ptr);
+    // The blocks run as they are read, a file that passes the header can still be damaged past it
+    if (!complete || block_cache_check(cache_ptr) != 0) {
+        if (complete) {
+            printf("Ignoring the damaged blocks in %s.\n", path);
+        }
+        block_cache_init(cache_ptr);
+        return -1;
+    }
+    return 0;
+}
+
+int catalog_save_analysis(const char *dir, uint64_t hash, block_cache *cache_ptr, const uint8_t memory[4096], const uint8_t original[4096]) {
+    char path[CATALOG_PATH_MAX];
+    uint8_t header[ANALYSIS_HEADER_SIZE];
+
+    for (int address = 0; address < 4096; address++) {
+        if (memory[address] != original[address]) {
+            block_cache_invalidate(cache_ptr, address, 1);
+        }
+    }
+
+    entry_path(dir, hash, "blocks", path);
+    analysis_header(hash, original, header);
+    return write_file(path, header, sizeof(header), cache_ptr, sizeof(block_cache));
+}
@@ -0,0 +1,45 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chip8.h"
+#include "blocks.h"
+
+// A catalog is a directory of ROMs named by their rom_hash(), with everything known about a ROM beside it:
+//   <hash>.ch8     the ROM itself
+//   <hash>.txt     metadata, one "<key> <value>" pair per line (name, clock, quirks), '#' starts a comment
+//   <hash>.blocks  translated blocks of the ROM as loaded, so a known ROM starts without re-translating
+
+#define CATALOG_NAME_MAX 64
+#define CATALOG_PATH_MAX 4096
+
+typedef struct {
+    uint64_t hash;
+    char name[CATALOG_NAME_MAX]; // File name the ROM was first added under
+    char quirks[CATALOG_NAME_MAX]; // Quirk profile the ROM expects, a name quirks_parse() knows
+    uint32_t clock_hz; // Recommended instructions per second
+} rom_metadata;
+
+// Parses a hash written as 16 hex digits, returns 0 on success and -1 if the name isn't one
+int catalog_parse_hash(const char *name, uint64_t *hash_ptr);
+
+// Adds a ROM to the catalog unless one with the same contents is there already, then reads its metadata.
+// New entries are named after the file and get the default clock and quirks. Returns 0 on success and -1 on failure.
+int catalog_add(const char *dir, const char *rom_path, const rom_mapping *rom_ptr, rom_metadata *metadata_ptr);
+
+// Maps the cataloged ROM with the given hash and reads its metadata. Returns 0 on success and -1 if it isn't
+// cataloged or its contents no longer match the hash.
+int catalog_open(const char *dir, uint64_t hash, rom_mapping *mapping_ptr, rom_metadata *metadata_ptr);
+
+// Reads the persisted blocks of a ROM into the cache, memory is the ROM as loaded that they must have been translated
+// from. Every entry is checked before it can run. Returns 0 on success and -1 if there are none for this build and
+// memory, or the file is damaged: the cache is then reset.
+int catalog_load_analysis(const char *dir, uint64_t hash, const uint8_t memory[4096], block_cache *cache_ptr);
+
+// Persists the blocks of a cache that still match the ROM as loaded: blocks built from bytes that differ
+// between the current memory and the freshly loaded one are dropped from the cache first.
+// Returns 0 on success and -1 on failure.
+int catalog_save_analysis(const char *dir, uint64_t hash, block_cache *cache_ptr, const uint8_t memory[4096], const uint8_t original[4096]);
+
+#endif
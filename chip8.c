@@ -0,0 +1,564 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "chip8.h"
+#include "opcodes.h"
+#include "trace.h"
+#include "profile.h"
+
+const uint8_t chip8_font[16 * 5] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, 0x20, 0x60, 0x20, 0x20, 0x70, 0xF0, 0x10, 0xF0, 0x80, 0xF0, 0xF0, 0x10, 0xF0, 0x10, 0xF0,
+    0x90, 0x90, 0xF0, 0x10, 0x10, 0xF0, 0x80, 0xF0, 0x10, 0xF0, 0xF0, 0x80, 0xF0, 0x90, 0xF0, 0xF0, 0x10, 0x20, 0x40, 0x40,
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, 0xF0, 0x90, 0xF0, 0x10, 0xF0, 0xF0, 0x90, 0xF0, 0x90, 0x90, 0xE0, 0x90, 0xE0, 0x90, 0xE0,
+    0xF0, 0x80, 0x80, 0x80, 0xF0, 0xE0, 0x90, 0x90, 0x90, 0xE0, 0xF0, 0x80, 0xF0, 0x80, 0xF0, 0xF0, 0x80, 0xF0, 0x80, 0x80
+};
+
+chip8_cpu init(void) {
+    chip8_cpu CPU;
+
+    // Memory, display, registers, keys and counters all start at zero
+    memset(&CPU, 0, sizeof(CPU));
+    memcpy(CPU.memory, chip8_font, sizeof(chip8_font));
+    CPU.dirty_rows = 0xFFFFFFFF; // The first frame uploads the whole screen
+    CPU.registers.program_counter = 0x200;
+    CPU.clock_hz = CHIP8_DEFAULT_CLOCK_HZ;
+    CPU.quirks = QUIRKS_CHIP8;
+    seed_random(&CPU, 0);
+
+    return CPU;
+}
+
+static void copy_pages(uint8_t *memory, const uint8_t *source, uint16_t pages) {
+    while (pages != 0) {
+        int page = __builtin_ctz(pages);
+        memcpy(memory + page * CHIP8_PAGE_SIZE, source + page * CHIP8_PAGE_SIZE, CHIP8_PAGE_SIZE);
+        pages &= pages - 1;
+    }
+}
+
+// Copies every field after memory, the instrumentation attached to the destination stays
+static void copy_state(chip8_cpu *cpu_ptr, const chip8_cpu *source_ptr) {
+    const size_t start = offsetof(chip8_cpu, memory) + sizeof(cpu_ptr->memory);
+#ifdef CHIP8_TRACE
+    struct trace_ring *trace_ptr = cpu_ptr->trace_ptr;
+#endif
+#ifdef CHIP8_PROFILE
+    struct profile *profile_ptr = cpu_ptr->profile_ptr;
+#endif
+
+    memcpy((uint8_t *)cpu_ptr + start, (const uint8_t *)source_ptr + start, sizeof(chip8_cpu) - start);
+#ifdef CHIP8_TRACE
+    cpu_ptr->trace_ptr = trace_ptr;
+#endif
+#ifdef CHIP8_PROFILE
+    cpu_ptr->profile_ptr = profile_ptr;
+#endif
+}
+
+void capture_image(chip8_cpu *cpu_ptr, chip8_cpu *image_ptr) {
+    cpu_ptr->dirty_pages = 0;
+    *image_ptr = *cpu_ptr;
+}
+
+uint16_t reset_to_image(chip8_cpu *cpu_ptr, const chip8_cpu *image_ptr) {
+    uint16_t pages = cpu_ptr->dirty_pages;
+
+    copy_pages(cpu_ptr->memory, image_ptr->memory, pages);
+    copy_state(cpu_ptr, image_ptr);
+    return pages;
+}
+
+uint16_t fork_from_image(chip8_cpu *child_ptr, const chip8_cpu *parent_ptr, const chip8_cpu *image_ptr) {
+    uint16_t parent_pages = parent_ptr->dirty_pages;
+    uint16_t child_pages = child_ptr->dirty_pages & ~parent_pages;
+
+    // Pages only the child wrote go back to the image, pages the parent wrote come from the parent
+    copy_pages(child_ptr->memory, image_ptr->memory, child_pages);
+    copy_pages(child_ptr->memory, parent_ptr->memory, parent_pages);
+    copy_state(child_ptr, parent_ptr);
+    return child_pages | parent_pages;
+}
+
+uint32_t mix_seed(uint32_t seed) {
+    seed ^= seed >> 16;
+    seed *= 0x85ebca6b;
+    seed ^= seed >> 13;
+    seed *= 0xc2b2ae35;
+    seed ^= seed >> 16;
+    return seed ? seed : 1;
+}
+
+void seed_random(chip8_cpu *cpu_ptr, uint32_t seed) {
+    cpu_ptr->registers.rng = mix_seed(seed);
+}
+
+void set_quirks(chip8_cpu *cpu_ptr, quirk_profile profile) {
+    cpu_ptr->quirks = profile < QUIRKS_COUNT ? profile : QUIRKS_CHIP8;
+}
+
+int map_rom(const char *path, rom_mapping *mapping_ptr) {
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+
+    mapping_ptr->data = NULL;
+    mapping_ptr->size = 0;
+    if (fd < 0) {
+        printf("Failed to open ROM %s.\n", path);
+        return -1;
+    }
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        printf("ROM %s is not a regular file.\n", path);
+        close(fd);
+        return -1;
+    }
+    if (info.st_size == 0 || info.st_size > ROM_MAX_SIZE) {
+        printf("ROM %s is %lld bytes, it must hold 1 to %d bytes to fit above 0x200.\n", path,
+               (long long)info.st_size, ROM_MAX_SIZE);
+        close(fd);
+        return -1;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Failed to map ROM %s.\n", path);
+        return -1;
+    }
+    mapping_ptr->data = data;
+    mapping_ptr->size = info.st_size;
+    return 0;
+}
+
+void unmap_rom(rom_mapping *mapping_ptr) {
+    if (mapping_ptr->data != NULL) {
+        munmap((void *)mapping_ptr->data, mapping_ptr->size);
+    }
+    mapping_ptr->data = NULL;
+    mapping_ptr->size = 0;
+}
+
+uint64_t rom_hash(const uint8_t *data, size_t size) {
+    // 64-bit FNV-1a, like display_hash()
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+int load_rom(chip8_cpu *cpu_ptr, const char *path) {
+    rom_mapping rom;
+
+    if (map_rom(path, &rom) != 0) {
+        return -1;
+    }
+    // The program goes to 0x200, see Cowgod's Chip 8 technical reference
+    load_rom_bytes(cpu_ptr, rom.data, rom.size);
+    unmap_rom(&rom);
+    return 0;
+}
+
+
+int load_rom_bytes(chip8_cpu *cpu_ptr, const uint8_t *data, size_t size) {
+    // The program area runs from 0x200 to the end of memory
+    if (size > ROM_MAX_SIZE) {
+        return -1;
+    }
+    memcpy(cpu_ptr->memory + 0x200, data, size);
+    return 0;
+}
+
+uint64_t display_hash(const chip8_cpu *cpu_ptr) {
+    // 64-bit FNV-1a over the framebuffer rows, most significant byte first
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int row = 0; row < 32; row++) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            hash = (hash ^ ((cpu_ptr->display[row] >> shift) & 0xFF)) * 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+void display_row_to_rgb(uint64_t bits, uint8_t rgb[64 * 3]) {
+    for (int column = 0; column < 64; column++) {
+        // A lit pixel is white, all three channels get 0xFF
+        uint8_t value = (uint8_t)-(uint8_t)((bits >> (63 - column)) & 1);
+        rgb[column * 3 + 0] = rgb[column * 3 + 1] = rgb[column * 3 + 2] = value;
+    }
+}
+
+void display_to_rgb(const uint64_t display[32], uint8_t rgb[64 * 32 * 3]) {
+    for (int row = 0; row < 32; row++) {
+        display_row_to_rgb(display[row], rgb + row * 64 * 3);
+    }
+}
+
+uint16_t fetch_opcode(const chip8_cpu *cpu_ptr) {
+    // The program counter is wrapped to the 4 KB address space so a stray jump can't read past memory
+    uint16_t pc = cpu_ptr->registers.program_counter & 0xFFF;
+    // 8-bit shift to the left on the 8-byte sized region of memory pointed at by the pc to put it in the format 0xXX00
+    uint16_t left_two_nibbles = cpu_ptr->memory[pc] << 8;
+    // Move the index by 1 (8 bytes) to get the second 8-byte sized part of the instruction as 0xXX
+    uint16_t right_two_nibbles = cpu_ptr->memory[(pc + 1) & 0xFFF];
+    // Perform bitwise OR on both to get the full 16 bytes instruction
+    return left_two_nibbles | right_two_nibbles;
+}
+
+// Always inlined into its callers, which pass a constant quirk set, so each caller gets an interpreter
+// with the quirk checks folded away
+static inline __attribute__((always_inline)) void execute_with_quirks(chip8_cpu *cpu_ptr, const unsigned quirks) {
+    uint16_t opcode, lowest_12_bits;
+    uint8_t upper_byte_low_nibble, low_byte_upper_nibble, low_byte;
+
+    opcode = fetch_opcode(cpu_ptr);
+    // Get the lower 4 bits (nibble/hex digit) of the high byte through a bitwise AND and a bitwise right shift by 1 byte
+    upper_byte_low_nibble = (opcode & 0x0F00) >> 8;
+    // Get the upper 4 bits (nibble/hex digit) of the low byte through a bitwise AND and a bitwise right shift by half a byte
+    low_byte_upper_nibble = (opcode & 0x00F0) >> 4;
+    // Get the low byte and the lowest 12 bits through bitwise AND
+    lowest_12_bits = opcode & 0x0FFF;
+    low_byte = opcode & 0x00FF;
+    TRACE_BEFORE(cpu_ptr);
+    PROFILE_INSTRUCTION(cpu_ptr, opcode);
+    // Process opcode
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            switch (opcode & 0x000F) {
+                case 0x0000:
+                    _00E0(cpu_ptr);
+                    break;
+                case 0x000E:
+                    _00EE(cpu_ptr);
+                    break;
+            }
+            break;
+        case 0x1000:
+            _1nnn(cpu_ptr, lowest_12_bits);
+            break;
+        case 0x2000:
+            _2nnn(cpu_ptr, lowest_12_bits);
+            break;
+        case 0x3000:
+            _3xkk(cpu_ptr, upper_byte_low_nibble, low_byte);
+            break;
+        case 0x4000:
+            _4xkk(cpu_ptr, upper_byte_low_nibble, low_byte);
+            break;
+        case 0x5000:
+            _5xy0(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble);
+            break;
+        case 0x6000:
+            _6xkk(cpu_ptr, upper_byte_low_nibble, low_byte);
+            break;
+        case 0x7000:
+            _7xkk(cpu_ptr, upper_byte_low_nibble, low_byte);
+            break;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0000:
+                    _8xy0(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble);
+                    break;
+                case 0x0001:
+                    _8xy1(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble, quirks);
+                    break;
+                case 0x0002:
+                    _8xy2(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble, quirks);
+                    break;
+                case 0x0003:
+                    _8xy3(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble, quirks);
+                    break;
+                case 0x0004:
+                    _8xy4(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble);
+                    break;
+                case 0x0005:
+                    _8xy5(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble);
+                    break;
+                case 0x0006:
+                    _8xy6(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble, quirks);
+                    break;
+                case 0x0007:
+                    _8xy7(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble);
+                    break;
+                case 0x000E:
+                    _8xyE(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble, quirks);
+                    break;
+            }
+            break;
+        case 0x9000:
+            _9xy0(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble);
+            break;
+        case 0xA000:
+            _Annn(cpu_ptr, lowest_12_bits);
+            break;
+        case 0xB000:
+            _Bnnn(cpu_ptr, lowest_12_bits, quirks);
+            break;
+        case 0xC000:
+            _Cxkk(cpu_ptr, upper_byte_low_nibble, low_byte);
+            break;
+        case 0xD000:
+            _Dxyn(cpu_ptr, upper_byte_low_nibble, low_byte_upper_nibble, opcode & 0x000F, quirks);
+            break;
+        case 0xE000:
+            switch (opcode & 0x00FF) {
+                case 0x009E:
+                    _Ex9E(cpu_ptr, upper_byte_low_nibble);
+                    break;
+                case 0x00A1:
+                    _ExA1(cpu_ptr, upper_byte_low_nibble);
+                    break;
+            }
+            break;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0007:
+                    _Fx07(cpu_ptr, upper_byte_low_nibble);
+                    break;
+                case 0x000A:
+                    _Fx0A(cpu_ptr, upper_byte_low_nibble);
+                    break;
+                case 0x0015:
+                    _Fx15(cpu_ptr, upper_byte_low_nibble);
+                    break;
+                case 0x0018:
+                    _Fx18(cpu_ptr, upper_byte_low_nibble);
+                    break;
+                case 0x001E:
+                    _Fx1E(cpu_ptr, upper_byte_low_nibble);
+                    break;
+                case 0x0029:
+                    _Fx29(cpu_ptr, upper_byte_low_nibble);
+                    break;
+                case 0x0033:
+                    _Fx33(cpu_ptr, upper_byte_low_nibble);
+                    break;
+                case 0x0055:
+                    _Fx55(cpu_ptr, upper_byte_low_nibble, quirks);
+                    break;
+                case 0x0065:
+                    _Fx65(cpu_ptr, upper_byte_low_nibble, quirks);
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+    TRACE_AFTER(cpu_ptr, opcode);
+}
+
+void execute_instruction(chip8_cpu *cpu_ptr) {
+    switch (cpu_ptr->quirks) {
+        case QUIRKS_SCHIP:
+            execute_with_quirks(cpu_ptr, QUIRK_SET_SCHIP);
+            break;
+        case QUIRKS_XOCHIP:
+            execute_with_quirks(cpu_ptr, QUIRK_SET_XOCHIP);
+            break;
+        default:
+            execute_with_quirks(cpu_ptr, QUIRK_SET_CHIP8);
+            break;
+    }
+}
+
+static inline __attribute__((always_inline)) void step_with_quirks(chip8_cpu *cpu_ptr, uint64_t n, const unsigned quirks) {
+    for (uint64_t i = 0; i < n; i++) {
+        execute_with_quirks(cpu_ptr, quirks);
+    }
+}
+
+uint64_t step(chip8_cpu *cpu_ptr, uint64_t n) {
+    switch (cpu_ptr->quirks) {
+        case QUIRKS_SCHIP:
+            step_with_quirks(cpu_ptr, n, QUIRK_SET_SCHIP);
+            break;
+        case QUIRKS_XOCHIP:
+            step_with_quirks(cpu_ptr, n, QUIRK_SET_XOCHIP);
+            break;
+        default:
+            step_with_quirks(cpu_ptr, n, QUIRK_SET_CHIP8);
+            break;
+    }
+    cpu_ptr->cycle_count += n;
+    return n;
+}
+
+int waiting_for_key(const chip8_cpu *cpu_ptr) {
+    return cpu_ptr->key_wait && cpu_ptr->keys == cpu_ptr->key_wait_pressed;
+}
+
+void set_clock_hz(chip8_cpu *cpu_ptr, uint32_t hz) {
+    cpu_ptr->clock_hz = hz ? hz : 1;
+    cpu_ptr->timer_phase %= cpu_ptr->clock_hz;
+}
+
+uint64_t cycles_until_tick(const chip8_cpu *cpu_ptr) {
+    // Every cycle moves the phase by 60, the timers tick when it reaches clock_hz
+    return (cpu_ptr->clock_hz - cpu_ptr->timer_phase + 59) / 60;
+}
+
+void advance_timers(chip8_cpu *cpu_ptr, uint64_t cycles) {
+    uint64_t phase = cpu_ptr->timer_phase + cycles * 60;
+    // Usually zero or one tick, more for clocks below 60 Hz or cycles skipped in bulk
+    uint64_t ticks = phase / cpu_ptr->clock_hz;
+
+    cpu_ptr->timer_phase = phase % cpu_ptr->clock_hz;
+    cpu_ptr->registers.delay_timer = ticks < cpu_ptr->registers.delay_timer ? cpu_ptr->registers.delay_timer - ticks : 0;
+    cpu_ptr->registers.sound_timer = ticks < cpu_ptr->registers.sound_timer ? cpu_ptr->registers.sound_timer - ticks : 0;
+}
+
+// Smallest number of cycles after which at least the given number of timer ticks happened
+static uint64_t cycles_until_ticks(const chip8_cpu *cpu_ptr, uint64_t ticks) {
+    return (ticks * cpu_ptr->clock_hz - cpu_ptr->timer_phase + 59) / 60;
+}
+
+// Delay timer value an instruction executed after the given number of cycles reads
+static uint8_t delay_timer_after(const chip8_cpu *cpu_ptr, uint64_t cycles) {
+    uint64_t ticks = (cpu_ptr->timer_phase + cycles * 60) / cpu_ptr->clock_hz;
+    return ticks < cpu_ptr->registers.delay_timer ? cpu_ptr->registers.delay_timer - ticks : 0;
+}
+
+static uint16_t opcode_at(const chip8_cpu *cpu_ptr, uint16_t address) {
+    return (cpu_ptr->memory[address] << 8) | cpu_ptr->memory[address + 1];
+}
+
+// Returns 3 when a delay timer loop starts at the address, 1 for a jump to itself and 0 otherwise
+static int idle_loop_at(const chip8_cpu *cpu_ptr, int start) {
+    if (start < 0 || start > 4096 - 6) {
+        return 0;
+    }
+
+    uint16_t first = opcode_at(cpu_ptr, start), second = opcode_at(cpu_ptr, start + 2);
+    uint16_t x = first & 0x0F00;
+    if (first == (0x1000 | start)) {
+        return 1;
+    }
+    if ((first & 0xF0FF) == 0xF007 && opcode_at(cpu_ptr, start + 4) == (0x1000 | start) &&
+        ((second & 0xFF00) == (0x3000 | x) || (second & 0xFF00) == (0x4000 | x))) {
+        return 3;
+    }
+    return 0;
+}
+
+uint64_t skip_idle_loop(chip8_cpu *cpu_ptr, uint64_t cycles) {
+    uint16_t pc = cpu_ptr->registers.program_counter;
+    uint64_t exit = UINT64_MAX; // Cycles until an iteration starts that leaves the loop
+    uint64_t finished = 0; // Cycles spent finishing an iteration that was under way
+
+#ifdef CHIP8_TRACE
+    // Every instruction has to be traced
+    if (cpu_ptr->trace_ptr != NULL) {
+        return 0;
+    }
+#endif
+    int period = idle_loop_at(cpu_ptr, pc);
+    if (period == 0 && (idle_loop_at(cpu_ptr, pc - 2) == 3 || idle_loop_at(cpu_ptr, pc - 4) == 3)) {
+        // Entered part way, e.g. at the start of a frame. The rest of the iteration doesn't read the timer,
+        // so it runs before the ticks are accounted for.
+        finished = idle_loop_at(cpu_ptr, pc - 2) == 3 ? 2 : 1;
+        if (finished >= cycles) {
+            return 0;
+        }
+        if (finished == 2) {
+            // A 3xkk or 4xkk that skips the jump leaves the loop, the instructions after it are the caller's
+            // engine's to run: the interpreter would leave its caches stale if one of them rewrites code
+            uint16_t skip = opcode_at(cpu_ptr, pc);
+            int equal = cpu_ptr->registers.V[(skip >> 8) & 0x0F] == (skip & 0x00FF);
+            if (equal == ((skip & 0xF000) == 0x3000)) {
+                return 0;
+            }
+        }
+        // Only the skip that stays in the loop and the jump back run here
+        step(cpu_ptr, finished);
+        advance_timers(cpu_ptr, finished);
+        pc = cpu_ptr->registers.program_counter;
+        cycles -= finished;
+        period = 3;
+    }
+    if (period == 0 || cycles == 0) {
+        return finished;
+    }
+
+    uint16_t second = opcode_at(cpu_ptr, pc + 2);
+    uint8_t x = (cpu_ptr->memory[pc] & 0x0F), kk = second & 0x00FF;
+    if (period == 3) {
+        // Every iteration reads the delay timer, 3xkk leaves once it equals kk and 4xkk once it differs.
+        // The timer only counts down, so the exit is the first iteration after enough ticks.
+        uint8_t delay_timer = cpu_ptr->registers.delay_timer;
+        uint64_t ticks = 0;
+        if ((second & 0xF000) == 0x3000) {
+            if (delay_timer == kk) {
+                return finished;
+            }
+            ticks = kk < delay_timer ? delay_timer - kk : 0;
+        } else {
+            if (delay_timer != kk) {
+                return finished;
+            }
+            ticks = delay_timer > 0 ? 1 : 0;
+        }
+        if (ticks > 0) {
+            exit = (cycles_until_ticks(cpu_ptr, ticks) + period - 1) / period * period;
+            // Below 180 Hz several ticks may pass within one iteration and step over kk
+            if ((second & 0xF000) == 0x3000 && delay_timer_after(cpu_ptr, exit) != kk) {
+                exit = UINT64_MAX;
+            }
+        }
+    }
+
+    // A jump to itself changes nothing until the budget runs out
+    uint64_t skipped = exit < cycles ? exit : cycles;
+    if (skipped == 0) {
+        return finished;
+    }
+#ifdef CHIP8_PROFILE
+    // The profile counts the skipped iterations as if they ran, the host just spends no time in them
+    if (cpu_ptr->profile_ptr != NULL) {
+        for (int i = 0; i < period; i++) {
+            uint64_t count = skipped / period + ((uint64_t)i < skipped % period);
+            cpu_ptr->profile_ptr->opcode_counts[opcode_at(cpu_ptr, pc + 2 * i)] += count;
+            cpu_ptr->profile_ptr->pc_hits[pc + 2 * i] += count;
+        }
+    }
+#endif
+    if (period == 3) {
+        // Part way into an iteration, Vx holds the timer as the last Fx07 read it
+        cpu_ptr->registers.V[x] = delay_timer_after(cpu_ptr, (skipped - 1) / 3 * 3);
+        cpu_ptr->registers.program_counter = pc + 2 * (skipped % 3);
+    }
+    cpu_ptr->cycle_count += skipped;
+    cpu_ptr->idle_cycles += skipped;
+    advance_timers(cpu_ptr, skipped);
+    return finished + skipped;
+}
+
+uint64_t run_for_cycles(chip8_cpu *cpu_ptr, uint64_t cycles) {
+    // Every instruction costs a single cycle, the budget is cut at each timer tick
+    uint64_t executed = 0;
+    while (executed < cycles) {
+        uint64_t chunk = cycles - executed;
+        uint64_t skipped = skip_idle_loop(cpu_ptr, chunk);
+        if (skipped > 0) {
+            executed += skipped;
+            continue;
+        }
+        if (waiting_for_key(cpu_ptr)) {
+            // Fx0A would only spin until the keys change, the rest of the budget passes without executing it
+            cpu_ptr->cycle_count += chunk;
+            cpu_ptr->idle_cycles += chunk;
+        } else {
+            if (chunk > cycles_until_tick(cpu_ptr)) {
+                chunk = cycles_until_tick(cpu_ptr);
+            }
+            step(cpu_ptr, chunk);
+        }
+        advance_timers(cpu_ptr, chunk);
+        executed += chunk;
+    }
+    return executed;
+}
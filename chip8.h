@@ -0,0 +1,137 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "quirks.h"
+
+// Instructions per second when nothing else is configured, the timers always run at 60 Hz
+#define CHIP8_DEFAULT_CLOCK_HZ 600
+
+// Largest ROM that fits in the program area from 0x200 to the end of memory
+#define ROM_MAX_SIZE (4096 - 0x200)
+
+// Memory is tracked for resets in 16 pages of 256 bytes
+#define CHIP8_PAGE_SIZE 256
+
+// Hexadecimal digit sprites, 5 rows each, init() places them at address 0 where Fx29 points
+extern const uint8_t chip8_font[16 * 5];
+
+typedef struct {
+    uint8_t V[16], delay_timer, sound_timer;
+    uint16_t I, program_counter, stack[16], stack_ptr;
+    uint32_t rng; // xorshift32 state used by Cxkk, never zero
+} cpu_registers;
+
+typedef struct {
+    uint8_t memory[4096];
+    uint16_t keys; // Bit n set while key n is held down
+    uint16_t key_wait_pressed; // Keys seen down since Fx0A started waiting
+    uint8_t key_wait; // 1 while Fx0A blocks until a key is pressed and released
+    uint64_t display[32]; // One word per row, bit 63 is the leftmost pixel
+    uint32_t dirty_rows; // Bit n set when row n changed since the frontend last took the frame
+    uint16_t dirty_pages; // Bit n set when Fx33/Fx55 stored to memory page n since the CPU left its golden image
+    cpu_registers registers;
+    uint64_t cycle_count; // Total number of instructions executed since init()
+    uint64_t idle_cycles; // Part of cycle_count fast-forwarded through idle loops and key waits instead of executed
+    uint32_t clock_hz; // Emulated instructions per second
+    uint32_t timer_phase; // Progress towards the next 60 Hz timer tick, in 1/60 cycles, always below clock_hz
+    uint8_t quirks; // quirk_profile the program expects
+#ifdef CHIP8_TRACE
+    struct trace_ring *trace_ptr; // Receives a record for every instruction when not NULL
+#endif
+#ifdef CHIP8_PROFILE
+    struct profile *profile_ptr; // Counts every instruction when not NULL
+#endif
+} chip8_cpu;
+
+// Returns a zeroed CPU with the font loaded and the program counter at the start of the program area (0x200)
+chip8_cpu init(void);
+
+// Copies a freshly loaded and configured CPU into image_ptr, the golden image instances reset and fork from.
+// The CPU itself counts as an untouched copy of the image from then on.
+void capture_image(chip8_cpu *cpu_ptr, chip8_cpu *image_ptr);
+
+// Puts a CPU that started as a copy of image_ptr back into that state. Only the memory pages the program
+// dirtied are copied back, along with the few hundred bytes of registers, display and counters.
+// Returns the pages restored, engine caches must drop what they decoded from them.
+uint16_t reset_to_image(chip8_cpu *cpu_ptr, const chip8_cpu *image_ptr);
+
+// Turns child_ptr into a copy of parent_ptr, both started as copies of image_ptr. Pages neither of them dirtied
+// already match and are not copied, so a fork costs the pages that differ. Returns the pages rewritten.
+uint16_t fork_from_image(chip8_cpu *child_ptr, const chip8_cpu *parent_ptr, const chip8_cpu *image_ptr);
+
+// Murmur3 finalizer, spreads consecutive seeds over the whole state space (xorshift needs a non-zero state)
+uint32_t mix_seed(uint32_t seed);
+
+// Seeds the random number generator of Cxkk. init() seeds it with 0.
+void seed_random(chip8_cpu *cpu_ptr, uint32_t seed);
+
+// Selects the quirk profile the engines run the program with, init() selects QUIRKS_CHIP8
+void set_quirks(chip8_cpu *cpu_ptr, quirk_profile profile);
+
+// A ROM file mapped read-only, pages are shared by every instance loading the same file
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+} rom_mapping;
+
+// Maps the ROM at path after checking it fits in the program area, returns 0 on success and -1 on failure
+int map_rom(const char *path, rom_mapping *mapping_ptr);
+void unmap_rom(rom_mapping *mapping_ptr);
+
+// 64-bit FNV-1a of the ROM contents, the key ROMs are cataloged by
+uint64_t rom_hash(const uint8_t *data, size_t size);
+
+// Copies the ROM at path into memory starting at 0x200, returns 0 on success and -1 on failure
+int load_rom(chip8_cpu *cpu_ptr, const char *path);
+
+// Copies an in-memory ROM image to 0x200, returns -1 if it does not fit in the program area
+int load_rom_bytes(chip8_cpu *cpu_ptr, const uint8_t *data, size_t size);
+
+// Hash of the framebuffer contents, used to compare runs
+uint64_t display_hash(const chip8_cpu *cpu_ptr);
+
+// Expands one packed row to 64 RGB pixels, white where the pixel is lit
+void display_row_to_rgb(uint64_t bits, uint8_t rgb[64 * 3]);
+
+// Expands the packed framebuffer to 64 x 32 RGB pixels, row by row from the top-left corner.
+// Only called when a frame is presented, the emulation itself never touches the RGB image.
+void display_to_rgb(const uint64_t display[32], uint8_t rgb[64 * 32 * 3]);
+
+// Reads the 16-bit instruction the program counter currently points at, without executing it
+uint16_t fetch_opcode(const chip8_cpu *cpu_ptr);
+
+// Reference interpreter: fetches, decodes and executes the instruction at the program counter.
+// It does not touch cycle_count, callers account for the instructions they execute.
+// There is one copy of the interpreter per quirk profile, this picks the CPU's.
+void execute_instruction(chip8_cpu *cpu_ptr);
+
+// Fetches, decodes and executes n instructions and returns how many were executed.
+// The profile is picked once, the loop runs the interpreter copy specialized for it.
+uint64_t step(chip8_cpu *cpu_ptr, uint64_t n);
+
+// True while Fx0A waits and no key changed since it last ran, executing further instructions would change nothing
+int waiting_for_key(const chip8_cpu *cpu_ptr);
+
+// Recognizes the spin loops that wait for a timer without side effects: "Fx07, 3xkk, 1nnn" and "Fx07, 4xkk, 1nnn"
+// jumping back to the Fx07, and "1nnn" jumping to itself. When the program counter is at the start of one, the
+// cycles until the loop exits (at most the budget) pass at once: the timers advance, the program counter and Vx
+// end up where executing the loop would have left them. Entered part way, it finishes the iteration only when
+// that stays in the loop: nothing after the exit runs here. Returns the cycles skipped, 0 when not at an idle loop.
+uint64_t skip_idle_loop(chip8_cpu *cpu_ptr, uint64_t cycles);
+
+// Sets the emulated clock rate, the timers keep ticking 60 times per emulated second
+void set_clock_hz(chip8_cpu *cpu_ptr, uint32_t hz);
+
+// Number of instructions left before the delay and sound timers tick next
+uint64_t cycles_until_tick(const chip8_cpu *cpu_ptr);
+
+// Accounts for executed cycles and ticks the timers once for every tick boundary they crossed
+void advance_timers(chip8_cpu *cpu_ptr, uint64_t cycles);
+
+// Advances the machine by a budget of cycles with the reference interpreter, ticking the timers on the way.
+// Returns how many cycles were consumed.
+uint64_t run_for_cycles(chip8_cpu *cpu_ptr, uint64_t cycles);
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "chip8.h"
+#include "engine.h"
+#include "lanes.h"
+#include "env_batch.h"
+
+// Instances a case runs in with -e envs, enough to give every worker thread a few
+#define CONFORMANCE_ENVS 64
+
+// Runs every ROM of a manifest with one engine, in the SIMD lanes or in a batch of environments, and compares the framebuffer hash it ends with.
+// The test ROMs check their own results and draw the number of checks that passed, so a wrong flag or a
+// store past the end of an array shows up as a different picture.
+
+typedef struct {
+    char rom[256];
+    quirk_profile quirks;
+    uint64_t cycles;
+    uint64_t hash;
+    uint32_t clock_hz;
+} conformance_case;
+
+static void usage(const char *program) {
+    printf("Usage: %s [-e interp|threaded|blocks|lanes|envs] manifest\n", program);
+    printf("  The manifest has one \"<rom> <quirks> <cycles> <display hash> [clock_hz]\" case per line, ROM paths are\n");
+    printf("  relative to it. Cases run frame by frame at the clock, %u Hz when it is left out.\n", CHIP8_DEFAULT_CLOCK_HZ);
+}
+
+// Prints the framebuffer so a failing case shows what the ROM drew
+static void print_display(const uint64_t display[32]) {
+    for (int row = 0; row < 32; row++) {
+        char line[65];
+        for (int column = 0; column < 64; column++) {
+            line[column] = (display[row] >> (63 - column)) & 1 ? '#' : '.';
+        }
+        line[64] = '\0';
+        printf("    %s\n", line);
+    }
+}
+
+static uint64_t hash_display(const uint64_t display[32]) {
+    chip8_cpu cpu;
+    memcpy(cpu.display, display, sizeof(cpu.display));
+    return display_hash(&cpu);
+}
+
+// Cycles of the given frame, carrying the remainder of clocks that aren't a multiple of 60 Hz like env_batch does
+static uint64_t frame_cycles(const conformance_case *case_ptr, uint64_t frame) {
+    return (frame + 1) * case_ptr->clock_hz / 60 - frame * case_ptr->clock_hz / 60;
+}
+
+// Runs the case in a batch of environments. The instances share nothing but the golden image, so they all have
+// to draw the same picture. Cases with an even number of frames run in two steps: the odd instances hold every
+// key down for the first and then fork from instance 0, which holds none, so they only draw the expected
+// picture if the fork undid all the keys changed.
+static int run_envs(const conformance_case *case_ptr, const uint8_t *rom, size_t size, uint64_t display[32]) {
+    static uint64_t displays[CONFORMANCE_ENVS * 32];
+    static uint16_t actions[CONFORMANCE_ENVS];
+    static chip8_cpu parent;
+    uint64_t frames = case_ptr->cycles * 60 / case_ptr->clock_hz;
+    int steps = frames % 2 == 0 ? 2 : 1, status = 0;
+    env_batch batch;
+    env_config config;
+    env_outputs outputs = { displays, NULL, NULL };
+
+    env_config_default(&config);
+    config.clock_hz = case_ptr->clock_hz;
+    config.frame_skip = (int)(frames / steps);
+    config.quirks = case_ptr->quirks;
+    config.threads = 4;
+    if (env_batch_init(&batch, rom, size, CONFORMANCE_ENVS, &config) != 0) {
+        return -1;
+    }
+    if (steps == 2) {
+        for (int n = 1; n < CONFORMANCE_ENVS; n += 2) {
+            actions[n] = 0xFFFF;
+        }
+        env_batch_step(&batch, actions, &outputs);
+        parent = batch.cpus[0];
+        for (int n = 1; n < CONFORMANCE_ENVS; n += 2) {
+            env_batch_fork(&batch, n, 0);
+            if (!cpu_state_equal(&batch.cpus[n], &parent) || batch.cpus[n].dirty_pages != parent.dirty_pages) {
+                printf("  environment %d differs from a full copy of environment 0 after forking from it\n", n);
+                status = -1;
+            }
+        }
+    }
+    env_batch_step(&batch, NULL, &outputs);
+    env_batch_free(&batch);
+
+    memcpy(display, displays, 32 * sizeof(uint64_t));
+    for (int n = 1; n < CONFORMANCE_ENVS; n++) {
+        if (memcmp(displays + n * 32, display, 32 * sizeof(uint64_t)) != 0) {
+            printf("  environment %d drew a different picture than environment 0\n", n);
+            memset(display, 0, 32 * sizeof(uint64_t));
+        }
+    }
+    return status;
+}
+
+// Runs a case frame by frame like the frontend, with the timers ticking, and fills display with the final
+// framebuffer. Returns 0 on success and -1 when the ROM can't run.
+static int run_case(const conformance_case *case_ptr, const uint8_t *rom, size_t size, int lanes, int envs,
+                    engine_kind kind, uint64_t display[32]) {
+    if (envs) {
+        return run_envs(case_ptr, rom, size, display);
+    }
+    if (lanes) {
+        chip8_lanes *lanes_ptr = lanes_create();
+        if (lanes_ptr == NULL || lanes_init(lanes_ptr, rom, size, 0, case_ptr->quirks) != 0) {
+            lanes_destroy(lanes_ptr);
+            return -1;
+        }
+        lanes_set_clock_hz(lanes_ptr, case_ptr->clock_hz);
+        for (uint64_t frame = 0; frame < case_ptr->cycles * 60 / case_ptr->clock_hz; frame++) {
+            run_lanes(lanes_ptr, frame_cycles(case_ptr, frame));
+        }
+        lanes_display(lanes_ptr, 0, display);
+        // Every lane runs the same program on the same input
+        for (int lane = 1; lane < CHIP8_LANES; lane++) {
+            uint64_t other[32];
+            lanes_display(lanes_ptr, lane, other);
+            if (memcmp(other, display, sizeof(other)) != 0) {
+                printf("  lane %d drew a different picture than lane 0\n", lane);
+                memset(display, 0, 32 * sizeof(uint64_t));
+            }
+        }
+        lanes_destroy(lanes_ptr);
+        return 0;
+    }
+
+    chip8_engine engine;
+    static chip8_cpu cpu;
+    if (engine_init(&engine, kind) != 0) {
+        return -1;
+    }
+    cpu = init();
+    set_clock_hz(&cpu, case_ptr->clock_hz);
+    set_quirks(&cpu, case_ptr->quirks);
+    if (load_rom_bytes(&cpu, rom, size) != 0) {
+        engine_free(&engine);
+        return -1;
+    }
+    // Budgets end part way into idle loops, the next frame has to finish them with the engine's caches in sync
+    for (uint64_t frame = 0; frame < case_ptr->cycles * 60 / case_ptr->clock_hz; frame++) {
+        engine_run_for_cycles(&engine, &cpu, frame_cycles(case_ptr, frame));
+    }
+    memcpy(display, cpu.display, sizeof(cpu.display));
+    engine_free(&engine);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    engine_kind kind = ENGINE_INTERPRETER;
+    int lanes = 0, envs = 0, option;
+
+    while ((option = getopt(argc, argv, "e:h")) != -1) {
+        switch (option) {
+            case 'e':
+                if (strcmp(optarg, "lanes") == 0) {
+                    lanes = 1;
+                } else if (strcmp(optarg, "envs") == 0) {
+                    envs = 1;
+                } else if (engine_parse(optarg, &kind) != 0) {
+                    printf("Unknown engine %s.\n", optarg);
+                    return -1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    const char *manifest_path = argv[optind];
+    FILE *file_ptr = fopen(manifest_path, "r");
+    if (file_ptr == NULL) {
+        printf("Failed to open manifest %s.\n", manifest_path);
+        return -1;
+    }
+
+    // ROM paths are relative to the directory of the manifest
+    char dir[4096];
+    const char *slash = strrchr(manifest_path, '/');
+    snprintf(dir, sizeof(dir), "%.*s", slash != NULL ? (int)(slash - manifest_path + 1) : 0, manifest_path);
+
+    char line[1024], quirks_name[32];
+    int passed = 0, failed = 0;
+    while (fgets(line, sizeof(line), file_ptr) != NULL) {
+        conformance_case test;
+        unsigned long long cycles, hash;
+        unsigned clock_hz = CHIP8_DEFAULT_CLOCK_HZ;
+        char *comment = strchr(line, '#');
+
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        int fields = sscanf(line, "%255s %31s %llu %llx %u", test.rom, quirks_name, &cycles, &hash, &clock_hz);
+        if (fields <= 0) {
+            continue;
+        }
+        if (fields < 4 || quirks_parse(quirks_name, &test.quirks) != 0 || clock_hz == 0) {
+            printf("Manifest %s: expected \"<rom> <chip8|schip|xochip> <cycles> <display hash> [clock_hz]\".\n",
+                   manifest_path);
+            fclose(file_ptr);
+            return -1;
+        }
+        // Cases end at a frame boundary, so every way of running them executes the same cycles
+        if (cycles * 60 % clock_hz != 0) {
+            printf("Manifest %s: %s runs %llu cycles, not a whole number of frames at %u Hz.\n", manifest_path,
+                   test.rom, cycles, clock_hz);
+            fclose(file_ptr);
+            return -1;
+        }
+        test.cycles = cycles;
+        test.hash = hash;
+        test.clock_hz = clock_hz;
+
+        char path[4096 + 256];
+        rom_mapping rom;
+        uint64_t display[32];
+        snprintf(path, sizeof(path), "%s%s", dir, test.rom);
+        if (map_rom(path, &rom) != 0) {
+            failed++;
+            continue;
+        }
+        int status = run_case(&test, rom.data, rom.size, lanes, envs, kind, display);
+        unmap_rom(&rom);
+
+        uint64_t actual = hash_display(display);
+        if (status == 0 && actual == test.hash) {
+            passed++;
+            continue;
+        }
+        failed++;
+        printf("FAIL %s (%s, %llu cycles): display hash %016llx, expected %016llx\n", test.rom, quirks_name,
+               cycles, (unsigned long long)actual, hash);
+        print_display(display);
+    }
+    fclose(file_ptr);
+
+    printf("Engine: %s\n", envs ? "envs" : lanes ? "lanes" : engine_name(kind));
+    printf("Conformance: %d of %d cases passed\n", passed, passed + failed);
+    return failed == 0 && passed > 0 ? 0 : -1;
+}
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "chip8.h"
+#include "engine.h"
+#include "disasm.h"
+#include "debugger.h"
+
+// Continuing without a cycle count runs at most this many emulated seconds
+#define CONTINUE_SECONDS 10
+
+void debugger_init(debugger *debugger_ptr) {
+    memset(debugger_ptr, 0, sizeof(*debugger_ptr));
+}
+
+int debugger_active(const debugger *debugger_ptr) {
+    return debugger_ptr->breakpoint_count > 0 || debugger_ptr->watch_count > 0 || debugger_ptr->watch_i ||
+           debugger_ptr->condition_count > 0;
+}
+
+void debugger_set_breakpoint(debugger *debugger_ptr, uint16_t address, int enabled) {
+    uint64_t bit = 1ULL << (address & 63);
+    uint64_t *word = &debugger_ptr->breakpoints[(address & 0xFFF) >> 6];
+
+    if (enabled && !(*word & bit)) {
+        *word |= bit;
+        debugger_ptr->breakpoint_count++;
+    } else if (!enabled && (*word & bit)) {
+        *word &= ~bit;
+        debugger_ptr->breakpoint_count--;
+    }
+}
+
+int debugger_add_watch(debugger *debugger_ptr, uint16_t start, uint16_t end, uint8_t access) {
+    if (debugger_ptr->watch_count == DEBUGGER_MAX_WATCHES) {
+        return -1;
+    }
+    watchpoint *watch_ptr = &debugger_ptr->watches[debugger_ptr->watch_count++];
+    watch_ptr->start = start & 0xFFF;
+    watch_ptr->end = end & 0xFFF;
+    watch_ptr->access = access;
+    return 0;
+}
+
+int debugger_add_condition(debugger *debugger_ptr, uint8_t reg, condition_op op, uint16_t value) {
+    if (debugger_ptr->condition_count == DEBUGGER_MAX_CONDITIONS) {
+        return -1;
+    }
+    break_condition *condition_ptr = &debugger_ptr->conditions[debugger_ptr->condition_count++];
+    condition_ptr->reg = reg;
+    condition_ptr->op = op;
+    condition_ptr->value = value;
+    return 0;
+}
+
+static uint16_t register_value(const chip8_cpu *cpu_ptr, uint8_t reg) {
+    switch (reg) {
+        case COND_REG_I:
+            return cpu_ptr->registers.I;
+        case COND_REG_DT:
+            return cpu_ptr->registers.delay_timer;
+        case COND_REG_ST:
+            return cpu_ptr->registers.sound_timer;
+        default:
+            return cpu_ptr->registers.V[reg & 0xF];
+    }
+}
+
+static int condition_holds(const debugger *debugger_ptr, const chip8_cpu *cpu_ptr) {
+    for (int i = 0; i < debugger_ptr->condition_count; i++) {
+        const break_condition *condition_ptr = &debugger_ptr->conditions[i];
+        uint16_t value = register_value(cpu_ptr, condition_ptr->reg);
+        switch (condition_ptr->op) {
+            case COND_EQ:
+                if (value == condition_ptr->value) {
+                    return 1;
+                }
+                break;
+            case COND_NE:
+                if (value != condition_ptr->value) {
+                    return 1;
+                }
+                break;
+            case COND_LT:
+                if (value < condition_ptr->value) {
+                    return 1;
+                }
+                break;
+            case COND_GT:
+                if (value > condition_ptr->value) {
+                    return 1;
+                }
+                break;
+        }
+    }
+    return 0;
+}
+
+// Number of bytes from I the memory opcodes access, 0 for every other opcode
+static int memory_access(uint16_t opcode, uint8_t *access_ptr) {
+    uint8_t x = (opcode & 0x0F00) >> 8;
+
+    if ((opcode & 0xF000) == 0xD000) {
+        *access_ptr = WATCH_READ;
+        return opcode & 0x000F;
+    }
+    switch (opcode & 0xF0FF) {
+        case 0xF033:
+            *access_ptr = WATCH_WRITE;
+            return 3;
+        case 0xF055:
+            *access_ptr = WATCH_WRITE;
+            return x + 1;
+        case 0xF065:
+            *access_ptr = WATCH_READ;
+            return x + 1;
+    }
+    return 0;
+}
+
+// Returns the stop reason when the opcode about to run accesses a watched byte, STOP_NONE otherwise
+static stop_reason check_watches(debugger *debugger_ptr, const chip8_cpu *cpu_ptr, uint16_t opcode) {
+    uint8_t access;
+    int length = memory_access(opcode, &access);
+
+    for (int i = 0; i < length; i++) {
+        // Same wrap around the end of memory as the handlers
+        uint16_t address = (cpu_ptr->registers.I + i) & 0xFFF;
+        for (int w = 0; w < debugger_ptr->watch_count; w++) {
+            const watchpoint *watch_ptr = &debugger_ptr->watches[w];
+            if ((watch_ptr->access & access) && address >= watch_ptr->start && address <= watch_ptr->end) {
+                debugger_ptr->stop_address = address;
+                return access == WATCH_WRITE ? STOP_WATCH_WRITE : STOP_WATCH_READ;
+            }
+        }
+    }
+    return STOP_NONE;
+}
+
+uint64_t debugger_run(debugger *debugger_ptr, chip8_cpu *cpu_ptr, uint64_t cycles) {
+    uint64_t executed = 0;
+
+    debugger_ptr->reason = STOP_NONE;
+    while (executed < cycles) {
+        uint16_t pc = cpu_ptr->registers.program_counter & 0xFFF;
+
+        if (waiting_for_key(cpu_ptr)) {
+            debugger_ptr->reason = STOP_KEY_WAIT;
+            break;
+        }
+        if (executed > 0) {
+            if ((debugger_ptr->breakpoints[pc >> 6] >> (pc & 63)) & 1) {
+                debugger_ptr->reason = STOP_BREAKPOINT;
+                debugger_ptr->stop_address = pc;
+                break;
+            }
+            if (debugger_ptr->condition_count > 0 && condition_holds(debugger_ptr, cpu_ptr)) {
+                debugger_ptr->reason = STOP_CONDITION;
+                debugger_ptr->stop_address = pc;
+                break;
+            }
+            if (debugger_ptr->watch_count > 0 &&
+                (debugger_ptr->reason = check_watches(debugger_ptr, cpu_ptr, fetch_opcode(cpu_ptr))) != STOP_NONE) {
+                break;
+            }
+        }
+
+        uint16_t I = cpu_ptr->registers.I;
+        step(cpu_ptr, 1);
+        advance_timers(cpu_ptr, 1);
+        executed++;
+        if (debugger_ptr->watch_i && cpu_ptr->registers.I != I) {
+            debugger_ptr->reason = STOP_WATCH_I;
+            debugger_ptr->stop_address = cpu_ptr->registers.I;
+            break;
+        }
+    }
+    return executed;
+}
+
+static void print_instruction(const chip8_cpu *cpu_ptr, uint16_t address) {
+    uint16_t opcode = (cpu_ptr->memory[address & 0xFFF] << 8) | cpu_ptr->memory[(address + 1) & 0xFFF];
+    char text[32];
+
+    disassemble(opcode, text, sizeof(text));
+    printf("%c %03X  %04X  %s\n", address == cpu_ptr->registers.program_counter ? '>' : ' ', address & 0xFFF, opcode, text);
+}
+
+static void print_registers(const chip8_cpu *cpu_ptr) {
+    const cpu_registers *r = &cpu_ptr->registers;
+
+    printf("PC=%03X I=%03X SP=%X DT=%02X ST=%02X keys=%04X cycles=%llu\n", r->program_counter, r->I, r->stack_ptr,
+           r->delay_timer, r->sound_timer, cpu_ptr->keys, (unsigned long long)cpu_ptr->cycle_count);
+    for (int i = 0; i < 16; i++) {
+        printf("V%X=%02X%c", i, r->V[i], i == 7 || i == 15 ? '\n' : ' ');
+    }
+}
+
+static void print_memory(const chip8_cpu *cpu_ptr, uint16_t address, int length) {
+    for (int i = 0; i < length; i++) {
+        if (i % 16 == 0) {
+            printf("%s%03X ", i ? "\n" : "", (address + i) & 0xFFF);
+        }
+        printf(" %02X", cpu_ptr->memory[(address + i) & 0xFFF]);
+    }
+    printf("\n");
+}
+
+static void print_stop(const debugger *debugger_ptr, const chip8_cpu *cpu_ptr, uint64_t executed) {
+    switch (debugger_ptr->reason) {
+        case STOP_NONE:
+            printf("Ran %llu cycles\n", (unsigned long long)executed);
+            break;
+        case STOP_BREAKPOINT:
+            printf("Breakpoint at %03X after %llu cycles\n", debugger_ptr->stop_address, (unsigned long long)executed);
+            break;
+        case STOP_WATCH_READ:
+        case STOP_WATCH_WRITE:
+            printf("%s of watched %03X after %llu cycles\n", debugger_ptr->reason == STOP_WATCH_READ ? "Read" : "Write",
+                   debugger_ptr->stop_address, (unsigned long long)executed);
+            break;
+        case STOP_WATCH_I:
+            printf("I changed to %03X after %llu cycles\n", debugger_ptr->stop_address, (unsigned long long)executed);
+            break;
+        case STOP_CONDITION:
+            printf("Condition met after %llu cycles\n", (unsigned long long)executed);
+            break;
+        case STOP_KEY_WAIT:
+            printf("Waiting for a key after %llu cycles, press one with k\n", (unsigned long long)executed);
+            break;
+    }
+    print_instruction(cpu_ptr, cpu_ptr->registers.program_counter);
+}
+
+static int parse_register(const char *name, uint8_t *reg_ptr) {
+    if (strcasecmp(name, "i") == 0) {
+        *reg_ptr = COND_REG_I;
+    } else if (strcasecmp(name, "dt") == 0) {
+        *reg_ptr = COND_REG_DT;
+    } else if (strcasecmp(name, "st") == 0) {
+        *reg_ptr = COND_REG_ST;
+    } else if ((name[0] == 'v' || name[0] == 'V') && name[1] != '\0' && name[2] == '\0' && strchr("0123456789abcdefABCDEF", name[1])) {
+        *reg_ptr = (uint8_t)strtoul(name + 1, NULL, 16);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_op(const char *text, condition_op *op_ptr) {
+    static const char *names[] = { "==", "!=", "<", ">" };
+
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(text, names[i]) == 0) {
+            *op_ptr = (condition_op)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void print_help(void) {
+    printf("b addr                 break when the program counter reaches addr\n");
+    printf("d addr                 delete the breakpoint at addr\n");
+    printf("w start [end] [r|w|rw] break on Fx33/Fx55/Fx65/Dxyn accesses to the range, both kinds by default\n");
+    printf("wi                     break after every instruction that changes I\n");
+    printf("if reg op value        break when the condition holds: reg is V0-VF, I, DT or ST, op is == != < >\n");
+    printf("clear                  delete every breakpoint, watchpoint and condition\n");
+    printf("s [n]                  step n instructions (1)\n");
+    printf("c [cycles]             continue until a break, or for %d emulated seconds\n", CONTINUE_SECONDS);
+    printf("k [key]                hold a hex key down, or release every key\n");
+    printf("r                      show the registers\n");
+    printf("m addr [length]        dump memory (64 bytes)\n");
+    printf("l [addr] [count]       disassemble from addr (the program counter) (8)\n");
+    printf("q                      quit\n");
+    printf("Numbers are decimal, or hexadecimal with a 0x prefix\n");
+}
+
+void debugger_repl(debugger *debugger_ptr, chip8_cpu *cpu_ptr, chip8_engine *engine_ptr, FILE *input_ptr) {
+    int interactive = isatty(fileno(input_ptr));
+    char line[256];
+
+    print_instruction(cpu_ptr, cpu_ptr->registers.program_counter);
+    for (;;) {
+        char command[16], first[32], second[32], third[32];
+        if (interactive) {
+            printf("(chip8) ");
+            fflush(stdout);
+        }
+        if (fgets(line, sizeof(line), input_ptr) == NULL) {
+            break;
+        }
+
+        int fields = sscanf(line, "%15s %31s %31s %31s", command, first, second, third);
+        if (fields <= 0) {
+            continue;
+        }
+        uint64_t a = fields > 1 ? strtoull(first, NULL, 0) : 0;
+        uint64_t b = fields > 2 ? strtoull(second, NULL, 0) : 0;
+
+        if (strcmp(command, "q") == 0) {
+            break;
+        } else if (strcmp(command, "h") == 0) {
+            print_help();
+        } else if (strcmp(command, "b") == 0 && fields == 2) {
+            debugger_set_breakpoint(debugger_ptr, a, 1);
+        } else if (strcmp(command, "d") == 0 && fields == 2) {
+            debugger_set_breakpoint(debugger_ptr, a, 0);
+        } else if (strcmp(command, "w") == 0 && fields >= 2) {
+            // The access kind may follow the start address directly
+            const char *kind = "rw";
+            uint16_t end = a;
+            if (fields == 3 && !isdigit((unsigned char)second[0])) {
+                kind = second;
+            } else if (fields >= 3) {
+                end = b;
+                kind = fields == 4 ? third : kind;
+            }
+            uint8_t access = (strchr(kind, 'r') ? WATCH_READ : 0) | (strchr(kind, 'w') ? WATCH_WRITE : 0);
+            if (access == 0 || debugger_add_watch(debugger_ptr, a, end, access) != 0) {
+                printf("Can't add the watchpoint.\n");
+            }
+        } else if (strcmp(command, "wi") == 0) {
+            debugger_ptr->watch_i = 1;
+        } else if (strcmp(command, "if") == 0 && fields == 4) {
+            uint8_t reg;
+            condition_op op;
+            if (parse_register(first, &reg) != 0 || parse_op(second, &op) != 0 ||
+                debugger_add_condition(debugger_ptr, reg, op, (uint16_t)strtoul(third, NULL, 0)) != 0) {
+                printf("Can't add the condition.\n");
+            }
+        } else if (strcmp(command, "clear") == 0) {
+            debugger_init(debugger_ptr);
+        } else if (strcmp(command, "s") == 0) {
+            run_for_cycles(cpu_ptr, fields > 1 ? a : 1);
+            // Code the interpreter stored over is unknown to the engine caches
+            engine_reset(engine_ptr);
+            print_instruction(cpu_ptr, cpu_ptr->registers.program_counter);
+        } else if (strcmp(command, "c") == 0) {
+            uint64_t cycles = fields > 1 ? a : (uint64_t)cpu_ptr->clock_hz * CONTINUE_SECONDS, executed;
+            if (debugger_active(debugger_ptr)) {
+                executed = debugger_run(debugger_ptr, cpu_ptr, cycles);
+                engine_reset(engine_ptr);
+            } else {
+                executed = engine_run_for_cycles(engine_ptr, cpu_ptr, cycles);
+                debugger_ptr->reason = STOP_NONE;
+            }
+            print_stop(debugger_ptr, cpu_ptr, executed);
+        } else if (strcmp(command, "k") == 0) {
+            cpu_ptr->keys = fields > 1 ? 1 << (strtoul(first, NULL, 16) & 0xF) : 0;
+        } else if (strcmp(command, "r") == 0) {
+            print_registers(cpu_ptr);
+        } else if (strcmp(command, "m") == 0 && fields >= 2) {
+            print_memory(cpu_ptr, a, fields > 2 ? (int)b : 64);
+        } else if (strcmp(command, "l") == 0) {
+            uint16_t address = fields > 1 ? a : cpu_ptr->registers.program_counter;
+            for (int i = 0; i < (fields > 2 ? (int)b : 8); i++) {
+                print_instruction(cpu_ptr, address + 2 * i);
+            }
+        } else {
+            printf("Unknown command, h lists them.\n");
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "chip8.h"
+#include "engine.h"
+
+#define DEBUGGER_MAX_WATCHES 16
+#define DEBUGGER_MAX_CONDITIONS 16
+
+// Access bits of a watchpoint
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+
+// Registers a condition can test besides V0 to VF
+enum { COND_REG_I = 16, COND_REG_DT, COND_REG_ST };
+
+typedef enum { COND_EQ, COND_NE, COND_LT, COND_GT } condition_op;
+
+typedef enum {
+    STOP_NONE, // The budget ran out
+    STOP_BREAKPOINT,
+    STOP_WATCH_READ, // The next instruction reads a watched byte
+    STOP_WATCH_WRITE, // The next instruction writes a watched byte
+    STOP_WATCH_I, // The last instruction changed I
+    STOP_CONDITION,
+    STOP_KEY_WAIT // Fx0A waits for a key that never comes without a frontend
+} stop_reason;
+
+typedef struct {
+    uint16_t start, end; // Inclusive range of addresses
+    uint8_t access; // WATCH_READ and/or WATCH_WRITE
+} watchpoint;
+
+typedef struct {
+    uint8_t reg; // 0 to 15 for V0 to VF, or one of the COND_REG_ values
+    uint8_t op; // condition_op
+    uint16_t value;
+} break_condition;
+
+typedef struct {
+    uint64_t breakpoints[4096 / 64]; // Bit per address, tested once per instruction by debugger_run()
+    int breakpoint_count;
+    watchpoint watches[DEBUGGER_MAX_WATCHES];
+    int watch_count;
+    int watch_i; // Stop after every instruction that changes I
+    break_condition conditions[DEBUGGER_MAX_CONDITIONS];
+    int condition_count;
+    stop_reason reason; // Why the last debugger_run() returned
+    uint16_t stop_address; // Memory address of a watch stop, the breakpoint address otherwise
+} debugger;
+
+void debugger_init(debugger *debugger_ptr);
+
+// True when any breakpoint, watchpoint or condition is set. Otherwise runs go through the normal engines
+// at full speed, the checks only exist in debugger_run().
+int debugger_active(const debugger *debugger_ptr);
+
+void debugger_set_breakpoint(debugger *debugger_ptr, uint16_t address, int enabled);
+
+// Adds a watchpoint or condition, returns -1 when the table is full
+int debugger_add_watch(debugger *debugger_ptr, uint16_t start, uint16_t end, uint8_t access);
+int debugger_add_condition(debugger *debugger_ptr, uint8_t reg, condition_op op, uint16_t value);
+
+// Debug engine: the reference interpreter one instruction at a time, ticking the timers like run_for_cycles().
+// Stops before an instruction at a breakpoint, before a memory access (Fx33, Fx55, Fx65, Dxyn) touching a
+// watched byte, when a condition holds and after an instruction that changed a watched I. The first instruction
+// is never stopped before, so a run can continue from where the last one stopped. Returns the cycles executed
+// and leaves the reason in debugger_ptr->reason.
+uint64_t debugger_run(debugger *debugger_ptr, chip8_cpu *cpu_ptr, uint64_t cycles);
+
+// Reads commands from the stream until it ends or "q", printing results to stdout. Continuing without anything
+// set runs the given engine. Type "h" for the list of commands.
+void debugger_repl(debugger *debugger_ptr, chip8_cpu *cpu_ptr, chip8_engine *engine_ptr, FILE *input_ptr);
+
+#endif
@@ -0,0 +1,188 @@
+#include <string.h>
+#include <stdint.h>
+#include "chip8.h"
+#include "opcodes.h"
+#include "decode_cache.h"
+
+void decode_cache_init(decode_cache *cache_ptr) {
+    memset(cache_ptr->ops, 0, sizeof(cache_ptr->ops));
+    cache_ptr->decoded_chunks = 0;
+    cache_ptr->quirks = QUIRKS_CHIP8;
+}
+
+void decode_cache_invalidate(decode_cache *cache_ptr, uint16_t address, uint16_t length) {
+    // Stores wrap around the end of memory like the handlers do
+    address &= 0xFFF;
+    if (address + length > 4096) {
+        decode_cache_invalidate(cache_ptr, 0, address + length - 4096);
+        length = 4096 - address;
+    }
+    // The instruction starting one byte before the write also reads the first written byte
+    int first = (int)address - 1 - DECODE_CACHE_START;
+    int last = (int)address + length - 1 - DECODE_CACHE_START;
+
+    if (first < 0) {
+        first = 0;
+    }
+    if (last >= DECODE_CACHE_SLOTS) {
+        last = DECODE_CACHE_SLOTS - 1;
+    }
+    for (int i = first; i <= last; i++) {
+        cache_ptr->ops[i].handler = NULL;
+    }
+}
+
+// Most stores go to data that never ran as code. Checking for that inline keeps the call, and the registers it
+// makes the handlers spill, out of Fx33 and Fx55. Ranges wrapping around memory take the full path.
+static inline void invalidate_written(decode_cache *cache_ptr, uint16_t address, uint16_t length) {
+    unsigned low = ((address - 1) & 0xFFF) >> 6, high = ((address + length - 1) & 0xFFF) >> 6;
+
+    if (low <= high && (cache_ptr->decoded_chunks & (~0ULL >> (63 - high)) & (~0ULL << low)) == 0) {
+        return;
+    }
+    decode_cache_invalidate(cache_ptr, address, length);
+}
+
+// Runs an instruction outside the cache through the reference interpreter. Code below the program area can still
+// store into it, so Fx33 and Fx55 drop the slots they overwrite like the cached handlers do.
+static void execute_uncached(chip8_cpu *cpu_ptr, decode_cache *cache_ptr) {
+    uint16_t opcode = fetch_opcode(cpu_ptr), address = cpu_ptr->registers.I;
+
+    execute_instruction(cpu_ptr);
+    if ((opcode & 0xF0FF) == 0xF033) {
+        invalidate_written(cache_ptr, address, 3);
+    } else if ((opcode & 0xF0FF) == 0xF055) {
+        invalidate_written(cache_ptr, address, ((opcode & 0x0F00) >> 8) + 1);
+    }
+}
+
+uint64_t run_threaded(chip8_cpu *cpu_ptr, decode_cache *cache_ptr, uint64_t n) {
+    static const void *labels[OP_SPECIALIZED_COUNT] = {
+        [OP_INVALID] = &&op_invalid,
+        [OP_00E0] = &&op_00E0, [OP_00EE] = &&op_00EE, [OP_1nnn] = &&op_1nnn, [OP_2nnn] = &&op_2nnn,
+        [OP_3xkk] = &&op_3xkk, [OP_4xkk] = &&op_4xkk, [OP_5xy0] = &&op_5xy0, [OP_6xkk] = &&op_6xkk,
+        [OP_7xkk] = &&op_7xkk, [OP_8xy0] = &&op_8xy0, [OP_8xy1] = &&op_8xy1, [OP_8xy2] = &&op_8xy2,
+        [OP_8xy3] = &&op_8xy3, [OP_8xy4] = &&op_8xy4, [OP_8xy5] = &&op_8xy5, [OP_8xy6] = &&op_8xy6,
+        [OP_8xy7] = &&op_8xy7, [OP_8xyE] = &&op_8xyE, [OP_9xy0] = &&op_9xy0, [OP_Annn] = &&op_Annn,
+        [OP_Bnnn] = &&op_Bnnn, [OP_Cxkk] = &&op_Cxkk, [OP_Dxyn] = &&op_Dxyn, [OP_Ex9E] = &&op_Ex9E,
+        [OP_ExA1] = &&op_ExA1, [OP_Fx07] = &&op_Fx07, [OP_Fx0A] = &&op_Fx0A, [OP_Fx15] = &&op_Fx15,
+        [OP_Fx18] = &&op_Fx18, [OP_Fx1E] = &&op_Fx1E, [OP_Fx29] = &&op_Fx29, [OP_Fx33] = &&op_Fx33,
+        [OP_Fx55] = &&op_Fx55, [OP_Fx65] = &&op_Fx65,
+        [OP_8xy1_VF] = &&op_8xy1_VF, [OP_8xy2_VF] = &&op_8xy2_VF, [OP_8xy3_VF] = &&op_8xy3_VF,
+        [OP_8xy6_VY] = &&op_8xy6_VY, [OP_8xyE_VY] = &&op_8xyE_VY, [OP_Bxnn] = &&op_Bxnn,
+        [OP_Dxyn_WRAP] = &&op_Dxyn_WRAP, [OP_Fx55_I] = &&op_Fx55_I, [OP_Fx65_I] = &&op_Fx65_I,
+    };
+    unsigned quirks = quirk_set(cpu_ptr->quirks);
+    uint64_t remaining = n;
+    decoded_op *op = NULL;
+    uint16_t pc, opcode, address;
+
+    if (cache_ptr->quirks != cpu_ptr->quirks) {
+        decode_cache_init(cache_ptr);
+        cache_ptr->quirks = cpu_ptr->quirks;
+    }
+
+    // Jumps straight to the label of the next instruction, decoding its slot first when it is empty.
+    // The last byte of memory is left to the reference interpreter since that instruction wraps around.
+    // GCC merges these tails into a single indirect jump. Keeping one per handler with -fno-crossjumping measured
+    // no faster, what the engine saves over the switch is the decoding, about 1.1 to 1.7 times per opcode class.
+#define DISPATCH() \
+    do { \
+        if (remaining == 0) { \
+            goto done; \
+        } \
+        remaining--; \
+        pc = cpu_ptr->registers.program_counter; \
+        if (pc < DECODE_CACHE_START || pc >= 0xFFF) { \
+            goto uncached; \
+        } \
+        op = &cache_ptr->ops[pc - DECODE_CACHE_START]; \
+        if (__builtin_expect(op->handler == NULL, 0)) { \
+            goto decode; \
+        } \
+        goto *op->handler; \
+    } while (0)
+
+    DISPATCH();
+
+decode:
+    opcode = fetch_opcode(cpu_ptr);
+    op->x = (opcode & 0x0F00) >> 8;
+    op->y = (opcode & 0x00F0) >> 4;
+    op->n = opcode & 0x000F;
+    op->kk = opcode & 0x00FF;
+    op->nnn = opcode & 0x0FFF;
+    cache_ptr->decoded_chunks |= 1ULL << (pc >> 6);
+    op->handler = labels[specialize_opcode(decode_opcode(opcode), quirks)];
+    goto *op->handler;
+
+uncached:
+    execute_uncached(cpu_ptr, cache_ptr);
+    DISPATCH();
+
+op_invalid:
+    // Unknown opcodes leave the program counter untouched, like the reference interpreter
+    DISPATCH();
+op_00E0: _00E0(cpu_ptr); DISPATCH();
+op_00EE: _00EE(cpu_ptr); DISPATCH();
+op_1nnn: _1nnn(cpu_ptr, op->nnn); DISPATCH();
+op_2nnn: _2nnn(cpu_ptr, op->nnn); DISPATCH();
+op_3xkk: _3xkk(cpu_ptr, op->x, op->kk); DISPATCH();
+op_4xkk: _4xkk(cpu_ptr, op->x, op->kk); DISPATCH();
+op_5xy0: _5xy0(cpu_ptr, op->x, op->y); DISPATCH();
+op_6xkk: _6xkk(cpu_ptr, op->x, op->kk); DISPATCH();
+op_7xkk: _7xkk(cpu_ptr, op->x, op->kk); DISPATCH();
+op_8xy0: _8xy0(cpu_ptr, op->x, op->y); DISPATCH();
+op_8xy1: _8xy1(cpu_ptr, op->x, op->y, 0); DISPATCH();
+op_8xy2: _8xy2(cpu_ptr, op->x, op->y, 0); DISPATCH();
+op_8xy3: _8xy3(cpu_ptr, op->x, op->y, 0); DISPATCH();
+op_8xy4: _8xy4(cpu_ptr, op->x, op->y); DISPATCH();
+op_8xy5: _8xy5(cpu_ptr, op->x, op->y); DISPATCH();
+op_8xy6: _8xy6(cpu_ptr, op->x, op->y, 0); DISPATCH();
+op_8xy7: _8xy7(cpu_ptr, op->x, op->y); DISPATCH();
+op_8xyE: _8xyE(cpu_ptr, op->x, op->y, 0); DISPATCH();
+op_9xy0: _9xy0(cpu_ptr, op->x, op->y); DISPATCH();
+op_Annn: _Annn(cpu_ptr, op->nnn); DISPATCH();
+op_Bnnn: _Bnnn(cpu_ptr, op->nnn, 0); DISPATCH();
+op_Cxkk: _Cxkk(cpu_ptr, op->x, op->kk); DISPATCH();
+op_Dxyn: _Dxyn(cpu_ptr, op->x, op->y, op->n, 0); DISPATCH();
+op_Ex9E: _Ex9E(cpu_ptr, op->x); DISPATCH();
+op_ExA1: _ExA1(cpu_ptr, op->x); DISPATCH();
+op_Fx07: _Fx07(cpu_ptr, op->x); DISPATCH();
+op_Fx0A: _Fx0A(cpu_ptr, op->x); DISPATCH();
+op_Fx15: _Fx15(cpu_ptr, op->x); DISPATCH();
+op_Fx18: _Fx18(cpu_ptr, op->x); DISPATCH();
+op_Fx1E: _Fx1E(cpu_ptr, op->x); DISPATCH();
+op_Fx29: _Fx29(cpu_ptr, op->x); DISPATCH();
+op_Fx33:
+    // Stores can rewrite code, so the slots covering the written bytes are decoded again on their next use
+    _Fx33(cpu_ptr, op->x);
+    invalidate_written(cache_ptr, cpu_ptr->registers.I, 3);
+    DISPATCH();
+op_Fx55:
+    address = cpu_ptr->registers.I;
+    _Fx55(cpu_ptr, op->x, 0);
+    invalidate_written(cache_ptr, address, op->x + 1);
+    DISPATCH();
+op_Fx65: _Fx65(cpu_ptr, op->x, 0); DISPATCH();
+
+    // Quirk variants, the decoder only picks them when the profile has the quirk
+op_8xy1_VF: _8xy1(cpu_ptr, op->x, op->y, QUIRK_VF_RESET); DISPATCH();
+op_8xy2_VF: _8xy2(cpu_ptr, op->x, op->y, QUIRK_VF_RESET); DISPATCH();
+op_8xy3_VF: _8xy3(cpu_ptr, op->x, op->y, QUIRK_VF_RESET); DISPATCH();
+op_8xy6_VY: _8xy6(cpu_ptr, op->x, op->y, QUIRK_SHIFT_VY); DISPATCH();
+op_8xyE_VY: _8xyE(cpu_ptr, op->x, op->y, QUIRK_SHIFT_VY); DISPATCH();
+op_Bxnn: _Bnnn(cpu_ptr, op->nnn, QUIRK_JUMP_VX); DISPATCH();
+op_Dxyn_WRAP: _Dxyn(cpu_ptr, op->x, op->y, op->n, QUIRK_WRAP_SPRITES); DISPATCH();
+op_Fx55_I:
+    address = cpu_ptr->registers.I;
+    _Fx55(cpu_ptr, op->x, QUIRK_INCREMENT_I);
+    invalidate_written(cache_ptr, address, op->x + 1);
+    DISPATCH();
+op_Fx65_I: _Fx65(cpu_ptr, op->x, QUIRK_INCREMENT_I); DISPATCH();
+
+done:
+#undef DISPATCH
+    cpu_ptr->cycle_count += n;
+    return n;
+}
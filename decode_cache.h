@@ -0,0 +1,34 @@
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include <stdint.h>
+#include "chip8.h"
+
+// The cache covers the program area, every byte address gets a slot since jumps may land on odd addresses
+#define DECODE_CACHE_START 0x200
+#define DECODE_CACHE_SLOTS (4096 - DECODE_CACHE_START)
+
+typedef struct {
+    const void *handler; // Label in run_threaded() executing this opcode, NULL while the slot is not decoded
+    uint16_t nnn;
+    uint8_t x, y, kk, n;
+} decoded_op;
+
+typedef struct {
+    decoded_op ops[DECODE_CACHE_SLOTS];
+    uint64_t decoded_chunks; // Bit n set once a slot starting in bytes 64n to 64n + 63 was decoded
+    uint8_t quirks; // Profile the slots were decoded for, the handlers bake its quirks in
+} decode_cache;
+
+// Marks every slot as not decoded, must be called after a ROM is loaded
+void decode_cache_init(decode_cache *cache_ptr);
+
+// Drops the slots whose instruction overlaps the length bytes written at address
+void decode_cache_invalidate(decode_cache *cache_ptr, uint16_t address, uint16_t length);
+
+// Executes n instructions through the decoded-op cache with direct-threaded dispatch,
+// returns how many were executed and adds them to cycle_count.
+// The cache starts over when the CPU's quirk profile isn't the one it was decoded for.
+uint64_t run_threaded(chip8_cpu *cpu_ptr, decode_cache *cache_ptr, uint64_t n);
+
+#endif
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "opcodes.h"
+#include "disasm.h"
+
+void disassemble(uint16_t opcode, char *buffer, size_t size) {
+    unsigned int x = (opcode & 0x0F00) >> 8, y = (opcode & 0x00F0) >> 4;
+    unsigned int n = opcode & 0x000F, kk = opcode & 0x00FF, nnn = opcode & 0x0FFF;
+
+    switch (decode_opcode(opcode)) {
+        case OP_00E0: snprintf(buffer, size, "CLS"); break;
+        case OP_00EE: snprintf(buffer, size, "RET"); break;
+        case OP_1nnn: snprintf(buffer, size, "JP 0x%03X", nnn); break;
+        case OP_2nnn: snprintf(buffer, size, "CALL 0x%03X", nnn); break;
+        case OP_3xkk: snprintf(buffer, size, "SE V%X, 0x%02X", x, kk); break;
+        case OP_4xkk: snprintf(buffer, size, "SNE V%X, 0x%02X", x, kk); break;
+        case OP_5xy0: snprintf(buffer, size, "SE V%X, V%X", x, y); break;
+        case OP_6xkk: snprintf(buffer, size, "LD V%X, 0x%02X", x, kk); break;
+        case OP_7xkk: snprintf(buffer, size, "ADD V%X, 0x%02X", x, kk); break;
+        case OP_8xy0: snprintf(buffer, size, "LD V%X, V%X", x, y); break;
+        case OP_8xy1: snprintf(buffer, size, "OR V%X, V%X", x, y); break;
+        case OP_8xy2: snprintf(buffer, size, "AND V%X, V%X", x, y); break;
+        case OP_8xy3: snprintf(buffer, size, "XOR V%X, V%X", x, y); break;
+        case OP_8xy4: snprintf(buffer, size, "ADD V%X, V%X", x, y); break;
+        case OP_8xy5: snprintf(buffer, size, "SUB V%X, V%X", x, y); break;
+        case OP_8xy6: snprintf(buffer, size, "SHR V%X", x); break;
+        case OP_8xy7: snprintf(buffer, size, "SUBN V%X, V%X", x, y); break;
+        case OP_8xyE: snprintf(buffer, size, "SHL V%X", x); break;
+        case OP_9xy0: snprintf(buffer, size, "SNE V%X, V%X", x, y); break;
+        case OP_Annn: snprintf(buffer, size, "LD I, 0x%03X", nnn); break;
+        case OP_Bnnn: snprintf(buffer, size, "JP V0, 0x%03X", nnn); break;
+        case OP_Cxkk: snprintf(buffer, size, "RND V%X, 0x%02X", x, kk); break;
+        case OP_Dxyn: snprintf(buffer, size, "DRW V%X, V%X, %u", x, y, n); break;
+        case OP_Ex9E: snprintf(buffer, size, "SKP V%X", x); break;
+        case OP_ExA1: snprintf(buffer, size, "SKNP V%X", x); break;
+        case OP_Fx07: snprintf(buffer, size, "LD V%X, DT", x); break;
+        case OP_Fx0A: snprintf(buffer, size, "LD V%X, K", x); break;
+        case OP_Fx15: snprintf(buffer, size, "LD DT, V%X", x); break;
+        case OP_Fx18: snprintf(buffer, size, "LD ST, V%X", x); break;
+        case OP_Fx1E: snprintf(buffer, size, "ADD I, V%X", x); break;
+        case OP_Fx29: snprintf(buffer, size, "LD F, V%X", x); break;
+        case OP_Fx33: snprintf(buffer, size, "LD B, V%X", x); break;
+        case OP_Fx55: snprintf(buffer, size, "LD [I], V%X", x); break;
+        case OP_Fx65: snprintf(buffer, size, "LD V%X, [I]", x); break;
+        default: snprintf(buffer, size, "DW 0x%04X", opcode); break;
+    }
+}
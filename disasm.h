@@ -0,0 +1,10 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes the mnemonic form of an opcode (e.g. "LD V3, 0x2A"), unknown opcodes come out as a data word
+void disassemble(uint16_t opcode, char *buffer, size_t size);
+
+#endif
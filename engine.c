@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "chip8.h"
+#include "engine.h"
+
+int engine_parse(const char *name, engine_kind *kind_ptr) {
+    if (strcmp(name, "interp") == 0) {
+        *kind_ptr = ENGINE_INTERPRETER;
+    } else if (strcmp(name, "threaded") == 0) {
+        *kind_ptr = ENGINE_THREADED;
+    } else if (strcmp(name, "blocks") == 0) {
+        *kind_ptr = ENGINE_BLOCKS;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *engine_name(engine_kind kind) {
+    switch (kind) {
+        case ENGINE_THREADED:
+            return "threaded";
+        case ENGINE_BLOCKS:
+            return "blocks";
+        default:
+            return "interp";
+    }
+}
+
+int engine_init(chip8_engine *engine_ptr, engine_kind kind) {
+    engine_ptr->kind = kind;
+    engine_ptr->decode_cache_ptr = NULL;
+    engine_ptr->block_cache_ptr = NULL;
+
+    if (kind == ENGINE_THREADED) {
+        engine_ptr->decode_cache_ptr = malloc(sizeof(decode_cache));
+        if (engine_ptr->decode_cache_ptr == NULL) {
+            return -1;
+        }
+    } else if (kind == ENGINE_BLOCKS) {
+        engine_ptr->block_cache_ptr = malloc(sizeof(block_cache));
+        if (engine_ptr->block_cache_ptr == NULL) {
+            return -1;
+        }
+    }
+
+    engine_reset(engine_ptr);
+    return 0;
+}
+
+void engine_free(chip8_engine *engine_ptr) {
+    free(engine_ptr->decode_cache_ptr);
+    free(engine_ptr->block_cache_ptr);
+    engine_ptr->decode_cache_ptr = NULL;
+    engine_ptr->block_cache_ptr = NULL;
+}
+
+void engine_reset(chip8_engine *engine_ptr) {
+    if (engine_ptr->decode_cache_ptr != NULL) {
+        decode_cache_init(engine_ptr->decode_cache_ptr);
+    }
+    if (engine_ptr->block_cache_ptr != NULL) {
+        block_cache_init(engine_ptr->block_cache_ptr);
+    }
+}
+
+void engine_reset_from(chip8_engine *engine_ptr, const block_cache *analysis_ptr) {
+    engine_reset(engine_ptr);
+    if (engine_ptr->block_cache_ptr != NULL && analysis_ptr != NULL) {
+        memcpy(engine_ptr->block_cache_ptr, analysis_ptr, sizeof(block_cache));
+    }
+}
+
+void engine_invalidate_pages(chip8_engine *engine_ptr, uint16_t pages) {
+    while (pages != 0) {
+        uint16_t address = __builtin_ctz(pages) * CHIP8_PAGE_SIZE;
+        if (engine_ptr->decode_cache_ptr != NULL) {
+            decode_cache_invalidate(engine_ptr->decode_cache_ptr, address, CHIP8_PAGE_SIZE);
+        }
+        if (engine_ptr->block_cache_ptr != NULL) {
+            block_cache_invalidate(engine_ptr->block_cache_ptr, address, CHIP8_PAGE_SIZE);
+        }
+        pages &= pages - 1;
+    }
+}
+
+uint64_t engine_run(chip8_engine *engine_ptr, chip8_cpu *cpu_ptr, uint64_t n) {
+#ifdef CHIP8_TRACE
+    // Only the reference interpreter emits trace records, a traced CPU always runs through it
+    if (cpu_ptr->trace_ptr != NULL) {
+        return step(cpu_ptr, n);
+    }
+#endif
+#ifdef CHIP8_PROFILE
+    // Same for the profiler: the counts are architectural so they don't depend on the engine, and the samples
+    // need the opcode the interpreter's hook records. Idle loops are still skipped and counted in bulk, which
+    // keeps a profiled run within about 10 to 40% of the time the blocks engine takes on the bundled ROMs.
+    if (cpu_ptr->profile_ptr != NULL) {
+        return step(cpu_ptr, n);
+    }
+#endif
+    switch (engine_ptr->kind) {
+        case ENGINE_THREADED:
+            return run_threaded(cpu_ptr, engine_ptr->decode_cache_ptr, n);
+        case ENGINE_BLOCKS:
+            return run_blocks(cpu_ptr, engine_ptr->block_cache_ptr, n);
+        default:
+            return step(cpu_ptr, n);
+    }
+}
+
+uint64_t engine_run_for_cycles(chip8_engine *engine_ptr, chip8_cpu *cpu_ptr, uint64_t cycles) {
+    uint64_t executed = 0;
+    while (executed < cycles) {
+        uint64_t chunk = cycles - executed;
+        uint64_t skipped = skip_idle_loop(cpu_ptr, chunk);
+        if (skipped > 0) {
+            executed += skipped;
+            continue;
+        }
+        if (waiting_for_key(cpu_ptr)) {
+            cpu_ptr->cycle_count += chunk;
+            cpu_ptr->idle_cycles += chunk;
+        } else {
+            if (chunk > cycles_until_tick(cpu_ptr)) {
+                chunk = cycles_until_tick(cpu_ptr);
+            }
+            engine_run(engine_ptr, cpu_ptr, chunk);
+        }
+        advance_timers(cpu_ptr, chunk);
+        executed += chunk;
+    }
+    return executed;
+}
+
+int cpu_state_equal(const chip8_cpu *a_ptr, const chip8_cpu *b_ptr) {
+    const cpu_registers *a = &a_ptr->registers, *b = &b_ptr->registers;
+
+    return memcmp(a_ptr->memory, b_ptr->memory, sizeof(a_ptr->memory)) == 0 &&
+           a_ptr->keys == b_ptr->keys && a_ptr->key_wait == b_ptr->key_wait &&
+           a_ptr->key_wait_pressed == b_ptr->key_wait_pressed &&
+           memcmp(a_ptr->display, b_ptr->display, sizeof(a_ptr->display)) == 0 &&
+           memcmp(a->V, b->V, sizeof(a->V)) == 0 &&
+           memcmp(a->stack, b->stack, sizeof(a->stack)) == 0 &&
+           a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer &&
+           a->I == b->I && a->program_counter == b->program_counter && a->stack_ptr == b->stack_ptr && a->rng == b->rng &&
+           a_ptr->cycle_count == b_ptr->cycle_count && a_ptr->timer_phase == b_ptr->timer_phase;
+}
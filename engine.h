@@ -0,0 +1,49 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+#include "chip8.h"
+#include "decode_cache.h"
+#include "blocks.h"
+
+typedef enum {
+    ENGINE_INTERPRETER, // Reference switch interpreter, execute_instruction()
+    ENGINE_THREADED, // Decoded-op cache with direct-threaded dispatch
+    ENGINE_BLOCKS // Translated basic blocks with superinstruction fusion
+} engine_kind;
+
+typedef struct {
+    engine_kind kind;
+    decode_cache *decode_cache_ptr;
+    block_cache *block_cache_ptr;
+} chip8_engine;
+
+// Parses "interp", "threaded" or "blocks", returns 0 on success and -1 on an unknown name
+int engine_parse(const char *name, engine_kind *kind_ptr);
+const char *engine_name(engine_kind kind);
+
+// Allocates the caches the engine kind needs, returns 0 on success and -1 on failure
+int engine_init(chip8_engine *engine_ptr, engine_kind kind);
+void engine_free(chip8_engine *engine_ptr);
+
+// Forgets everything decoded so far, must be called whenever memory is replaced wholesale (ROM load, state restore)
+void engine_reset(chip8_engine *engine_ptr);
+
+// Like engine_reset() after loading a ROM whose blocks were translated before, the blocks engine starts
+// from a copy of them. analysis_ptr may be NULL when there are none.
+void engine_reset_from(chip8_engine *engine_ptr, const block_cache *analysis_ptr);
+
+// Drops what was decoded from the given memory pages, after reset_to_image() or fork_from_image() rewrote them.
+// Everything decoded from the other pages stays valid, a reset instance does not translate its code again.
+void engine_invalidate_pages(chip8_engine *engine_ptr, uint16_t pages);
+
+// Executes n instructions with the selected engine and adds them to cycle_count
+uint64_t engine_run(chip8_engine *engine_ptr, chip8_cpu *cpu_ptr, uint64_t n);
+
+// Same as run_for_cycles() with the selected engine: executes the budget and ticks the timers at 60 Hz
+uint64_t engine_run_for_cycles(chip8_engine *engine_ptr, chip8_cpu *cpu_ptr, uint64_t cycles);
+
+// Compares the architectural state of two CPUs, returns 1 when they match
+int cpu_state_equal(const chip8_cpu *a_ptr, const chip8_cpu *b_ptr);
+
+#endif
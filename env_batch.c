@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "env_batch.h"
+
+void env_config_default(env_config *config_ptr) {
+    memset(config_ptr, 0, sizeof(*config_ptr));
+    config_ptr->frame_skip = 4;
+    config_ptr->clock_hz = CHIP8_DEFAULT_CLOCK_HZ;
+    config_ptr->quirks = QUIRKS_CHIP8;
+    config_ptr->done_address = -1;
+}
+
+// Starts episode episodes[n] of instance n from the golden image
+static void restart_instance(env_batch *batch_ptr, size_t n) {
+    chip8_cpu *cpu_ptr = &batch_ptr->cpus[n];
+
+    reset_to_image(cpu_ptr, &batch_ptr->image);
+    seed_random(cpu_ptr, batch_ptr->config.seed + batch_ptr->episodes[n] * (uint32_t)batch_ptr->count + (uint32_t)n);
+    batch_ptr->frames[n] = 0;
+    batch_ptr->restart[n] = 0;
+}
+
+static uint8_t done_flags(const env_batch *batch_ptr, size_t n) {
+    const env_config *config_ptr = &batch_ptr->config;
+    uint8_t done = 0;
+
+    if (config_ptr->done_address >= 0 &&
+        (batch_ptr->cpus[n].memory[config_ptr->done_address] & config_ptr->done_mask) == config_ptr->done_value) {
+        done |= ENV_TERMINATED;
+    }
+    if (config_ptr->max_frames != 0 && batch_ptr->frames[n] >= config_ptr->max_frames) {
+        done |= ENV_TRUNCATED;
+    }
+    return done;
+}
+
+static void write_outputs(const env_batch *batch_ptr, size_t n, uint8_t done, const env_outputs *outputs_ptr) {
+    const chip8_cpu *cpu_ptr = &batch_ptr->cpus[n];
+    int reward_count = batch_ptr->config.reward_count;
+
+    if (outputs_ptr->displays != NULL) {
+        memcpy(outputs_ptr->displays + n * 32, cpu_ptr->display, sizeof(cpu_ptr->display));
+    }
+    if (outputs_ptr->rewards != NULL) {
+        for (int i = 0; i < reward_count; i++) {
+            outputs_ptr->rewards[n * reward_count + i] = cpu_ptr->memory[batch_ptr->config.reward_addresses[i]];
+        }
+    }
+    if (outputs_ptr->done != NULL) {
+        outputs_ptr->done[n] = done;
+    }
+}
+
+// Runs one worker's instances through the step under way. Every instance goes through the reference
+// interpreter: the engine caches decode from memory the program can rewrite, so they can't be shared.
+static void step_slice(env_batch *batch_ptr, const env_worker *worker_ptr) {
+    const env_config *config_ptr = &batch_ptr->config;
+
+    for (size_t n = worker_ptr->first; n < worker_ptr->last; n++) {
+        chip8_cpu *cpu_ptr = &batch_ptr->cpus[n];
+        uint8_t done = 0;
+
+        if (batch_ptr->restart[n]) {
+            batch_ptr->episodes[n]++;
+            restart_instance(batch_ptr, n);
+        }
+        if (batch_ptr->actions != NULL) {
+            cpu_ptr->keys = batch_ptr->actions[n];
+        }
+        // Whole cycles per frame, carrying the remainder of clocks that aren't a multiple of 60 Hz
+        for (int i = 0; i < config_ptr->frame_skip && done == 0; i++) {
+            uint64_t frame = batch_ptr->frames[n];
+            run_for_cycles(cpu_ptr, (frame + 1) * config_ptr->clock_hz / 60 - frame * config_ptr->clock_hz / 60);
+            batch_ptr->frames[n]++;
+            done = done_flags(batch_ptr, n);
+        }
+        batch_ptr->restart[n] = done != 0;
+        write_outputs(batch_ptr, n, done, &batch_ptr->outputs);
+    }
+}
+
+static void *worker_main(void *arg) {
+    env_worker *worker_ptr = arg;
+    env_batch *batch_ptr = worker_ptr->batch_ptr;
+    uint64_t seen = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&batch_ptr->lock);
+        while (batch_ptr->generation == seen && !batch_ptr->stop) {
+            pthread_cond_wait(&batch_ptr->wake, &batch_ptr->lock);
+        }
+        if (batch_ptr->stop) {
+            pthread_mutex_unlock(&batch_ptr->lock);
+            return NULL;
+        }
+        seen = batch_ptr->generation;
+        pthread_mutex_unlock(&batch_ptr->lock);
+
+        step_slice(batch_ptr, worker_ptr);
+
+        pthread_mutex_lock(&batch_ptr->lock);
+        if (--batch_ptr->pending == 0) {
+            pthread_cond_signal(&batch_ptr->idle);
+        }
+        pthread_mutex_unlock(&batch_ptr->lock);
+    }
+}
+
+int env_batch_init(env_batch *batch_ptr, const uint8_t *rom, size_t size, size_t count, const env_config *config_ptr) {
+    const env_config *c = config_ptr;
+    int threads = c->threads > 0 ? c->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(batch_ptr, 0, sizeof(*batch_ptr));
+    if (count == 0 || c->frame_skip < 1 || c->clock_hz == 0 || c->done_address >= 4096 ||
+        c->reward_count < 0 || c->reward_count > ENV_MAX_REWARD_BYTES) {
+        printf("Invalid environment batch configuration.\n");
+        return -1;
+    }
+    for (int i = 0; i < c->reward_count; i++) {
+        if (c->reward_addresses[i] >= 4096) {
+            printf("Reward address %X is outside memory.\n", c->reward_addresses[i]);
+            return -1;
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if ((size_t)threads > count) {
+        threads = (int)count;
+    }
+
+    chip8_cpu cpu = init();
+    set_clock_hz(&cpu, c->clock_hz);
+    set_quirks(&cpu, c->quirks);
+    if (load_rom_bytes(&cpu, rom, size) != 0) {
+        return -1;
+    }
+    capture_image(&cpu, &batch_ptr->image);
+
+    batch_ptr->config = *c;
+    batch_ptr->count = count;
+    batch_ptr->cpus = aligned_alloc(64, (count * sizeof(chip8_cpu) + 63) & ~(size_t)63);
+    batch_ptr->frames = calloc(count, sizeof(uint32_t));
+    batch_ptr->episodes = calloc(count, sizeof(uint32_t));
+    batch_ptr->restart = calloc(count, sizeof(uint8_t));
+    batch_ptr->workers = calloc(threads, sizeof(env_worker));
+    if (batch_ptr->cpus == NULL || batch_ptr->frames == NULL || batch_ptr->episodes == NULL ||
+        batch_ptr->restart == NULL || batch_ptr->workers == NULL) {
+        printf("Unable to allocate %zu environments.\n", count);
+        free(batch_ptr->cpus);
+        free(batch_ptr->frames);
+        free(batch_ptr->episodes);
+        free(batch_ptr->restart);
+        free(batch_ptr->workers);
+        return -1;
+    }
+    for (size_t n = 0; n < count; n++) {
+        batch_ptr->cpus[n] = batch_ptr->image;
+        restart_instance(batch_ptr, n);
+    }
+
+    pthread_mutex_init(&batch_ptr->lock, NULL);
+    pthread_cond_init(&batch_ptr->wake, NULL);
+    pthread_cond_init(&batch_ptr->idle, NULL);
+    // Worker 0 is the caller. Instances are only split once the threads are up, so the ones that
+    // failed to start leave their share to the others.
+    batch_ptr->worker_count = 1;
+    while (batch_ptr->worker_count < threads) {
+        env_worker *worker_ptr = &batch_ptr->workers[batch_ptr->worker_count];
+        worker_ptr->batch_ptr = batch_ptr;
+        if (pthread_create(&worker_ptr->thread, NULL, worker_main, worker_ptr) != 0) {
+            break;
+        }
+        batch_ptr->worker_count++;
+    }
+    pthread_mutex_lock(&batch_ptr->lock);
+    for (int i = 0; i < batch_ptr->worker_count; i++) {
+        batch_ptr->workers[i].batch_ptr = batch_ptr;
+        batch_ptr->workers[i].first = count * i / batch_ptr->worker_count;
+        batch_ptr->workers[i].last = count * (i + 1) / batch_ptr->worker_count;
+    }
+    pthread_mutex_unlock(&batch_ptr->lock);
+    return 0;
+}
+
+void env_batch_free(env_batch *batch_ptr) {
+    pthread_mutex_lock(&batch_ptr->lock);
+    batch_ptr->stop = 1;
+    pthread_cond_broadcast(&batch_ptr->wake);
+    pthread_mutex_unlock(&batch_ptr->lock);
+    for (int i = 1; i < batch_ptr->worker_count; i++) {
+        pthread_join(batch_ptr->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&batch_ptr->idle);
+    pthread_cond_destroy(&batch_ptr->wake);
+    pthread_mutex_destroy(&batch_ptr->lock);
+    free(batch_ptr->cpus);
+    free(batch_ptr->frames);
+    free(batch_ptr->episodes);
+    free(batch_ptr->restart);
+    free(batch_ptr->workers);
+}
+
+void env_batch_observe(env_batch *batch_ptr, const env_outputs *outputs_ptr) {
+    for (size_t n = 0; n < batch_ptr->count; n++) {
+        write_outputs(batch_ptr, n, batch_ptr->restart[n] ? done_flags(batch_ptr, n) : 0, outputs_ptr);
+    }
+}
+
+void env_batch_step(env_batch *batch_ptr, const uint16_t *actions, const env_outputs *outputs_ptr) {
+    pthread_mutex_lock(&batch_ptr->lock);
+    batch_ptr->actions = actions;
+    batch_ptr->outputs = *outputs_ptr;
+    batch_ptr->pending = batch_ptr->worker_count - 1;
+    batch_ptr->generation++;
+    pthread_cond_broadcast(&batch_ptr->wake);
+    pthread_mutex_unlock(&batch_ptr->lock);
+
+    step_slice(batch_ptr, &batch_ptr->workers[0]);
+
+    pthread_mutex_lock(&batch_ptr->lock);
+    while (batch_ptr->pending > 0) {
+        pthread_cond_wait(&batch_ptr->idle, &batch_ptr->lock);
+    }
+    pthread_mutex_unlock(&batch_ptr->lock);
+}
+
+void env_batch_fork(env_batch *batch_ptr, size_t child, size_t parent) {
+    fork_from_image(&batch_ptr->cpus[child], &batch_ptr->cpus[parent], &batch_ptr->image);
+    batch_ptr->frames[child] = batch_ptr->frames[parent];
+    batch_ptr->episodes[child] = batch_ptr->episodes[parent];
+    batch_ptr->restart[child] = batch_ptr->restart[parent];
+}
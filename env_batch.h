@@ -0,0 +1,85 @@
+#ifndef ENV_BATCH_H
+#define ENV_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "chip8.h"
+
+#define ENV_MAX_REWARD_BYTES 16
+
+// Bits of the per-instance done flags
+#define ENV_TERMINATED 1 // The done byte reached its value
+#define ENV_TRUNCATED 2 // The episode ran for max_frames
+
+typedef struct {
+    int frame_skip; // 60 Hz frames every env_batch_step() advances each instance by, at least 1
+    uint32_t clock_hz;
+    quirk_profile quirks;
+    uint32_t seed; // Instance n of episode e seeds Cxkk with seed + e * count + n
+    uint32_t max_frames; // Episodes are truncated after this many frames, 0 never truncates
+    int done_address; // Episodes end when (memory[done_address] & done_mask) == done_value, -1 disables it
+    uint8_t done_mask, done_value;
+    uint16_t reward_addresses[ENV_MAX_REWARD_BYTES]; // Memory bytes copied out after every step
+    int reward_count;
+    int threads; // Worker threads including the caller's, 0 uses one per core
+} env_config;
+
+// Caller-owned arrays the batch writes into, every one holds an entry per instance in instance order
+typedef struct {
+    uint64_t *displays; // 32 packed rows per instance, in the chip8_cpu.display layout
+    uint8_t *rewards; // reward_count bytes per instance
+    uint8_t *done; // ENV_TERMINATED and ENV_TRUNCATED bits, the instance restarts at its next step
+} env_outputs;
+
+typedef struct env_batch env_batch;
+
+// One thread's share of the instances
+typedef struct {
+    env_batch *batch_ptr;
+    size_t first, last; // Instances [first, last) belong to this worker
+    pthread_t thread;
+} env_worker;
+
+struct env_batch {
+    chip8_cpu *cpus;
+    uint32_t *frames; // Frames since each instance last restarted
+    uint32_t *episodes; // Number of restarts of each instance
+    uint8_t *restart; // Set for the instances whose episode ended in the last step
+    chip8_cpu image; // Golden image every instance restarts from
+    size_t count;
+    env_config config;
+    // Worker 0 is the calling thread, the others wait for the generation to change
+    env_worker *workers;
+    int worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, idle;
+    uint64_t generation;
+    int pending; // Workers still running the current step
+    int stop;
+    // Arguments of the step under way
+    const uint16_t *actions;
+    env_outputs outputs;
+};
+
+// Fills in the defaults: frame skip 4, the default clock, chip8 quirks, no done byte, no rewards, one thread per core
+void env_config_default(env_config *config_ptr);
+
+// Loads the ROM into count instances and starts the worker threads, returns 0 on success and -1 on failure
+int env_batch_init(env_batch *batch_ptr, const uint8_t *rom, size_t size, size_t count, const env_config *config_ptr);
+void env_batch_free(env_batch *batch_ptr);
+
+// Writes the current observations without advancing, for the first step of a run
+void env_batch_observe(env_batch *batch_ptr, const env_outputs *outputs_ptr);
+
+// Holds the keys of actions[n] down in instance n, runs every instance for frame_skip frames in parallel and
+// writes the observations. Instances done in the previous step restart from the golden image first.
+// Nothing is allocated, the workers write straight into the caller's arrays.
+void env_batch_step(env_batch *batch_ptr, const uint16_t *actions, const env_outputs *outputs_ptr);
+
+// Makes instance child continue from where instance parent is, between steps, for searches that branch out of
+// one state. Only the memory pages either of them stored to are copied. The child takes the parent's episode,
+// frame count and random state, so it draws the same numbers until the two are given different actions.
+void env_batch_fork(env_batch *batch_ptr, size_t child, size_t parent);
+
+#endif
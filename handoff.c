@@ -0,0 +1,78 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include "handoff.h"
+#include "timing.h"
+
+void triple_buffer_init(triple_buffer *buffer_ptr) {
+    memset(buffer_ptr->slots, 0, sizeof(buffer_ptr->slots));
+    buffer_ptr->back = 0;
+    atomic_init(&buffer_ptr->middle, 1);
+    buffer_ptr->front = 2;
+}
+
+void triple_buffer_publish(triple_buffer *buffer_ptr) {
+    // Release makes the slot contents visible before the index, acquire hands back a slot the reader let go of
+    int previous = atomic_exchange_explicit(&buffer_ptr->middle, buffer_ptr->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+    buffer_ptr->back = previous & ~TRIPLE_BUFFER_FRESH;
+}
+
+const frame_slot *triple_buffer_take(triple_buffer *buffer_ptr) {
+    if (!(atomic_load_explicit(&buffer_ptr->middle, memory_order_relaxed) & TRIPLE_BUFFER_FRESH)) {
+        return NULL;
+    }
+    // Only the writer sets the fresh bit and only this thread clears it, so it is still set here
+    int middle = atomic_exchange_explicit(&buffer_ptr->middle, buffer_ptr->front, memory_order_acq_rel);
+    buffer_ptr->front = middle & ~TRIPLE_BUFFER_FRESH;
+    return &buffer_ptr->slots[buffer_ptr->front];
+}
+
+int input_queue_init(input_queue *queue_ptr) {
+    atomic_init(&queue_ptr->head, 0);
+    atomic_init(&queue_ptr->tail, 0);
+    queue_ptr->dropped = 0;
+    return sem_init(&queue_ptr->ready, 0, 0) == 0 ? 0 : -1;
+}
+
+void input_queue_free(input_queue *queue_ptr) {
+    sem_destroy(&queue_ptr->ready);
+}
+
+void input_queue_push(input_queue *queue_ptr, int key, int action) {
+    uint64_t head = atomic_load_explicit(&queue_ptr->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&queue_ptr->tail, memory_order_acquire) == INPUT_QUEUE_EVENTS) {
+        queue_ptr->dropped++;
+        return;
+    }
+    host_event *event_ptr = &queue_ptr->events[head & (INPUT_QUEUE_EVENTS - 1)];
+    event_ptr->key = key;
+    event_ptr->action = action;
+    event_ptr->time = now_seconds();
+    atomic_store_explicit(&queue_ptr->head, head + 1, memory_order_release);
+    sem_post(&queue_ptr->ready);
+}
+
+int input_queue_pop(input_queue *queue_ptr, host_event *event_ptr) {
+    uint64_t tail = atomic_load_explicit(&queue_ptr->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&queue_ptr->head, memory_order_acquire)) {
+        return -1;
+    }
+    *event_ptr = queue_ptr->events[tail & (INPUT_QUEUE_EVENTS - 1)];
+    atomic_store_explicit(&queue_ptr->tail, tail + 1, memory_order_release);
+    // Consume the event's post so a later wait sleeps. If the producer hasn't posted yet, the wait returns once early.
+    sem_trywait(&queue_ptr->ready);
+    return 0;
+}
+
+void input_queue_wait(input_queue *queue_ptr) {
+    while (sem_wait(&queue_ptr->ready) != 0 && errno == EINTR) {
+    }
+}
+
+void input_queue_wake(input_queue *queue_ptr) {
+    sem_post(&queue_ptr->ready);
+}
@@ -0,0 +1,75 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+
+// Lock-free handoff between the emulation thread and the render thread: completed frames go one way
+// through a triple buffer, host input events the other way through a single-producer single-consumer queue.
+
+#define INPUT_QUEUE_EVENTS 256 // Must be a power of two
+
+// A completed emulated frame as the render thread sees it
+typedef struct {
+    uint64_t display[32];
+    uint64_t frame; // Emulated frames run before this one was published
+    uint64_t input_sequence; // Input events applied before the frame was published
+    double input_time; // now_seconds() when the newest of those events reached the input queue
+} frame_slot;
+
+// The emulation thread fills the back slot and swaps it with the middle one, the render thread swaps its front slot
+// with the middle one when that holds a frame it hasn't seen. Neither side ever waits for the other.
+typedef struct {
+    frame_slot slots[3];
+    _Atomic int middle; // Slot index, with TRIPLE_BUFFER_FRESH set while it holds an unseen frame
+    int back; // Emulation thread only
+    int front; // Render thread only
+} triple_buffer;
+
+#define TRIPLE_BUFFER_FRESH 4
+
+void triple_buffer_init(triple_buffer *buffer_ptr);
+
+// Slot the emulation thread fills next
+static inline frame_slot *triple_buffer_back(triple_buffer *buffer_ptr) {
+    return &buffer_ptr->slots[buffer_ptr->back];
+}
+
+// Hands the filled back slot to the render thread, replacing a frame it hasn't taken yet
+void triple_buffer_publish(triple_buffer *buffer_ptr);
+
+// Returns the newest published frame, or NULL when nothing was published since the last call
+const frame_slot *triple_buffer_take(triple_buffer *buffer_ptr);
+
+// Key or button change as GLFW reported it
+typedef struct {
+    int key, action;
+    double time; // now_seconds() when the event was pushed
+} host_event;
+
+typedef struct {
+    host_event events[INPUT_QUEUE_EVENTS];
+    _Atomic uint64_t head; // Events pushed so far
+    _Atomic uint64_t tail; // Events popped so far
+    uint64_t dropped; // Events lost because the emulation thread was a whole queue behind, producer only
+    sem_t ready; // Posted for every push, lets a consumer with nothing to do sleep until input arrives
+} input_queue;
+
+// Returns 0 on success and -1 on failure
+int input_queue_init(input_queue *queue_ptr);
+void input_queue_free(input_queue *queue_ptr);
+
+// Render thread: appends an event, drops it when the queue is full. Never blocks.
+void input_queue_push(input_queue *queue_ptr, int key, int action);
+
+// Emulation thread: takes the oldest event, returns 0 on success and -1 when the queue is empty
+int input_queue_pop(input_queue *queue_ptr, host_event *event_ptr);
+
+// Emulation thread: sleeps until an event is pushed or input_queue_wake() is called
+void input_queue_wait(input_queue *queue_ptr);
+
+// Wakes a consumer sleeping in input_queue_wait() without an event, e.g. to shut it down
+void input_queue_wake(input_queue *queue_ptr);
+
+#endif
@@ -0,0 +1,546 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "chip8.h"
+#include "engine.h"
+#include "batch.h"
+#include "lanes.h"
+#include "input_script.h"
+#include "savestate.h"
+#include "catalog.h"
+#include "audio.h"
+#include "debugger.h"
+#include "stream.h"
+#include "trace.h"
+#include "profile.h"
+#include "timing.h"
+
+// Number of instructions executed between two clock reads
+#define BENCH_CHUNK (1 << 20)
+// Number of instructions both engines run between two state comparisons in diff mode
+#define DIFF_CHUNK 64
+
+static void usage(const char *program) {
+    printf("Usage: %s [-C catalog] [-q quirks] [-e interp|threaded|blocks] [-s seconds] [-S socket [-K frames]] [-d | -g] rom\n",
+           program);
+    printf("       %s [-C catalog] [-q quirks] [-e interp|threaded|blocks] [-j threads] -b jobs\n", program);
+    printf("       %s [-C catalog] [-q quirks] [-s seconds] -L seed rom\n", program);
+    printf("       %s [-e interp|threaded|blocks] [-o hashes] [-a null|device|wav file] [-S socket [-K frames]] -r log\n",
+           program);
+#ifdef CHIP8_TRACE
+    printf("  -t  write a binary trace of every instruction to the file, read it back with tracedump\n");
+#endif
+#ifdef CHIP8_PROFILE
+    printf("  -p  profile the benchmark, the report goes to the file and a flamegraph stack file next to it.\n");
+    printf("      The profiled run goes through the interpreter whatever -e says.\n");
+#endif
+    printf("  -C  add the ROMs to a catalog directory and use its clock, quirks and translated blocks, rom may be a cataloged hash\n");
+    printf("  -q  run with the chip8, schip or xochip quirk profile instead of the cataloged one (default chip8)\n");
+    printf("  -d  run the reference interpreter alongside the engine and stop at the first divergence\n");
+    printf("  -g  debug the ROM with breakpoints, watchpoints and stepping, commands are read from stdin (h lists them)\n");
+    printf("  -b  run every job of the list on all cores and report per-job results\n");
+    printf("  -L  run %d instances of the ROM in lockstep SIMD lanes, seeded from the given value\n", CHIP8_LANES);
+    printf("  -r  replay a recorded input log as fast as possible, -o writes the rolling framebuffer hash of every frame\n");
+    printf("  -a  replay in real time feeding the beeper to an audio sink, and report its counters\n");
+    printf("  -S  publish every frame that changed to the clients of a Unix socket, read it with streamclient\n");
+    printf("  -K  send a keyframe every given number of frames sent instead of every %d\n", STREAM_DEFAULT_KEYFRAME_INTERVAL);
+}
+
+// Loads the ROM at path, or with a catalog the ROM at path or with the hash given as path, and applies its
+// cataloged clock and quirks. A quirk profile other than QUIRKS_COUNT overrides the cataloged one.
+// Returns 0 on success and -1 on failure.
+static int load_program(const char *catalog_dir, const char *path, quirk_profile quirks, chip8_cpu *cpu_ptr,
+                        uint64_t *hash_ptr) {
+    rom_mapping rom;
+    rom_metadata metadata;
+    uint64_t hash;
+
+    if (quirks != QUIRKS_COUNT) {
+        set_quirks(cpu_ptr, quirks);
+    }
+    if (catalog_dir == NULL) {
+        return load_rom(cpu_ptr, path);
+    }
+    if (access(path, F_OK) != 0 && catalog_parse_hash(path, &hash) == 0) {
+        if (catalog_open(catalog_dir, hash, &rom, &metadata) != 0) {
+            return -1;
+        }
+    } else if (map_rom(path, &rom) != 0) {
+        return -1;
+    } else if (catalog_add(catalog_dir, path, &rom, &metadata) != 0) {
+        unmap_rom(&rom);
+        return -1;
+    }
+
+    if (quirks == QUIRKS_COUNT && quirks_parse(metadata.quirks, &quirks) != 0) {
+        printf("Unknown quirk profile %s in the catalog.\n", metadata.quirks);
+        unmap_rom(&rom);
+        return -1;
+    }
+    load_rom_bytes(cpu_ptr, rom.data, rom.size);
+    set_clock_hz(cpu_ptr, metadata.clock_hz);
+    set_quirks(cpu_ptr, quirks);
+    *hash_ptr = metadata.hash;
+    unmap_rom(&rom);
+    return 0;
+}
+
+static int run_lockstep(const char *catalog_dir, const char *path, quirk_profile quirks, uint32_t seed, double duration) {
+    // The ROM goes through the regular loader, then the whole program area is copied into every lane
+    chip8_cpu CPU = init();
+    uint64_t hash;
+    if (load_program(catalog_dir, path, quirks, &CPU, &hash) != 0) {
+        printf("Failed to load ROM %s.\n", path);
+        return -1;
+    }
+
+    chip8_lanes *lanes_ptr = lanes_create();
+    if (lanes_ptr == NULL) {
+        printf("Failed to allocate the lanes.\n");
+        return -1;
+    }
+    lanes_init(lanes_ptr, CPU.memory + 0x200, sizeof(CPU.memory) - 0x200, seed, CPU.quirks);
+    lanes_set_clock_hz(lanes_ptr, CPU.clock_hz);
+
+    double start = now_seconds(), elapsed = 0.0;
+    uint64_t executed = 0;
+    while (elapsed < duration) {
+        executed += run_lanes(lanes_ptr, BENCH_CHUNK / CHIP8_LANES);
+        elapsed = now_seconds() - start;
+    }
+
+    uint64_t steps = lanes_ptr->vector_steps + lanes_ptr->scalar_steps;
+    printf("ROM: %s\n", path);
+    printf("Lanes: %d\n", CHIP8_LANES);
+    printf("Quirks: %s\n", quirks_name(CPU.quirks));
+    printf("Instructions executed: %llu\n", (unsigned long long)executed);
+    printf("Vector steps: %llu (%.1f%% of dispatches)\n", (unsigned long long)lanes_ptr->vector_steps,
+           steps ? 100.0 * lanes_ptr->vector_steps / steps : 0.0);
+    printf("Scalar steps: %llu\n", (unsigned long long)lanes_ptr->scalar_steps);
+    printf("Elapsed time: %.3f s\n", elapsed);
+    printf("Instructions/sec: %.0f\n", executed / elapsed);
+
+    lanes_destroy(lanes_ptr);
+    return 0;
+}
+
+// Replays a recorded session frame by frame. The rolling hash folds in the framebuffer at the end of every
+// frame, so two replays agree on a frame's hash exactly when they agree on every frame up to it.
+static int run_replay(const char *log_path, const char *hashes_path, const char *audio_name, engine_kind kind,
+                      frame_stream *stream_ptr) {
+    input_log log;
+    chip8_engine engine;
+    chip8_cpu CPU = init();
+    FILE *hashes_ptr = NULL;
+    audio_output *audio_ptr = NULL;
+
+    if (input_log_read(&log, log_path) != 0) {
+        return -1;
+    }
+    if (engine_init(&engine, kind) != 0) {
+        printf("Failed to allocate the %s engine.\n", engine_name(kind));
+        input_log_free(&log);
+        return -1;
+    }
+    if (hashes_path != NULL && (hashes_ptr = fopen(hashes_path, "w")) == NULL) {
+        printf("Failed to create %s.\n", hashes_path);
+        engine_free(&engine);
+        input_log_free(&log);
+        return -1;
+    }
+    if (audio_name != NULL) {
+        audio_sink_kind sink;
+        const char *audio_path;
+        audio_parse(audio_name, &sink, &audio_path);
+        if ((audio_ptr = audio_create(sink, audio_path)) == NULL) {
+            if (hashes_ptr != NULL) {
+                fclose(hashes_ptr);
+            }
+            engine_free(&engine);
+            input_log_free(&log);
+            return -1;
+        }
+    }
+    snapshot_load(&CPU, log.start);
+
+    double start = now_seconds();
+    uint64_t first_cycle = CPU.cycle_count, first_idle = CPU.idle_cycles, frames = 0, hash = 0xcbf29ce484222325ULL;
+    size_t next = 0;
+    while (CPU.cycle_count < log.end_cycle) {
+        uint64_t end = CPU.cycle_count + cycles_until_tick(&CPU);
+        if (audio_ptr != NULL) {
+            // A sink consumes samples at the sample rate, so frames are paced like the frontend paces them
+            sleep_until(start + (double)frames / 60);
+            audio_frame(audio_ptr, &CPU);
+        }
+        run_script_until(&engine, &CPU, &log.script, &next, end < log.end_cycle ? end : log.end_cycle);
+        hash = (hash ^ display_hash(&CPU)) * 0x100000001b3ULL;
+        frames++;
+        if (stream_ptr != NULL) {
+            stream_publish(stream_ptr, CPU.display);
+        }
+        if (hashes_ptr != NULL) {
+            fprintf(hashes_ptr, "%llu %llu %016llx\n", (unsigned long long)frames,
+                    (unsigned long long)CPU.cycle_count, (unsigned long long)hash);
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    printf("Log: %s\n", log_path);
+    printf("Engine: %s\n", engine_name(kind));
+    printf("Key events: %zu\n", log.script.count);
+    printf("Frames: %llu (%.1f s of play)\n", (unsigned long long)frames, (double)frames / 60);
+    uint64_t idle = CPU.idle_cycles - first_idle;
+    printf("Instructions executed: %llu (%llu skipped in idle loops)\n",
+           (unsigned long long)(CPU.cycle_count - first_cycle - idle), (unsigned long long)idle);
+    printf("Elapsed time: %.3f s\n", elapsed);
+    printf("Final hash: %016llx\n", (unsigned long long)hash);
+    if (audio_ptr != NULL) {
+        audio_stop(audio_ptr);
+        audio_report(audio_ptr);
+        audio_destroy(audio_ptr);
+    }
+
+    int status = 0;
+    if (hashes_ptr != NULL && fclose(hashes_ptr) != 0) {
+        printf("Failed to write %s.\n", hashes_path);
+        status = -1;
+    }
+    engine_free(&engine);
+    input_log_free(&log);
+    return status;
+}
+
+static int run_batch(const char *catalog_dir, const char *jobs_path, quirk_profile quirks, int threads, engine_kind kind) {
+    batch_list list;
+    batch_stats stats;
+
+    if (batch_load(jobs_path, &list) != 0) {
+        return -1;
+    }
+    if (catalog_dir != NULL && batch_use_catalog(&list, catalog_dir) != 0) {
+        printf("Failed to use the catalog %s.\n", catalog_dir);
+        batch_free(&list);
+        return -1;
+    }
+    for (size_t i = 0; i < list.rom_count && quirks != QUIRKS_COUNT; i++) {
+        list.roms[i].quirks = quirks;
+    }
+
+    batch_result *results = calloc(list.job_count + 1, sizeof(batch_result));
+    if (results == NULL || batch_run(&list, results, threads, kind, &stats) != 0) {
+        printf("Failed to run the batch.\n");
+        free(results);
+        batch_free(&list);
+        return -1;
+    }
+
+    for (size_t i = 0; i < list.job_count; i++) {
+        const batch_result *result_ptr = &results[i];
+        printf("job %zu rom %s worker %d instructions %llu time %.3f ms pc %#x hash %016llx\n",
+               i, list.roms[list.jobs[i].rom_index].path, result_ptr->worker,
+               (unsigned long long)result_ptr->executed, result_ptr->seconds * 1e3,
+               result_ptr->program_counter, (unsigned long long)result_ptr->display_hash);
+    }
+    printf("Jobs: %zu on %d threads (%llu stolen, %llu reset from dirty pages)\n", list.job_count, threads,
+           (unsigned long long)stats.steals, (unsigned long long)stats.resets);
+    printf("Engine: %s\n", engine_name(kind));
+    printf("Instructions executed: %llu (%llu skipped in idle loops)\n", (unsigned long long)stats.executed,
+           (unsigned long long)stats.idle_cycles);
+    printf("Elapsed time: %.3f s\n", stats.seconds);
+    printf("Instructions/sec: %.0f\n", stats.executed / stats.seconds);
+
+    free(results);
+    batch_free(&list);
+    return 0;
+}
+
+// Runs the engine and the reference interpreter in lockstep chunks, returns 0 if they never diverged. Both go
+// through the timed path the frontend uses, so timer ticks and idle-loop skipping are compared too.
+static int run_diff(chip8_engine *engine_ptr, chip8_cpu *cpu_ptr, double duration) {
+    chip8_cpu reference = *cpu_ptr;
+#ifdef CHIP8_TRACE
+    // Only the engine side is traced
+    reference.trace_ptr = NULL;
+#endif
+    double start = now_seconds();
+
+    while (now_seconds() - start < duration) {
+        uint64_t first_cycle = reference.cycle_count;
+
+        run_for_cycles(&reference, DIFF_CHUNK);
+        engine_run_for_cycles(engine_ptr, cpu_ptr, DIFF_CHUNK);
+
+        if (!cpu_state_equal(&reference, cpu_ptr)) {
+            printf("Engine %s diverged from the interpreter between cycles %llu and %llu.\n",
+                   engine_name(engine_ptr->kind), (unsigned long long)first_cycle,
+                   (unsigned long long)reference.cycle_count);
+            printf("Program counter: interpreter %#x, engine %#x\n",
+                   reference.registers.program_counter, cpu_ptr->registers.program_counter);
+            return -1;
+        }
+    }
+
+    printf("Engine %s matched the interpreter for %llu cycles (%llu skipped in idle loops).\n",
+           engine_name(engine_ptr->kind), (unsigned long long)reference.cycle_count,
+           (unsigned long long)reference.idle_cycles);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    engine_kind kind = ENGINE_BLOCKS;
+    double duration = 5.0;
+    const char *jobs_path = NULL, *log_path = NULL, *hashes_path = NULL, *catalog_dir = NULL, *audio_name = NULL;
+    const char *stream_path = NULL;
+    uint32_t keyframe_interval = STREAM_DEFAULT_KEYFRAME_INTERVAL;
+    frame_stream stream, *stream_ptr = NULL;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    quirk_profile quirks = QUIRKS_COUNT; // As cataloged
+    int diff = 0, debug = 0, lockstep = 0, option;
+    uint32_t seed = 0;
+#ifdef CHIP8_TRACE
+    const char *trace_path = NULL;
+#endif
+#ifdef CHIP8_PROFILE
+    const char *profile_path = NULL;
+    profile *prof = NULL;
+#endif
+
+    while ((option = getopt(argc, argv, "e:s:dgb:j:L:r:o:a:C:q:S:K:t:p:h")) != -1) {
+        switch (option) {
+            case 'e':
+                if (engine_parse(optarg, &kind) != 0) {
+                    printf("Unknown engine %s.\n", optarg);
+                    return -1;
+                }
+                break;
+            case 's':
+                duration = atof(optarg);
+                break;
+            case 'd':
+                diff = 1;
+                break;
+            case 'g':
+                debug = 1;
+                break;
+            case 'b':
+                jobs_path = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'L':
+                lockstep = 1;
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                log_path = optarg;
+                break;
+            case 'o':
+                hashes_path = optarg;
+                break;
+            case 'a':
+                audio_name = optarg;
+                break;
+            case 'C':
+                catalog_dir = optarg;
+                break;
+            case 'S':
+                stream_path = optarg;
+                break;
+            case 'K':
+                keyframe_interval = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'q':
+                if (quirks_parse(optarg, &quirks) != 0) {
+                    printf("Unknown quirk profile %s.\n", optarg);
+                    return -1;
+                }
+                break;
+            case 't':
+#ifdef CHIP8_TRACE
+                trace_path = optarg;
+                break;
+#else
+                printf("Tracing needs a build with -DCHIP8_TRACE.\n");
+                return -1;
+#endif
+            case 'p':
+#ifdef CHIP8_PROFILE
+                profile_path = optarg;
+                break;
+#else
+                printf("Profiling needs a build with -DCHIP8_PROFILE.\n");
+                return -1;
+#endif
+            default:
+                usage(argv[0]);
+                return option == 'h' ? 0 : -1;
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (stream_path != NULL && (jobs_path != NULL || lockstep || diff || debug)) {
+        printf("Streaming needs a single run or a replay.\n");
+        return -1;
+    }
+    if (jobs_path != NULL) {
+        return run_batch(catalog_dir, jobs_path, quirks, threads, kind);
+    }
+    if (log_path != NULL) {
+        if (stream_path != NULL) {
+            if (stream_open(&stream, stream_path, keyframe_interval) != 0) {
+                return -1;
+            }
+            stream_ptr = &stream;
+        }
+        int result = run_replay(log_path, hashes_path, audio_name, kind, stream_ptr);
+        if (stream_ptr != NULL) {
+            stream_report(stream_ptr);
+            stream_close(stream_ptr);
+        }
+        return result;
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return -1;
+    }
+    const char *path = argv[optind];
+    if (lockstep) {
+        return run_lockstep(catalog_dir, path, quirks, seed, duration);
+    }
+
+    chip8_cpu CPU = init();
+    uint64_t hash = 0;
+    double load_start = now_seconds();
+    if (load_program(catalog_dir, path, quirks, &CPU, &hash) != 0) {
+        printf("Failed to load ROM %s.\n", path);
+        return -1;
+    }
+
+    chip8_engine engine;
+    if (engine_init(&engine, kind) != 0) {
+        printf("Failed to allocate the %s engine.\n", engine_name(kind));
+        return -1;
+    }
+    // Blocks are persisted for the ROM as loaded, the memory at this point is what they are checked against
+    uint8_t original[4096];
+    int analysis_loaded = 0;
+    memcpy(original, CPU.memory, sizeof(original));
+    if (catalog_dir != NULL && engine.block_cache_ptr != NULL) {
+        analysis_loaded = catalog_load_analysis(catalog_dir, hash, original, engine.block_cache_ptr) == 0;
+    }
+    double load_seconds = now_seconds() - load_start;
+#ifdef CHIP8_TRACE
+    if (trace_path != NULL && (CPU.trace_ptr = trace_create(trace_path)) == NULL) {
+        engine_free(&engine);
+        return -1;
+    }
+#endif
+
+    if (debug) {
+        debugger dbg;
+        debugger_init(&dbg);
+        debugger_repl(&dbg, &CPU, &engine, stdin);
+#ifdef CHIP8_TRACE
+        trace_destroy(CPU.trace_ptr);
+#endif
+        engine_free(&engine);
+        return 0;
+    }
+    if (diff) {
+        int result = run_diff(&engine, &CPU, duration);
+#ifdef CHIP8_TRACE
+        trace_destroy(CPU.trace_ptr);
+#endif
+        engine_free(&engine);
+        return result;
+    }
+
+#ifdef CHIP8_PROFILE
+    if (profile_path != NULL) {
+        CPU.profile_ptr = prof = profile_create();
+        if (prof != NULL && profile_sample_thread(prof, PROFILE_ENTERED) != 0) {
+            profile_destroy(prof);
+            CPU.profile_ptr = prof = NULL;
+        }
+    }
+#endif
+
+    if (stream_path != NULL) {
+        if (stream_open(&stream, stream_path, keyframe_interval) != 0) {
+#ifdef CHIP8_TRACE
+            trace_destroy(CPU.trace_ptr);
+#endif
+            engine_free(&engine);
+            return -1;
+        }
+        stream_ptr = &stream;
+    }
+
+    // Run the ROM unthrottled until the time budget is spent, with the timers ticking so programs waiting on
+    // the delay timer get past it. Cycles fast-forwarded through idle loops are not counted as executed.
+    double start = now_seconds(), elapsed = 0.0;
+    uint64_t executed = 0, idle_start = CPU.idle_cycles;
+    while (elapsed < duration) {
+        if (stream_ptr != NULL) {
+            // A 60 Hz frame at a time, publishing the picture each one ends with
+            executed += engine_run_for_cycles(&engine, &CPU, cycles_until_tick(&CPU));
+            stream_publish(stream_ptr, CPU.display);
+        } else {
+            executed += engine_run_for_cycles(&engine, &CPU, BENCH_CHUNK);
+        }
+        elapsed = now_seconds() - start;
+#ifdef CHIP8_PROFILE
+        // SIGUSR1 writes the report so far without stopping the run
+        if (CPU.profile_ptr != NULL && profile_report_requested()) {
+            profile_write(prof, &CPU, profile_path);
+        }
+#endif
+    }
+#ifdef CHIP8_PROFILE
+    if (CPU.profile_ptr != NULL) {
+        profile_write(prof, &CPU, profile_path);
+        profile_destroy(prof);
+    }
+#endif
+
+    printf("ROM: %s\n", path);
+    if (catalog_dir != NULL) {
+        printf("Catalog hash: %016llx\n", (unsigned long long)hash);
+        if (engine.block_cache_ptr != NULL) {
+            printf("Blocks: %s\n", analysis_loaded ? "loaded from the catalog" : "translated from scratch");
+            catalog_save_analysis(catalog_dir, hash, engine.block_cache_ptr, CPU.memory, original);
+        }
+    }
+    printf("Load time: %.3f ms\n", load_seconds * 1e3);
+    printf("Quirks: %s\n", quirks_name(CPU.quirks));
+#ifdef CHIP8_PROFILE
+    if (profile_path != NULL && kind != ENGINE_INTERPRETER) {
+        printf("Engine: interp, profiling replaced %s\n", engine_name(kind));
+    } else {
+        printf("Engine: %s\n", engine_name(kind));
+    }
+#else
+    printf("Engine: %s\n", engine_name(kind));
+#endif
+    uint64_t idle = CPU.idle_cycles - idle_start;
+    executed -= idle;
+    printf("Instructions executed: %llu (%llu more cycles skipped in idle loops)\n", (unsigned long long)executed,
+           (unsigned long long)idle);
+    printf("Elapsed time: %.3f s\n", elapsed);
+    printf("Instructions/sec: %.0f\n", executed / elapsed);
+    if (stream_ptr != NULL) {
+        stream_report(stream_ptr);
+        stream_close(stream_ptr);
+    }
+
+#ifdef CHIP8_TRACE
+    trace_destroy(CPU.trace_ptr);
+#endif
+    engine_free(&engine);
+    return 0;
+}
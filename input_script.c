@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "chip8.h"
+#include "engine.h"
+#include "savestate.h"
+#include "input_script.h"
+
+#define INPUT_LOG_MAGIC "C8IN"
+#define INPUT_LOG_VERSION 2
+#define INPUT_LOG_HEADER_SIZE (4 + 4 + 8 + 8)
+
+static int append_event(input_script *script_ptr, uint64_t cycle, uint16_t keys) {
+    if (script_ptr->count == script_ptr->capacity) {
+        size_t capacity = script_ptr->capacity ? script_ptr->capacity * 2 : 64;
+        input_event *events = realloc(script_ptr->events, capacity * sizeof(input_event));
+        if (events == NULL) {
+            return -1;
+        }
+        script_ptr->events = events;
+        script_ptr->capacity = capacity;
+    }
+    script_ptr->events[script_ptr->count].cycle = cycle;
+    script_ptr->events[script_ptr->count].keys = keys;
+    script_ptr->count++;
+    return 0;
+}
+
+int input_script_load(const char *path, input_script *script_ptr) {
+    FILE *file_ptr = fopen(path, "r");
+    char line[256];
+
+    script_ptr->events = NULL;
+    script_ptr->count = 0;
+    script_ptr->capacity = 0;
+
+    if (file_ptr == NULL) {
+        printf("Failed to open input script %s.\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file_ptr) != NULL) {
+        unsigned long long cycle;
+        unsigned int keys;
+        char *comment = line;
+
+        while (*comment != '\0' && *comment != '#') {
+            comment++;
+        }
+        *comment = '\0';
+
+        if (sscanf(line, "%llu %x", &cycle, &keys) != 2) {
+            continue;
+        }
+        if (script_ptr->count > 0 && cycle < script_ptr->events[script_ptr->count - 1].cycle) {
+            printf("Input script %s is not sorted by cycle.\n", path);
+            input_script_free(script_ptr);
+            fclose(file_ptr);
+            return -1;
+        }
+
+        if (append_event(script_ptr, cycle, keys & 0xFFFF) != 0) {
+            input_script_free(script_ptr);
+            fclose(file_ptr);
+            return -1;
+        }
+    }
+
+    fclose(file_ptr);
+    return 0;
+}
+
+void input_script_free(input_script *script_ptr) {
+    free(script_ptr->events);
+    script_ptr->events = NULL;
+    script_ptr->count = 0;
+    script_ptr->capacity = 0;
+}
+
+void apply_key_mask(chip8_cpu *cpu_ptr, uint16_t keys) {
+    cpu_ptr->keys = keys;
+}
+
+uint64_t run_with_script(chip8_engine *engine_ptr, chip8_cpu *cpu_ptr, const input_script *script_ptr, uint64_t cycles) {
+    size_t next = 0;
+
+    run_script_until(engine_ptr, cpu_ptr, script_ptr, &next, cpu_ptr->cycle_count + cycles);
+    return cycles;
+}
+
+void run_script_until(chip8_engine *engine_ptr, chip8_cpu *cpu_ptr, const input_script *script_ptr, size_t *next_ptr, uint64_t end) {
+    size_t next = *next_ptr;
+
+    // Events that are already due are applied before running up to the following one
+    while (cpu_ptr->cycle_count < end) {
+        while (next < script_ptr->count && script_ptr->events[next].cycle <= cpu_ptr->cycle_count) {
+            apply_key_mask(cpu_ptr, script_ptr->events[next].keys);
+            next++;
+        }
+
+        uint64_t until = end;
+        if (next < script_ptr->count && script_ptr->events[next].cycle < until) {
+            until = script_ptr->events[next].cycle;
+        }
+        engine_run_for_cycles(engine_ptr, cpu_ptr, until - cpu_ptr->cycle_count);
+    }
+    *next_ptr = next;
+}
+
+int input_log_start(input_log *log_ptr, const chip8_cpu *cpu_ptr) {
+    snapshot_save(cpu_ptr, log_ptr->start);
+    log_ptr->script.count = 0;
+    log_ptr->end_cycle = cpu_ptr->cycle_count;
+    return append_event(&log_ptr->script, cpu_ptr->cycle_count, cpu_ptr->keys);
+}
+
+void input_log_free(input_log *log_ptr) {
+    input_script_free(&log_ptr->script);
+}
+
+int input_log_record(input_log *log_ptr, uint64_t cycle, uint16_t keys) {
+    input_script *script_ptr = &log_ptr->script;
+
+    while (script_ptr->count > 0 && script_ptr->events[script_ptr->count - 1].cycle >= cycle) {
+        script_ptr->count--;
+    }
+    // Nothing changed since the previous event, e.g. a key pressed and released within one frame
+    if (script_ptr->count > 0 && script_ptr->events[script_ptr->count - 1].keys == keys) {
+        return 0;
+    }
+    return append_event(script_ptr, cycle, keys);
+}
+
+static void put_le(uint8_t *out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint64_t get_le(const uint8_t *in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+int input_log_write(input_log *log_ptr, uint64_t end_cycle, const char *path) {
+    const input_script *script_ptr = &log_ptr->script;
+    uint8_t header[INPUT_LOG_HEADER_SIZE];
+    FILE *file_ptr = fopen(path, "wb");
+
+    if (file_ptr == NULL) {
+        printf("Failed to create input log %s.\n", path);
+        return -1;
+    }
+
+    log_ptr->end_cycle = end_cycle;
+    memcpy(header, INPUT_LOG_MAGIC, 4);
+    put_le(header + 4, INPUT_LOG_VERSION, 4);
+    put_le(header + 8, end_cycle, 8);
+    put_le(header + 16, script_ptr->count, 8);
+    int written = fwrite(header, 1, sizeof(header), file_ptr) == sizeof(header) &&
+                  fwrite(log_ptr->start, 1, SNAPSHOT_SIZE, file_ptr) == SNAPSHOT_SIZE;
+
+    // Cycles are stored as the delta to the previous event, one or two bytes for presses a fraction of a second apart
+    uint64_t previous = 0;
+    for (size_t i = 0; i < script_ptr->count && written; i++) {
+        uint8_t event[10 + 2], *out = event;
+        uint64_t delta = script_ptr->events[i].cycle - previous;
+        do {
+            *out++ = (delta & 0x7F) | (delta > 0x7F ? 0x80 : 0);
+            delta >>= 7;
+        } while (delta != 0);
+        put_le(out, script_ptr->events[i].keys, 2);
+        out += 2;
+        written = fwrite(event, 1, out - event, file_ptr) == (size_t)(out - event);
+        previous = script_ptr->events[i].cycle;
+    }
+
+    if (fclose(file_ptr) != 0 || !written) {
+        printf("Failed to write input log %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int input_log_read(input_log *log_ptr, const char *path) {
+    uint8_t header[INPUT_LOG_HEADER_SIZE];
+    FILE *file_ptr = fopen(path, "rb");
+
+    memset(log_ptr, 0, sizeof(*log_ptr));
+    if (file_ptr == NULL) {
+        printf("Failed to open input log %s.\n", path);
+        return -1;
+    }
+
+    if (fread(header, 1, sizeof(header), file_ptr) != sizeof(header) || memcmp(header, INPUT_LOG_MAGIC, 4) != 0 ||
+        get_le(header + 4, 4) != INPUT_LOG_VERSION || fread(log_ptr->start, 1, SNAPSHOT_SIZE, file_ptr) != SNAPSHOT_SIZE) {
+        printf("%s is not a compatible input log.\n", path);
+        fclose(file_ptr);
+        return -1;
+    }
+    log_ptr->end_cycle = get_le(header + 8, 8);
+
+    uint64_t count = get_le(header + 16, 8), cycle = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t delta = 0;
+        uint8_t keys[2];
+        int byte, shift = 0;
+        do {
+            byte = fgetc(file_ptr);
+            delta |= (uint64_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte != EOF && (byte & 0x80) && shift < 64);
+
+        if (byte == EOF || (byte & 0x80) || fread(keys, 1, 2, file_ptr) != 2 ||
+            append_event(&log_ptr->script, cycle + delta, get_le(keys, 2)) != 0) {
+            printf("Input log %s is truncated.\n", path);
+            input_log_free(log_ptr);
+            fclose(file_ptr);
+            return -1;
+        }
+        cycle += delta;
+    }
+
+    fclose(file_ptr);
+    return 0;
+}
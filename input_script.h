@@ -0,0 +1,59 @@
+#ifndef INPUT_SCRIPT_H
+#define INPUT_SCRIPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chip8.h"
+#include "engine.h"
+#include "savestate.h"
+
+// From the given cycle on, the keys whose bits are set in the mask are held down (bit n is key n)
+typedef struct {
+    uint64_t cycle;
+    uint16_t keys;
+} input_event;
+
+typedef struct {
+    input_event *events; // Sorted by cycle
+    size_t count, capacity;
+} input_script;
+
+// A recorded session: the machine when recording started and every change of the key mask after it.
+// Replaying the events from the snapshot reproduces the session exactly, the random generator included.
+typedef struct {
+    uint8_t start[SNAPSHOT_SIZE];
+    input_script script;
+    uint64_t end_cycle; // Cycle the session ended at, set by input_log_write and input_log_read
+} input_log;
+
+// Parses a text script with one "<cycle> <hex key mask>" pair per line, '#' starts a comment.
+// Returns 0 on success and -1 on failure.
+int input_script_load(const char *path, input_script *script_ptr);
+void input_script_free(input_script *script_ptr);
+
+// Sets the keypad to the keys held in the mask
+void apply_key_mask(chip8_cpu *cpu_ptr, uint16_t keys);
+
+// Runs the CPU for a number of cycles with the timers ticking, applying the script events when their cycle is reached
+uint64_t run_with_script(chip8_engine *engine_ptr, chip8_cpu *cpu_ptr, const input_script *script_ptr, uint64_t cycles);
+
+// Runs the CPU up to the end cycle like run_with_script, resuming at the event *next_ptr and leaving it
+// at the first event not applied yet, so a script can be played back in pieces (e.g. one frame at a time)
+void run_script_until(chip8_engine *engine_ptr, chip8_cpu *cpu_ptr, const input_script *script_ptr, size_t *next_ptr, uint64_t end);
+
+// Starts a new recording from the current state of the CPU, dropping the events recorded so far.
+// A log starts out zeroed. Returns 0 on success and -1 on failure.
+int input_log_start(input_log *log_ptr, const chip8_cpu *cpu_ptr);
+void input_log_free(input_log *log_ptr);
+
+// Records that the keys in the mask are held from the given cycle on. Events from that cycle on are dropped
+// first, so recording at an earlier cycle after rewinding replaces the future that was undone.
+// Returns 0 on success and -1 if the log could not grow.
+int input_log_record(input_log *log_ptr, uint64_t cycle, uint16_t keys);
+
+// Log files: "C8IN", version, end cycle, event count, the start snapshot, then every event as a LEB128
+// delta to the cycle of the previous event and a little-endian key mask. Return 0 on success and -1 on failure.
+int input_log_write(input_log *log_ptr, uint64_t end_cycle, const char *path);
+int input_log_read(input_log *log_ptr, const char *path);
+
+#endif
@@ -0,0 +1,524 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "chip8.h"
+#include "opcodes.h"
+#include "lanes.h"
+
+// Comparisons between lane vectors produce these signed vectors, -1 where true and 0 where false
+typedef int8_t lane_i8 __attribute__((vector_size(CHIP8_LANES)));
+typedef int16_t lane_i16 __attribute__((vector_size(2 * CHIP8_LANES)));
+typedef int32_t lane_i32 __attribute__((vector_size(4 * CHIP8_LANES)));
+typedef int64_t lane_i64 __attribute__((vector_size(8 * CHIP8_LANES)));
+
+// Keeps old in the lanes outside the mask and takes new in the lanes inside it
+#define BLEND(old, new, mask) ((old) ^ (((old) ^ (new)) & (mask)))
+
+// The lanes executing the current opcode, as all-ones elements at every width the registers use
+typedef struct {
+    lane_u8 m8;
+    lane_u16 m16;
+    lane_u32 m32;
+    lane_u64 m64;
+} lane_mask;
+
+static inline lane_u8 splat8(uint8_t value) {
+    return (lane_u8){0} + value;
+}
+
+static inline lane_u16 splat16(uint16_t value) {
+    return (lane_u16){0} + value;
+}
+
+static inline lane_u16 widen(lane_u8 value) {
+    return __builtin_convertvector(value, lane_u16);
+}
+
+static inline lane_u16 widen_condition(lane_i8 condition) {
+    return (lane_u16)__builtin_convertvector(condition, lane_i16);
+}
+
+static inline lane_u8 narrow(lane_u16 value) {
+    return __builtin_convertvector(value, lane_u8);
+}
+
+static inline int mask_any(lane_i16 mask) {
+    uint64_t words[sizeof(mask) / 8], any = 0;
+    memcpy(words, &mask, sizeof(mask));
+    for (size_t i = 0; i < sizeof(mask) / 8; i++) {
+        any |= words[i];
+    }
+    return any != 0;
+}
+
+static inline int mask_equal(lane_i16 a, lane_i16 b) {
+    return !mask_any(a ^ b);
+}
+
+// True when every lane in the mask holds the expected value, so the lanes can share one memory or stack slot
+static inline int uniform8(lane_u8 value, uint8_t expected, const lane_mask *m) {
+    return mask_equal(__builtin_convertvector((lane_i8)(value == expected), lane_i16) & (lane_i16)m->m16, (lane_i16)m->m16);
+}
+
+static inline int uniform16(lane_u16 value, uint16_t expected, const lane_mask *m) {
+    return mask_equal((value == expected) & (lane_i16)m->m16, (lane_i16)m->m16);
+}
+
+chip8_lanes *lanes_create(void) {
+    size_t alignment = _Alignof(chip8_lanes);
+    size_t size = (sizeof(chip8_lanes) + alignment - 1) / alignment * alignment;
+    return aligned_alloc(alignment, size);
+}
+
+void lanes_destroy(chip8_lanes *lanes_ptr) {
+    free(lanes_ptr);
+}
+
+int lanes_init(chip8_lanes *lanes_ptr, const uint8_t *rom, size_t size, uint32_t seed, quirk_profile quirks) {
+    if (size > 4096 - 0x200) {
+        return -1;
+    }
+
+    memset(lanes_ptr, 0, sizeof(*lanes_ptr));
+    lanes_ptr->quirks = quirks;
+    lanes_ptr->clock_hz = CHIP8_DEFAULT_CLOCK_HZ;
+    lanes_ptr->registers.program_counter = splat16(0x200);
+    for (size_t i = 0; i < sizeof(chip8_font); i++) {
+        lanes_ptr->memory[i] = splat8(chip8_font[i]);
+    }
+    for (size_t i = 0; i < size; i++) {
+        lanes_ptr->memory[0x200 + i] = splat8(rom[i]);
+    }
+    for (int lane = 0; lane < CHIP8_LANES; lane++) {
+        lanes_ptr->registers.rng[lane] = mix_seed(seed + lane);
+    }
+    return 0;
+}
+
+void lanes_display(const chip8_lanes *lanes_ptr, int lane, uint64_t display[32]) {
+    for (int row = 0; row < 32; row++) {
+        display[row] = lanes_ptr->display[row][lane];
+    }
+}
+
+void lanes_set_clock_hz(chip8_lanes *lanes_ptr, uint32_t hz) {
+    lanes_ptr->clock_hz = hz > 0 ? hz : 1;
+    lanes_ptr->timer_phase %= lanes_ptr->clock_hz;
+}
+
+void lanes_set_keys(chip8_lanes *lanes_ptr, int lane, uint16_t keys) {
+    lanes_ptr->registers.keys[lane] = keys;
+}
+
+static inline void mark_written(chip8_lanes *lanes_ptr, uint16_t address) {
+    lanes_ptr->written[address >> 3] |= 1 << (address & 7);
+}
+
+static inline void store_vector(chip8_lanes *lanes_ptr, uint16_t address, lane_u8 value, const lane_mask *m) {
+    address &= 0xFFF;
+    lanes_ptr->memory[address] = BLEND(lanes_ptr->memory[address], value, m->m8);
+    mark_written(lanes_ptr, address);
+}
+
+// Runs the opcode at once for every lane in the mask, returns 0 when the lanes' I or stack pointers
+// differ and the opcode has to take the per-lane path. Like the handlers in opcodes.h, quirks is a constant.
+static inline __attribute__((always_inline)) int execute_vector(chip8_lanes *lanes_ptr, opcode_id id, uint8_t x, uint8_t y,
+                                                                uint8_t kk, uint16_t nnn, const lane_mask *m, int leader,
+                                                                const unsigned quirks) {
+    lane_registers *r = &lanes_ptr->registers;
+    lane_u16 advance = m->m16 & 2;
+    lane_u8 vx = r->V[x], vy = r->V[y], shifted = quirks & QUIRK_SHIFT_VY ? vy : vx, result, flag;
+    lane_u16 skip, wide, tens;
+    lane_u32 state;
+    lane_u64 sprite, collision, column;
+    uint16_t I = r->I[leader];
+    uint8_t sp, row, rows;
+
+    switch (id) {
+        case OP_INVALID:
+            // Unknown opcodes leave the program counter untouched, like the reference interpreter
+            return 1;
+        case OP_Fx0A:
+            // Same wait as _Fx0A: lanes holding a released key take it and go on, the others keep waiting here
+            wide = r->key_wait_pressed & ~r->keys;
+            skip = widen_condition((lane_i8)(r->key_wait != 0)) & (wide != 0) & m->m16;
+            for (int lane = 0; lane < CHIP8_LANES; lane++) {
+                if (skip[lane]) {
+                    r->V[x][lane] = __builtin_ctz(wide[lane]);
+                }
+            }
+            r->key_wait = BLEND(r->key_wait, (lane_u8)__builtin_convertvector((lane_i16)~skip, lane_i8) & 1, m->m8);
+            r->key_wait_pressed = BLEND(r->key_wait_pressed, (r->key_wait_pressed | r->keys) & ~skip, m->m16);
+            r->program_counter += skip & 2;
+            return 1;
+        case OP_00E0:
+            for (int i = 0; i < 32; i++) {
+                lanes_ptr->display[i] &= ~m->m64;
+            }
+            break;
+        case OP_00EE:
+            if (!uniform8(r->stack_ptr, r->stack_ptr[leader], m)) {
+                return 0;
+            }
+            sp = (r->stack_ptr[leader] - 1) & 0xF;
+            r->stack_ptr = BLEND(r->stack_ptr, splat8(sp), m->m8);
+            r->program_counter = BLEND(r->program_counter, r->stack[sp] + 2, m->m16);
+            return 1;
+        case OP_1nnn:
+            r->program_counter = BLEND(r->program_counter, splat16(nnn), m->m16);
+            return 1;
+        case OP_2nnn:
+            if (!uniform8(r->stack_ptr, r->stack_ptr[leader], m)) {
+                return 0;
+            }
+            sp = r->stack_ptr[leader] & 0xF;
+            r->stack[sp] = BLEND(r->stack[sp], r->program_counter, m->m16);
+            r->stack_ptr = BLEND(r->stack_ptr, splat8(sp + 1), m->m8);
+            r->program_counter = BLEND(r->program_counter, splat16(nnn), m->m16);
+            return 1;
+        case OP_3xkk:
+            skip = widen_condition(vx == splat8(kk));
+            r->program_counter += (2 + (skip & 2)) & m->m16;
+            return 1;
+        case OP_4xkk:
+            skip = widen_condition(vx != splat8(kk));
+            r->program_counter += (2 + (skip & 2)) & m->m16;
+            return 1;
+        case OP_5xy0:
+            skip = widen_condition(vx == vy);
+            r->program_counter += (2 + (skip & 2)) & m->m16;
+            return 1;
+        case OP_9xy0:
+            skip = widen_condition(vx != vy);
+            r->program_counter += (2 + (skip & 2)) & m->m16;
+            return 1;
+        case OP_6xkk:
+            r->V[x] = BLEND(vx, splat8(kk), m->m8);
+            break;
+        case OP_7xkk:
+            r->V[x] = BLEND(vx, vx + kk, m->m8);
+            break;
+        case OP_8xy0:
+            r->V[x] = BLEND(vx, vy, m->m8);
+            break;
+        case OP_8xy1:
+            r->V[x] = BLEND(vx, vx | vy, m->m8);
+            if (quirks & QUIRK_VF_RESET) {
+                r->V[0xF] = BLEND(r->V[0xF], splat8(0), m->m8);
+            }
+            break;
+        case OP_8xy2:
+            r->V[x] = BLEND(vx, vx & vy, m->m8);
+            if (quirks & QUIRK_VF_RESET) {
+                r->V[0xF] = BLEND(r->V[0xF], splat8(0), m->m8);
+            }
+            break;
+        case OP_8xy3:
+            r->V[x] = BLEND(vx, vx ^ vy, m->m8);
+            if (quirks & QUIRK_VF_RESET) {
+                r->V[0xF] = BLEND(r->V[0xF], splat8(0), m->m8);
+            }
+            break;
+        // For the flag setting ops VF is written last so the flag wins when x is F
+        case OP_8xy4:
+            result = vx + vy;
+            flag = (lane_u8)(result < vx) & 1;
+            r->V[x] = BLEND(vx, result, m->m8);
+            r->V[0xF] = BLEND(r->V[0xF], flag, m->m8);
+            break;
+        case OP_8xy5:
+            flag = (lane_u8)(vx >= vy) & 1;
+            r->V[x] = BLEND(vx, vx - vy, m->m8);
+            r->V[0xF] = BLEND(r->V[0xF], flag, m->m8);
+            break;
+        case OP_8xy6:
+            flag = shifted & 1;
+            r->V[x] = BLEND(vx, shifted >> 1, m->m8);
+            r->V[0xF] = BLEND(r->V[0xF], flag, m->m8);
+            break;
+        case OP_8xy7:
+            flag = (lane_u8)(vy >= vx) & 1;
+            r->V[x] = BLEND(vx, vy - vx, m->m8);
+            r->V[0xF] = BLEND(r->V[0xF], flag, m->m8);
+            break;
+        case OP_8xyE:
+            flag = shifted >> 7;
+            r->V[x] = BLEND(vx, shifted << 1, m->m8);
+            r->V[0xF] = BLEND(r->V[0xF], flag, m->m8);
+            break;
+        case OP_Annn:
+            r->I = BLEND(r->I, splat16(nnn), m->m16);
+            break;
+        case OP_Bnnn:
+            r->program_counter = BLEND(r->program_counter, splat16(nnn) + widen(r->V[quirks & QUIRK_JUMP_VX ? nnn >> 8 : 0x0]), m->m16);
+            return 1;
+        case OP_Cxkk:
+            // xorshift32, only the lanes executing the opcode advance their generator
+            state = r->rng;
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            r->rng = BLEND(r->rng, state, m->m32);
+            r->V[x] = BLEND(vx, __builtin_convertvector(state, lane_u8) & kk, m->m8);
+            break;
+        case OP_Dxyn:
+            // Every lane draws its own sprite bytes at its own column, the row has to be shared
+            if (!uniform16(r->I, I, m) || !uniform8(vy, vy[leader], m)) {
+                return 0;
+            }
+            row = vy[leader] & 31;
+            rows = (quirks & QUIRK_WRAP_SPRITES) || row + (kk & 0xF) <= 32 ? kk & 0xF : 32 - row;
+            column = __builtin_convertvector(vx & 63, lane_u64);
+            collision = (lane_u64){0};
+            for (uint8_t i = 0; i < rows; i++) {
+                sprite = __builtin_convertvector(lanes_ptr->memory[(I + i) & 0xFFF], lane_u64) << 56;
+                if (quirks & QUIRK_WRAP_SPRITES) {
+                    sprite = (sprite >> column) | (sprite << ((64 - column) & 63));
+                } else {
+                    sprite >>= column;
+                }
+                sprite &= m->m64;
+                collision |= lanes_ptr->display[(row + i) & 31] & sprite;
+                lanes_ptr->display[(row + i) & 31] ^= sprite;
+            }
+            flag = (lane_u8)__builtin_convertvector(collision != 0, lane_i8) & 1;
+            r->V[0xF] = BLEND(r->V[0xF], flag, m->m8);
+            break;
+        case OP_Ex9E:
+            skip = widen_condition((lane_i8)__builtin_convertvector((r->keys >> widen(vx & 0xF)) & 1, lane_u8) != 0);
+            r->program_counter += (2 + (skip & 2)) & m->m16;
+            return 1;
+        case OP_ExA1:
+            skip = widen_condition((lane_i8)__builtin_convertvector((r->keys >> widen(vx & 0xF)) & 1, lane_u8) == 0);
+            r->program_counter += (2 + (skip & 2)) & m->m16;
+            return 1;
+        case OP_Fx07:
+            r->V[x] = BLEND(vx, r->delay_timer, m->m8);
+            break;
+        case OP_Fx15:
+            r->delay_timer = BLEND(r->delay_timer, vx, m->m8);
+            break;
+        case OP_Fx18:
+            r->sound_timer = BLEND(r->sound_timer, vx, m->m8);
+            break;
+        case OP_Fx1E:
+            r->I = BLEND(r->I, r->I + widen(vx), m->m16);
+            break;
+        case OP_Fx29:
+            r->I = BLEND(r->I, (widen(vx) & 0xF) * 5, m->m16);
+            break;
+        case OP_Fx33:
+            if (!uniform16(r->I, I, m)) {
+                return 0;
+            }
+            // Division by 100 and 10 through multiply and shift, exact for every byte value
+            wide = widen(vx);
+            tens = (wide * 205) >> 11;
+            store_vector(lanes_ptr, I, narrow((wide * 41) >> 12), m);
+            store_vector(lanes_ptr, I + 1, narrow(tens - ((tens * 205) >> 11) * 10), m);
+            store_vector(lanes_ptr, I + 2, narrow(wide - tens * 10), m);
+            break;
+        case OP_Fx55:
+            if (!uniform16(r->I, I, m)) {
+                return 0;
+            }
+            for (int i = 0; i <= x; i++) {
+                store_vector(lanes_ptr, I + i, r->V[i], m);
+            }
+            if (quirks & QUIRK_INCREMENT_I) {
+                r->I = BLEND(r->I, splat16(I + x + 1), m->m16);
+            }
+            break;
+        case OP_Fx65:
+            if (!uniform16(r->I, I, m)) {
+                return 0;
+            }
+            for (int i = 0; i <= x; i++) {
+                r->V[i] = BLEND(r->V[i], lanes_ptr->memory[(I + i) & 0xFFF], m->m8);
+            }
+            if (quirks & QUIRK_INCREMENT_I) {
+                r->I = BLEND(r->I, splat16(I + x + 1), m->m16);
+            }
+            break;
+        default:
+            return 0;
+    }
+
+    r->program_counter += advance;
+    return 1;
+}
+
+static inline void store_byte(chip8_lanes *lanes_ptr, int lane, uint16_t address, uint8_t value) {
+    address &= 0xFFF;
+    lanes_ptr->memory[address][lane] = value;
+    mark_written(lanes_ptr, address);
+}
+
+// Same stack, memory and sprite opcodes for a single lane, used when the lanes' I, stack pointers or sprite rows differ
+static inline __attribute__((always_inline)) void execute_scalar(chip8_lanes *lanes_ptr, int lane, opcode_id id, uint16_t opcode,
+                                                                 const unsigned quirks) {
+    lane_registers *r = &lanes_ptr->registers;
+    uint16_t I = r->I[lane], nnn = opcode & 0x0FFF;
+    uint8_t x = (opcode & 0x0F00) >> 8, y = (opcode & 0x00F0) >> 4;
+    uint8_t sp, value, column, row, rows;
+    uint64_t sprite, collision = 0;
+
+    switch (id) {
+        case OP_00EE:
+            sp = (r->stack_ptr[lane] - 1) & 0xF;
+            r->stack_ptr[lane] = sp;
+            r->program_counter[lane] = r->stack[sp][lane] + 2;
+            return;
+        case OP_2nnn:
+            sp = r->stack_ptr[lane] & 0xF;
+            r->stack[sp][lane] = r->program_counter[lane];
+            r->stack_ptr[lane] = sp + 1;
+            r->program_counter[lane] = nnn;
+            return;
+        case OP_Dxyn:
+            column = r->V[x][lane] & 63;
+            row = r->V[y][lane] & 31;
+            rows = (quirks & QUIRK_WRAP_SPRITES) || row + (opcode & 0x000F) <= 32 ? opcode & 0x000F : 32 - row;
+            for (uint8_t i = 0; i < rows; i++) {
+                sprite = sprite_row(lanes_ptr->memory[(I + i) & 0xFFF][lane], column, quirks);
+                collision |= lanes_ptr->display[(row + i) & 31][lane] & sprite;
+                lanes_ptr->display[(row + i) & 31][lane] ^= sprite;
+            }
+            r->V[0xF][lane] = collision != 0;
+            break;
+        case OP_Fx33:
+            value = r->V[x][lane];
+            store_byte(lanes_ptr, lane, I, value / 100);
+            store_byte(lanes_ptr, lane, I + 1, (value % 100) / 10);
+            store_byte(lanes_ptr, lane, I + 2, value % 10);
+            break;
+        case OP_Fx55:
+            for (int i = 0; i <= x; i++) {
+                store_byte(lanes_ptr, lane, I + i, r->V[i][lane]);
+            }
+            if (quirks & QUIRK_INCREMENT_I) {
+                r->I[lane] = I + x + 1;
+            }
+            break;
+        case OP_Fx65:
+            for (int i = 0; i <= x; i++) {
+                r->V[i][lane] = lanes_ptr->memory[(I + i) & 0xFFF][lane];
+            }
+            if (quirks & QUIRK_INCREMENT_I) {
+                r->I[lane] = I + x + 1;
+            }
+            break;
+        default:
+            break;
+    }
+    r->program_counter[lane] += 2;
+}
+
+static inline int was_written(const chip8_lanes *lanes_ptr, uint16_t address) {
+    address &= 0xFFF;
+    return (lanes_ptr->written[address >> 3] >> (address & 7)) & 1;
+}
+
+// Always inlined into run_lanes() once per quirk profile, so every copy has its quirks folded in
+static inline __attribute__((always_inline)) void run_chunk(chip8_lanes *lanes_ptr, uint32_t n, const unsigned quirks) {
+    lane_registers *r = &lanes_ptr->registers;
+    lane_u32 executed = {0};
+    lane_i16 active = (lane_i16){0} == 0, group;
+    int leader = 0;
+
+    while (mask_any(active)) {
+        while (!active[leader]) {
+            leader = (leader + 1) % CHIP8_LANES;
+        }
+
+        // Common case: every active lane sits at the leader's program counter. Otherwise the lowest
+        // program counter goes first, so lanes that fell behind after a branch can catch up and reconverge.
+        uint16_t pc = r->program_counter[leader];
+        group = (r->program_counter == pc) & active;
+        if (!mask_equal(group, active)) {
+            for (int lane = 0; lane < CHIP8_LANES; lane++) {
+                if (active[lane] && r->program_counter[lane] < pc) {
+                    pc = r->program_counter[lane];
+                    leader = lane;
+                }
+            }
+            group = (r->program_counter == pc) & active;
+        }
+
+        // Lanes share the ROM, they only need to be compared where some lane has stored to memory
+        lane_u8 high = lanes_ptr->memory[pc & 0xFFF], low = lanes_ptr->memory[(pc + 1) & 0xFFF];
+        uint16_t opcode = (high[leader] << 8) | low[leader];
+        if (was_written(lanes_ptr, pc) || was_written(lanes_ptr, pc + 1)) {
+            lane_i8 same = (high == high[leader]) & (low == low[leader]);
+            group &= __builtin_convertvector(same, lane_i16);
+        }
+
+        lane_mask m;
+        m.m8 = (lane_u8)__builtin_convertvector(group, lane_i8);
+        m.m16 = (lane_u16)group;
+        m.m32 = (lane_u32)__builtin_convertvector(group, lane_i32);
+        m.m64 = (lane_u64)__builtin_convertvector(group, lane_i64);
+
+        opcode_id id = decode_opcode(opcode);
+        uint8_t x = (opcode & 0x0F00) >> 8;
+        uint16_t nnn = opcode & 0x0FFF;
+        if (execute_vector(lanes_ptr, id, x, (opcode & 0x00F0) >> 4, opcode & 0x00FF, nnn, &m, leader, quirks)) {
+            lanes_ptr->vector_steps++;
+        } else {
+            for (int lane = 0; lane < CHIP8_LANES; lane++) {
+                if (group[lane]) {
+                    execute_scalar(lanes_ptr, lane, id, opcode, quirks);
+                    lanes_ptr->scalar_steps++;
+                }
+            }
+        }
+
+        executed += m.m32 & 1;
+        if (id == OP_Fx0A) {
+            // Another try with the same keys changes nothing, the lanes still waiting are done with this chunk
+            group &= r->program_counter == pc;
+            executed = BLEND(executed, (lane_u32){0} + n, (lane_u32)__builtin_convertvector(group, lane_i32));
+        }
+        active = __builtin_convertvector(executed < n, lane_i16);
+    }
+}
+
+// Counts the timers of every lane down by the ticks that passed, stopping at zero
+static void advance_lane_timers(chip8_lanes *lanes_ptr, uint64_t cycles) {
+    uint64_t phase = lanes_ptr->timer_phase + cycles * 60;
+    uint64_t ticks = phase / lanes_ptr->clock_hz;
+    lane_registers *r = &lanes_ptr->registers;
+
+    lanes_ptr->timer_phase = phase % lanes_ptr->clock_hz;
+    if (ticks == 0) {
+        return;
+    }
+    // Saturating subtract: lanes already below the ticks go to zero
+    lane_u8 t = splat8(ticks < 255 ? ticks : 255);
+    r->delay_timer = (r->delay_timer - t) & (lane_u8)(r->delay_timer > t);
+    r->sound_timer = (r->sound_timer - t) & (lane_u8)(r->sound_timer > t);
+}
+
+uint64_t run_lanes(chip8_lanes *lanes_ptr, uint64_t n) {
+    uint64_t total = n * CHIP8_LANES;
+
+    // Budgets are counted in 32-bit lanes and cut at every timer tick, like run_for_cycles()
+    while (n > 0) {
+        uint64_t until_tick = (lanes_ptr->clock_hz - lanes_ptr->timer_phase + 59) / 60;
+        uint32_t chunk = n < until_tick ? (uint32_t)n : (uint32_t)until_tick;
+        switch (lanes_ptr->quirks) {
+            case QUIRKS_SCHIP:
+                run_chunk(lanes_ptr, chunk, QUIRK_SET_SCHIP);
+                break;
+            case QUIRKS_XOCHIP:
+                run_chunk(lanes_ptr, chunk, QUIRK_SET_XOCHIP);
+                break;
+            default:
+                run_chunk(lanes_ptr, chunk, QUIRK_SET_CHIP8);
+                break;
+        }
+        advance_lane_timers(lanes_ptr, chunk);
+        n -= chunk;
+    }
+    return total;
+}
@@ -0,0 +1,75 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "quirks.h"
+
+// Number of instances of the same ROM executed in lockstep: 8, 16 or 32.
+// 32 byte-wide lanes fill an AVX2 register, 16 fill an SSE register.
+#ifndef CHIP8_LANES
+#define CHIP8_LANES 32
+#endif
+
+#if CHIP8_LANES != 8 && CHIP8_LANES != 16 && CHIP8_LANES != 32
+#error "CHIP8_LANES must be 8, 16 or 32"
+#endif
+
+// Element n of every lane vector belongs to lane n. The compiler lowers the arithmetic
+// on these types to SSE/AVX2 instructions depending on the target flags (-msse2, -mavx2).
+typedef uint8_t lane_u8 __attribute__((vector_size(CHIP8_LANES)));
+typedef uint16_t lane_u16 __attribute__((vector_size(2 * CHIP8_LANES)));
+typedef uint32_t lane_u32 __attribute__((vector_size(4 * CHIP8_LANES)));
+typedef uint64_t lane_u64 __attribute__((vector_size(8 * CHIP8_LANES)));
+
+// Structure-of-arrays counterpart of cpu_registers
+typedef struct {
+    lane_u8 V[16], delay_timer, sound_timer;
+    lane_u16 I, program_counter;
+    lane_u16 keys; // Bit n set while key n is held down
+    lane_u16 key_wait_pressed; // Keys seen down since Fx0A started waiting, as in chip8_cpu
+    lane_u8 key_wait; // 1 in the lanes Fx0A blocks until a key is pressed and released
+    lane_u32 rng; // Per-lane xorshift32 state used by Cxkk
+    lane_u16 stack[16];
+    lane_u8 stack_ptr;
+} lane_registers;
+
+typedef struct {
+    lane_registers registers;
+    // Interleaved by address, so a store or load at the same address in every lane is one vector access
+    lane_u8 memory[4096];
+    lane_u64 display[32]; // Packed rows like chip8_cpu.display, one word per lane
+    uint8_t written[4096 / 8]; // Bit set for every byte some lane stored to, lanes may see different code there
+    uint64_t vector_steps; // Opcodes executed once for every lane sharing the program counter
+    uint64_t scalar_steps; // Opcodes executed lane by lane because the lanes' I, stack pointers or sprite rows differ
+    uint8_t quirks; // quirk_profile every lane runs the program with
+    // Every lane executes the same number of cycles, so they share the timer phase like they share the clock
+    uint32_t clock_hz;
+    uint32_t timer_phase; // Progress towards the next 60 Hz tick, as in chip8_cpu
+} chip8_lanes;
+
+// Allocates lanes with the alignment the vector registers need, returns NULL on failure
+chip8_lanes *lanes_create(void);
+void lanes_destroy(chip8_lanes *lanes_ptr);
+
+// Loads the same ROM into every lane at the default clock, lane n seeds its random generator from seed + n.
+// Lane n draws the same numbers as a chip8_cpu given seed_random(seed + n) and set_quirks(quirks).
+// Returns 0 on success and -1 if the ROM does not fit in the program area.
+int lanes_init(chip8_lanes *lanes_ptr, const uint8_t *rom, size_t size, uint32_t seed, quirk_profile quirks);
+
+// Sets the instructions per second of every lane, which sets how many of them run between timer ticks
+void lanes_set_clock_hz(chip8_lanes *lanes_ptr, uint32_t hz);
+
+// Sets the keys held down in one lane, bit n is key n
+void lanes_set_keys(chip8_lanes *lanes_ptr, int lane, uint16_t keys);
+
+// Copies the framebuffer of one lane out in the chip8_cpu.display layout
+void lanes_display(const chip8_lanes *lanes_ptr, int lane, uint64_t display[32]);
+
+// Executes n instructions in every lane, ticking the timers at 60 Hz of the clock like run_for_cycles().
+// Lanes whose program counters agree run the opcode together, the others wait for their turn.
+// A lane blocked in Fx0A spends the rest of the budget there, its keys can't change before the call returns.
+// Returns the total number of instructions executed over all lanes.
+uint64_t run_lanes(chip8_lanes *lanes_ptr, uint64_t n);
+
+#endif
@@ -1,595 +1,453 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
-
+#include "chip8.h"
+#include "presenter.h"
+#include "handoff.h"
+#include "scheduler.h"
+#include "savestate.h"
+#include "input_script.h"
+#include "audio.h"
+#include "trace.h"
+#include "profile.h"
+#include "timing.h"
+
+// Seconds of play the rewind buffer keeps
+#define REWIND_SECONDS 60
+
+// CHIP-8 keys 0 to F in order, each one a digit or letter key on the host keyboard
+#define DEFAULT_KEYMAP "1234QWERASDFZXCV"
+
+// The main thread owns the window and presents frames, the emulation thread owns everything below the handoff.
+// They only share the triple buffer, the input queue and the stop flag.
 typedef struct {
-    uint8_t V[16], delay_timer, sound_timer;
-    uint16_t I, program_counter, stack[16], stack_ptr;
-} cpu_registers;
-
+    chip8_cpu *cpu_ptr;
+    scheduler *scheduler_ptr;
+    rewind_buffer *rewind_ptr;
+    audio_output *audio_ptr; // NULL when no sink could be opened
+    const char *state_path;
+    input_log *log_ptr; // Records every key change when CHIP8_INPUT_LOG names a file, NULL otherwise
+    uint64_t log_frame; // First rewind frame that belongs to the recording
+    int rewinding; // Backspace held, frames are taken back instead of run
+    int rewind_started; // Backspace was just pressed, the newest recorded frame is the one on screen
+    int8_t chip8_key[GLFW_KEY_LAST + 1]; // CHIP-8 key of every host key, -1 when unmapped
+#ifdef CHIP8_PROFILE
+    const char *profile_path;
+#endif
+    uint64_t frames; // Emulated frames run or rewound
+    uint64_t input_sequence; // Host events applied
+    double input_time; // When the newest applied event was pushed
+    uint64_t published_sequence; // input_sequence of the last published frame
+    triple_buffer frames_out;
+    input_queue input;
+    atomic_int stop;
+} frontend;
+
+// Input-to-photon latency: from a key event reaching the input queue until the first frame emulated after it is on screen
 typedef struct {
-    uint8_t memory[4096], key_input[16];
-    GLubyte display_buffer[64 * 32 * 3]; // 64 x 32 over 3 color channels
-    cpu_registers registers;
-} chip8_cpu;
-
-void _00E0(chip8_cpu *cpu_ptr) {
-    for (int i = 0; i < 64; i++) {
-        for (int j = 0; j < 32; j++) {
-            cpu_ptr->display_buffer[(i * 32 + j) * 3 + 0] = 0; // R
-            cpu_ptr->display_buffer[(i * 32 + j) * 3 + 1] = 0; // G
-            cpu_ptr->display_buffer[(i * 32 + j) * 3 + 2] = 0; // B
-        }
+    uint64_t sequence; // Newest input_sequence measured
+    uint64_t count;
+    double total, max;
+} latency_stats;
+
+// Builds the host to CHIP-8 key table from a 16 character keymap, returns 0 on success and -1 if it is invalid
+static int load_keymap(frontend *frontend_ptr, const char *keymap) {
+    memset(frontend_ptr->chip8_key, -1, sizeof(frontend_ptr->chip8_key));
+    if (strlen(keymap) != 16) {
+        printf("Keymap must have 16 keys, one for each of 0-F.\n");
+        return -1;
     }
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _00EE(chip8_cpu *cpu_ptr) {
-    cpu_ptr->registers.stack_ptr -= 1;
-    cpu_ptr->registers.program_counter = cpu_ptr->registers.stack[cpu_ptr->registers.stack_ptr];
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _1nnn(chip8_cpu *cpu_ptr, uint16_t lowest_12_bits) {
-    cpu_ptr->registers.program_counter = lowest_12_bits;
-}
-
-void _2nnn(chip8_cpu *cpu_ptr, uint16_t lowest_12_bits) {
-    cpu_ptr->registers.stack[cpu_ptr->registers.stack_ptr] = cpu_ptr->registers.program_counter;
-    cpu_ptr->registers.stack_ptr += 1;
-    cpu_ptr->registers.program_counter = lowest_12_bits;
-}
 
-void _3xkk(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte) {
-    if (cpu_ptr->registers.V[lower_high_byte] == low_byte) {
-        cpu_ptr->registers.program_counter += 4;
-    } else {
-        cpu_ptr->registers.program_counter += 2;
+    for (int i = 0; i < 16; i++) {
+        // GLFW key codes of digits and letters are their uppercase ASCII values
+        int key = toupper((unsigned char)keymap[i]);
+        if (!isdigit(key) && !isupper(key)) {
+            printf("Keymap key %c is not a digit or a letter.\n", keymap[i]);
+            return -1;
+        }
+        frontend_ptr->chip8_key[key] = i;
     }
+    return 0;
 }
 
-void _4xkk(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte) {
-    if (cpu_ptr->registers.V[lower_high_byte] != low_byte) {
-        cpu_ptr->registers.program_counter += 4;
-    } else {
-        cpu_ptr->registers.program_counter += 2;
+// Logs the keys held at the current cycle
+static void record_keys(frontend *frontend_ptr) {
+    if (frontend_ptr->log_ptr != NULL) {
+        input_log_record(frontend_ptr->log_ptr, frontend_ptr->cpu_ptr->cycle_count, frontend_ptr->cpu_ptr->keys);
     }
 }
 
-void _5xy0(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_lower_byte) {
-    if (cpu_ptr->registers.V[lower_high_byte] == cpu_ptr->registers.V[upper_lower_byte]) {
-        cpu_ptr->registers.program_counter += 4;
-    } else {
-        cpu_ptr->registers.program_counter += 2;
+// Starts the recording over from the current state, after a jump the events so far can't reproduce
+static void restart_log(frontend *frontend_ptr) {
+    if (frontend_ptr->log_ptr != NULL) {
+        input_log_start(frontend_ptr->log_ptr, frontend_ptr->cpu_ptr);
+        frontend_ptr->log_frame = frontend_ptr->rewind_ptr->frames;
     }
 }
 
-void _6xkk(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte)
-{
-    cpu_ptr->registers.V[lower_high_byte] = low_byte;
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _7xkk(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte)
-{
-    cpu_ptr->registers.V[lower_high_byte] += low_byte;
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _8xy0(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
-    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.V[upper_low_byte];
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _8xy1(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
-    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.V[lower_high_byte] | cpu_ptr->registers.V[upper_low_byte];
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _8xy2(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
-    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.V[lower_high_byte] & cpu_ptr->registers.V[upper_low_byte];
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _8xy3(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
-    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.V[lower_high_byte] ^ cpu_ptr->registers.V[upper_low_byte];
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _8xy4(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
-    uint8_t sum = (cpu_ptr->registers.V[lower_high_byte] + cpu_ptr->registers.V[upper_low_byte]) & 0xFF;
-    cpu_ptr->registers.V[lower_high_byte] = (cpu_ptr->registers.V[lower_high_byte] + cpu_ptr->registers.V[upper_low_byte]) & 0xFF;
-    uint16_t carry = sum & 0xF00;
-    if (carry) {
-        cpu_ptr->registers.V[16] = 1;
-    } else {
-        cpu_ptr->registers.V[16] = 0;
-    }
-    cpu_ptr->registers.program_counter += 2;
-}
+// Keys only change here, so the emulation loop never polls the keyboard. Runs on the emulation thread.
+static void apply_host_event(frontend *frontend_ptr, const host_event *event_ptr) {
+    int key = event_ptr->key, action = event_ptr->action;
 
-void _8xy5(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
-    if ((cpu_ptr->registers.V[lower_high_byte] > cpu_ptr->registers.V[upper_low_byte])) {
-        cpu_ptr->registers.V[16] = 1;
-    } else {
-        cpu_ptr->registers.V[16] = 0;
+    frontend_ptr->input_sequence++;
+    frontend_ptr->input_time = event_ptr->time;
+    // Tab switches between real-time pacing and running as fast as possible
+    if (key == GLFW_KEY_TAB && action == GLFW_PRESS) {
+        scheduler_set_realtime(frontend_ptr->scheduler_ptr, !frontend_ptr->scheduler_ptr->realtime);
+        return;
     }
-    cpu_ptr->registers.V[lower_high_byte] = (cpu_ptr->registers.V[lower_high_byte] - cpu_ptr->registers.V[upper_low_byte]) & 0xFF;
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _8xy6(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
-    if (cpu_ptr->registers.V[lower_high_byte] & 0b1) { 
-        cpu_ptr->registers.V[16] = 1;
+    if (key == GLFW_KEY_BACKSPACE) {
+        frontend_ptr->rewinding = action == GLFW_PRESS;
+        frontend_ptr->rewind_started = frontend_ptr->rewinding;
+        return;
     }
-    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.V[lower_high_byte] >> 2;
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _8xy7(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
-    if ((cpu_ptr->registers.V[lower_high_byte] < cpu_ptr->registers.V[upper_low_byte])) {
-        cpu_ptr->registers.V[16] = 1;
-    } else {
-        cpu_ptr->registers.V[16] = 0;
+    // F5 saves the state next to the ROM, F9 loads it back. The keys held right now stay held.
+    if ((key == GLFW_KEY_F5 || key == GLFW_KEY_F9) && action == GLFW_PRESS) {
+        uint16_t keys = frontend_ptr->cpu_ptr->keys;
+        if (key == GLFW_KEY_F5) {
+            savestate_write(frontend_ptr->cpu_ptr, frontend_ptr->state_path);
+        } else if (savestate_read(frontend_ptr->cpu_ptr, frontend_ptr->state_path) == 0) {
+            frontend_ptr->cpu_ptr->keys = keys;
+            restart_log(frontend_ptr);
+        }
+        return;
     }
-    cpu_ptr->registers.V[lower_high_byte] = (cpu_ptr->registers.V[upper_low_byte] - cpu_ptr->registers.V[lower_high_byte]) & 0xFF;
-    cpu_ptr->registers.program_counter += 2;
-}
 
-void _8xyE(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
-    if (cpu_ptr->registers.V[lower_high_byte] >> 8) {
-        cpu_ptr->registers.V[16] = 1;
-    } else {
-        cpu_ptr->registers.V[16] = 0;
+    int chip8_key = frontend_ptr->chip8_key[key];
+    if (chip8_key < 0) {
+        return;
     }
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _9xy0(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_lower_byte)
-{
-    if (cpu_ptr->registers.V[lower_high_byte] != cpu_ptr->registers.V[upper_lower_byte])
-    {
-        cpu_ptr->registers.program_counter += 4;
+    if (action == GLFW_PRESS) {
+        frontend_ptr->cpu_ptr->keys |= 1 << chip8_key;
     } else {
-        cpu_ptr->registers.program_counter += 2;
+        frontend_ptr->cpu_ptr->keys &= ~(1 << chip8_key);
     }
+    record_keys(frontend_ptr);
 }
 
-void _Annn(chip8_cpu *cpu_ptr, uint16_t lowest_12_bits)
-{
-    cpu_ptr->registers.I = lowest_12_bits;
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _Bnnn(chip8_cpu *cpu_ptr, uint16_t lowest_12_bits)
-{
-    cpu_ptr->registers.program_counter = lowest_12_bits + cpu_ptr->registers.V[0x0];
-}
-
-void _Cxkk(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte) {
-    cpu_ptr->registers.V[lower_high_byte] = (rand() % 256) & low_byte; // Modulo operator to keep the random number in the 8 bit range
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _Dxyn() {
-    printf("Not implemented.\n");
-}
-
-void _Ex9E(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    if (cpu_ptr->key_input[lower_high_byte]) {
-        cpu_ptr->registers.program_counter += 4;
-    } else {
-        cpu_ptr->registers.program_counter += 2;
-    }
-}
+// Runs one emulated frame and records it for rewinding, or steps one frame back while Backspace is held
+static void run_frame(frontend *frontend_ptr) {
+    chip8_cpu *cpu_ptr = frontend_ptr->cpu_ptr;
 
-void _ExA1(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    if (!cpu_ptr->key_input[lower_high_byte]) {
-        cpu_ptr->registers.program_counter += 4;
-    } else {
-        cpu_ptr->registers.program_counter += 2;
+    if (frontend_ptr->audio_ptr != NULL) {
+        audio_frame(frontend_ptr->audio_ptr, cpu_ptr);
     }
-}
-
-void _Fx07(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.delay_timer;
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _Fx0A(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    printf("Not implemented.\n");
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _Fx15(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    cpu_ptr->registers.delay_timer = cpu_ptr->registers.V[lower_high_byte];
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _Fx18(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    cpu_ptr->registers.sound_timer = cpu_ptr->registers.V[lower_high_byte];
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _Fx1E(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    cpu_ptr->registers.I = cpu_ptr->registers.I + cpu_ptr->registers.V[lower_high_byte];
-    cpu_ptr->registers.program_counter += 2;
-}
-
-void _Fx29(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    cpu_ptr->registers.I = 5*(cpu_ptr->registers.V[lower_high_byte]) & 0xFFF;
-    cpu_ptr->registers.program_counter += 2;
-}
 
-void _Fx33(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    cpu_ptr->memory[cpu_ptr->registers.I] = lower_high_byte / 100;
-    cpu_ptr->memory[cpu_ptr->registers.I + 1] = (lower_high_byte % 100) / 10;
-    cpu_ptr->memory[cpu_ptr->registers.I + 2] = lower_high_byte % 10;
-    cpu_ptr->registers.program_counter += 2;
-}
+    if (frontend_ptr->rewinding) {
+        uint16_t keys = cpu_ptr->keys;
+        // Every frame pushes the state it ends with, so the first step back skips the one already shown
+        if (frontend_ptr->rewind_started) {
+            frontend_ptr->rewind_started = 0;
+            if (frontend_ptr->rewind_ptr->frames - frontend_ptr->rewind_ptr->oldest > 1) {
+                rewind_drop(frontend_ptr->rewind_ptr);
+            }
+        }
+        if (rewind_pop(frontend_ptr->rewind_ptr, cpu_ptr) == 0) {
+            cpu_ptr->keys = keys;
+            // Back on the recorded timeline the undone events are replaced, before its start the recording begins anew
+            if (frontend_ptr->rewind_ptr->frames >= frontend_ptr->log_frame) {
+                record_keys(frontend_ptr);
+            } else {
+                restart_log(frontend_ptr);
+            }
+        }
+        return;
+    }
+    run_for_cycles(cpu_ptr, cycles_until_tick(cpu_ptr));
+    rewind_push(frontend_ptr->rewind_ptr, cpu_ptr);
+}
+
+// Hands the framebuffer to the render thread when it changed or input arrived since the last frame it got,
+// the latter so every event's latency is measured even when the screen doesn't react
+static void publish_frame(frontend *frontend_ptr) {
+    chip8_cpu *cpu_ptr = frontend_ptr->cpu_ptr;
+
+    if (cpu_ptr->dirty_rows == 0 && frontend_ptr->input_sequence == frontend_ptr->published_sequence) {
+        return;
+    }
+    frame_slot *slot_ptr = triple_buffer_back(&frontend_ptr->frames_out);
+    memcpy(slot_ptr->display, cpu_ptr->display, sizeof(slot_ptr->display));
+    slot_ptr->frame = frontend_ptr->frames;
+    slot_ptr->input_sequence = frontend_ptr->input_sequence;
+    slot_ptr->input_time = frontend_ptr->input_time;
+    triple_buffer_publish(&frontend_ptr->frames_out);
+    cpu_ptr->dirty_rows = 0;
+    frontend_ptr->published_sequence = frontend_ptr->input_sequence;
+    // Wakes the render thread out of glfwWaitEvents()
+    glfwPostEmptyEvent();
+}
+
+static void *emulation_main(void *arg) {
+    frontend *frontend_ptr = arg;
+    chip8_cpu *cpu_ptr = frontend_ptr->cpu_ptr;
+    scheduler *scheduler_ptr = frontend_ptr->scheduler_ptr;
+    host_event event;
+
+#ifdef CHIP8_PROFILE
+    if (cpu_ptr->profile_ptr != NULL) {
+        profile_sample_thread(cpu_ptr->profile_ptr, PROFILE_ENTERED);
+    }
+#endif
+    while (!atomic_load(&frontend_ptr->stop)) {
+        PROFILE_ENTER(cpu_ptr, PROFILE_INPUT);
+        while (input_queue_pop(&frontend_ptr->input, &event) == 0) {
+            apply_host_event(frontend_ptr, &event);
+        }
 
-void _Fx55(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    for (int i = 0; i < 16; i++) {
-        cpu_ptr->memory[cpu_ptr->registers.I + i] = cpu_ptr->registers.V[i];
-    }
-    cpu_ptr->registers.program_counter += 2;
-}
+        // Run every emulated frame that is due, each one ends on a timer tick
+        PROFILE_ENTER(cpu_ptr, PROFILE_DISPATCH);
+        int frames = scheduler_due_frames(scheduler_ptr);
+        if (scheduler_ptr->realtime) {
+            for (int i = 0; i < frames; i++) {
+                run_frame(frontend_ptr);
+                frontend_ptr->frames++;
+            }
+        } else {
+            do {
+                run_frame(frontend_ptr);
+                frontend_ptr->frames++;
+            } while (now_seconds() < scheduler_ptr->next_frame);
+        }
 
-void _Fx65(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
-    for (int i = 0; i < 16; i++) {
-        cpu_ptr->registers.V[i] = cpu_ptr->memory[cpu_ptr->registers.I + i];
+        PROFILE_ENTER(cpu_ptr, PROFILE_HANDOFF);
+        publish_frame(frontend_ptr);
+        PROFILE_ENTER(cpu_ptr, PROFILE_IDLE);
+
+        if (!frontend_ptr->rewinding && waiting_for_key(cpu_ptr) && cpu_ptr->registers.delay_timer == 0 &&
+            cpu_ptr->registers.sound_timer == 0) {
+            // Blocked in Fx0A with nothing left to count down: sleep until an event arrives,
+            // then restart the emulated clock so the idle time isn't caught up
+            input_queue_wait(&frontend_ptr->input);
+            scheduler_set_realtime(scheduler_ptr, scheduler_ptr->realtime);
+        } else {
+            // Sleep until the next frame is due, events that arrive meanwhile wait in the queue
+            scheduler_wait(scheduler_ptr);
+        }
+        PROFILE_ENTER(cpu_ptr, PROFILE_INPUT);
+#ifdef CHIP8_PROFILE
+        if (cpu_ptr->profile_ptr != NULL && profile_report_requested()) {
+            profile_write(cpu_ptr->profile_ptr, cpu_ptr, frontend_ptr->profile_path);
+        }
+#endif
     }
-    cpu_ptr->registers.program_counter += 2;
+    return NULL;
 }
 
-void update_keypad_state(chip8_cpu *cpu_ptr, GLFWwindow *window_ptr) {
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_1) == GLFW_PRESS) {
-        cpu_ptr->key_input[0x0] = 1;
-    } else {
-        cpu_ptr->key_input[0x0] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_2) == GLFW_PRESS) {
-        cpu_ptr->key_input[0x1] = 1;
-    } else {
-        cpu_ptr->key_input[0x1] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_3) == GLFW_PRESS) {
-        cpu_ptr->key_input[0x2] = 1;
-    } else {
-        cpu_ptr->key_input[0x2] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_4) == GLFW_PRESS) {
-        cpu_ptr->key_input[0x3] = 1;
-    } else {
-        cpu_ptr->key_input[0x3] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_Q) == GLFW_PRESS) {
-        cpu_ptr->key_input[0x4] = 1;
-    } else {
-        cpu_ptr->key_input[0x4] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_W) == GLFW_PRESS) {
-        cpu_ptr->key_input[0x5] = 1;
-    } else {
-        cpu_ptr->key_input[0x5] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_E) == GLFW_PRESS) {
-        cpu_ptr->key_input[0x6] = 1;
-    } else {
-        cpu_ptr->key_input[0x6] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_R) == GLFW_PRESS) {
-        cpu_ptr->key_input[0x7] = 1;
-    } else {
-        cpu_ptr->key_input[0x7] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_A) == GLFW_PRESS) {
-        cpu_ptr->key_input[0x8] = 1;
-    } else {
-        cpu_ptr->key_input[0x8] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_S) == GLFW_PRESS) {
-        cpu_ptr->key_input[0x9] = 1;
-    } else {
-        cpu_ptr->key_input[0x9] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_D) == GLFW_PRESS) {
-        cpu_ptr->key_input[0xA] = 1;
-    } else {
-        cpu_ptr->key_input[0xA] = 0;
-    }
+// Runs on the main thread, events go to the emulation thread as they are
+static void key_callback(GLFWwindow *window_ptr, int key, int scancode, int action, int mods) {
+    frontend *frontend_ptr = glfwGetWindowUserPointer(window_ptr);
 
-    if (glfwGetKey(window_ptr, GLFW_KEY_F) == GLFW_PRESS) {
-        cpu_ptr->key_input[0xB] = 1;
-    } else {
-        cpu_ptr->key_input[0xB] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_Z) == GLFW_PRESS) {
-        cpu_ptr->key_input[0xC] = 1;
-    } else {
-        cpu_ptr->key_input[0xC] = 0;
-    }
-
-    if (glfwGetKey(window_ptr, GLFW_KEY_X) == GLFW_PRESS) {
-        cpu_ptr->key_input[0xD] = 1;
-    } else {
-        cpu_ptr->key_input[0xD] = 0;
+    if (key < 0 || key > GLFW_KEY_LAST || action == GLFW_REPEAT) {
+        return;
     }
+    input_queue_push(&frontend_ptr->input, key, action);
+}
 
-    if (glfwGetKey(window_ptr, GLFW_KEY_C) == GLFW_PRESS) {
-        cpu_ptr->key_input[0xE] = 1;
-    } else {
-        cpu_ptr->key_input[0xE] = 0;
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s rom [clock_hz] [keymap] [chip8|schip|xochip]\n", argv[0]);
+        return -1;
     }
 
-    if (glfwGetKey(window_ptr, GLFW_KEY_V) == GLFW_PRESS) {
-        cpu_ptr->key_input[0xF] = 1;
-    } else {
-        cpu_ptr->key_input[0xF] = 0;
+    // Initialize GLFW lib
+    if (!glfwInit()) {
+        printf("Failed to initialize GLFW.\n");
+        return -1;
     }
 
-}
+    // Create window and it's OpenGL context, scaled up from the 64 x 32 display
+    GLFWwindow *win = glfwCreateWindow(64 * PRESENTER_SCALE, 32 * PRESENTER_SCALE, "Chip8 Emulator", NULL, NULL);
 
-chip8_cpu init(void) {
-    chip8_cpu CPU;
-    int i, j;
-
-    for (i = 0; i < 64; i++) {
-        for (j = 0; j < 32; j++) {
-            CPU.display_buffer[(i * 32 + j) * 3 + 0] = 0; // R
-            CPU.display_buffer[(i * 32 + j) * 3 + 1] = 0; // G
-            CPU.display_buffer[(i * 32 + j) * 3 + 2] = 0; // B
-        }
+    if (!win) {
+        glfwTerminate();
+        printf("Failed to create a window.\n");
+        return -1;
     }
 
-    for (i = 0; i < 4096; i++) {
-        CPU.memory[i] = 0x0;
-    }
+    glfwMakeContextCurrent(win);
+    // Only the render thread waits for vsync, the emulation thread paces itself
+    glfwSwapInterval(1);
 
-    for (i = 0; i < 16; i++) {
-        CPU.key_input[i] = 0x0;
-        CPU.registers.V[i] = 0x0;
-        CPU.registers.stack[i] = 0x0;
+    presenter display;
+    if (presenter_init(&display, win) != 0) {
+        glfwDestroyWindow(win);
+        glfwTerminate();
+        return -1;
     }
 
-    CPU.registers.delay_timer = 0x0;
-    CPU.registers.sound_timer = 0x0;
-    CPU.registers.I = 0x0;
-    CPU.registers.stack_ptr = 0x0;
-    CPU.registers.program_counter = 0x200;
-
-    return CPU;
-}
-
-int load_rom(chip8_cpu *cpu_ptr, const char *path) {
-    // Creates file pointer
-    FILE *file_ptr = fopen(path, "r");
-    int file_size, read_bytes;
-
-    // Ensures the stream pointer is not null
-    if (file_ptr == NULL) {
-        printf("Falha ao abrir o arquivo, seu viado!");
+    chip8_cpu CPU = init();
+    char *path = argv[1];
+    if (load_rom(&CPU, path) != 0) {
+        presenter_free(&display);
+        glfwDestroyWindow(win);
+        glfwTerminate();
         return -1;
     }
-
-    // Moves file pointer to the file end to get file size
-    if (fseek(file_ptr, 0, SEEK_END) == 0) {
-        file_size = ftell(file_ptr);
-        if (file_size == -1)
-        {
-            fclose(file_ptr);
+    if (argc > 2) {
+        set_clock_hz(&CPU, (uint32_t)strtoul(argv[2], NULL, 0));
+    }
+    if (argc > 4) {
+        quirk_profile quirks;
+        if (quirks_parse(argv[4], &quirks) != 0) {
+            printf("Unknown quirk profile %s.\n", argv[4]);
+            presenter_free(&display);
+            glfwDestroyWindow(win);
+            glfwTerminate();
             return -1;
         }
-    }
-
-    // Moves file pointer back to the file start
-    if (fseek(file_ptr, 0, SEEK_SET) != 0) {
-        fclose(file_ptr);
+        set_quirks(&CPU, quirks);
+    }
+
+#ifdef CHIP8_TRACE
+    // Traced builds keep the newest instructions in memory, or stream all of them to CHIP8_TRACE_FILE
+    CPU.trace_ptr = trace_create(getenv("CHIP8_TRACE_FILE"));
+#endif
+#ifdef CHIP8_PROFILE
+    // Profiled builds write <rom>.profile on exit and whenever SIGUSR1 arrives
+    char profile_path[4096];
+    snprintf(profile_path, sizeof(profile_path), "%s.profile", path);
+    profile *prof = CPU.profile_ptr = profile_create();
+    // This thread renders, all of its samples are presenting. The emulation thread samples itself once it starts.
+    if (prof != NULL && profile_sample_thread(prof, PROFILE_PRESENT) != 0) {
+        profile_destroy(prof);
+        prof = CPU.profile_ptr = NULL;
+    }
+#endif
+
+    scheduler sched;
+    scheduler_init(&sched, 1);
+
+    rewind_buffer rewind;
+    char state_path[4096];
+    snprintf(state_path, sizeof(state_path), "%s.state", path);
+    if (rewind_init(&rewind, REWIND_SECONDS * SCHEDULER_FRAME_HZ) != 0) {
+        printf("Failed to allocate the rewind buffer.\n");
+        presenter_free(&display);
+        glfwDestroyWindow(win);
+        glfwTerminate();
         return -1;
     }
 
-    // Reads the ROM into memory with the appropriate offset (0x200, see Cowgod's Chip 8 technical reference)
-    read_bytes = fread(cpu_ptr->memory + 0x200, sizeof(uint8_t), file_size, file_ptr);
-    // Some classic print debugging to check how many bytes were read into the CPU memory
-    printf("A total of %d bytes were read.\n", read_bytes);
-
-    fclose(file_ptr);
-
-    return 0;
-}
-
-int main(int argc, char **argv) {
-
-    // Initialize GLFW lib
-    if (!glfwInit()) {
-        printf("Failed to initialize GLFW.\n");
+    // Sessions recorded to CHIP8_INPUT_LOG replay with headless -r
+    static input_log log;
+    const char *log_path = getenv("CHIP8_INPUT_LOG");
+    // CHIP8_AUDIO picks the sink: "device" (the default), "null" or a WAV file to write
+    audio_sink_kind sink;
+    const char *audio_path;
+    audio_parse(getenv("CHIP8_AUDIO") != NULL ? getenv("CHIP8_AUDIO") : "device", &sink, &audio_path);
+    audio_output *audio_ptr = audio_create(sink, audio_path);
+    if (audio_ptr == NULL && sink != AUDIO_SINK_NULL) {
+        printf("Continuing without sound.\n");
+        audio_ptr = audio_create(AUDIO_SINK_NULL, NULL);
+    }
+
+    static frontend front;
+    front.cpu_ptr = &CPU;
+    front.scheduler_ptr = &sched;
+    front.rewind_ptr = &rewind;
+    front.audio_ptr = audio_ptr;
+    front.state_path = state_path;
+    front.log_ptr = log_path != NULL ? &log : NULL;
+#ifdef CHIP8_PROFILE
+    front.profile_path = profile_path;
+#endif
+    restart_log(&front);
+    triple_buffer_init(&front.frames_out);
+    if (load_keymap(&front, argc > 3 ? argv[3] : DEFAULT_KEYMAP) != 0 || input_queue_init(&front.input) != 0) {
+        audio_destroy(audio_ptr);
+        rewind_free(&rewind);
+        presenter_free(&display);
+        glfwDestroyWindow(win);
+        glfwTerminate();
         return -1;
     }
-
-    // Create window and it's OpenGL context
-    GLFWwindow *win = glfwCreateWindow(64, 32, "Chip8 Emulator", NULL, NULL);
-
-    if (!win) {
+    glfwSetWindowUserPointer(win, &front);
+    glfwSetKeyCallback(win, key_callback);
+
+    pthread_t emulation_thread;
+    if (pthread_create(&emulation_thread, NULL, emulation_main, &front) != 0) {
+        printf("Failed to start the emulation thread.\n");
+        input_queue_free(&front.input);
+        audio_destroy(audio_ptr);
+        rewind_free(&rewind);
+        presenter_free(&display);
+        glfwDestroyWindow(win);
         glfwTerminate();
-        printf("Failed to create a window.\n");
         return -1;
     }
 
-    glfwSetInputMode(win, GLFW_STICKY_KEYS, GLFW_TRUE);
-    glfwMakeContextCurrent(win);
-
-    chip8_cpu CPU = init();
-    char *path = "Cave.ch8";
-    load_rom(&CPU, path);
-    uint16_t opcode, left_two_nibbles, right_two_nibbles, lowest_12_bits;
-    uint8_t upper_byte_low_nibble, low_byte_upper_nibble, low_byte;
-
-    // Main emulator loop
+    // Render loop: sleeps until a window event or a published frame wakes it, then presents the newest frame.
+    // A stall in here never holds up the emulation thread, it only makes frames get skipped.
+    static const uint64_t blank[32];
+    const uint64_t *shown = blank;
+    latency_stats latency = { 0 };
     while (!glfwWindowShouldClose(win)) {
-        // 8-bit shift to the left on the 8-byte sized region of memory pointed at by the pc to put it in the format 0xXX00
-        left_two_nibbles = CPU.memory[CPU.registers.program_counter] << 8;
-        // Move the index by 1 (8 bytes) to get the second 8-byte sized part of the instruction as 0xXX
-        right_two_nibbles = CPU.memory[CPU.registers.program_counter + 1];
-        // Perform bitwise OR on both to get the full 16 bytes instruction
-        opcode = left_two_nibbles | right_two_nibbles;
-        // Get the lower 4 bits (nibble/hex digit) of the high byte through a bitwise AND and a bitwise right shift by 1 byte
-        upper_byte_low_nibble = (opcode & 0x0F00) >> 8;
-        // Get the upper 4 bits (nibble/hex digit) of the low byte through a bitwise AND and a bitwise right shift by half a byte
-        low_byte_upper_nibble = (opcode & 0x00F0) >> 4;
-        // Get the low byte and the lowest 12 bits through bitwise AND
-        lowest_12_bits = opcode & 0x0FFF;
-        low_byte = opcode & 0x00FF;
-        printf("Program counter address: %#x\n", CPU.registers.program_counter);
-        printf("Opcode: %#x\n", opcode);
-        // Process opcode
-        switch (opcode & 0xF000) {
-            case 0x0000:
-                switch (opcode & 0x000F) {
-                    case 0x0000:
-                        _00E0(&CPU);
-                        break;
-                    case 0x000E:
-                        _00EE(&CPU);
-                        break;
-                }
-                break;
-            case 0x1000:
-                _1nnn(&CPU, lowest_12_bits);
-                break;
-            case 0x2000:
-                _2nnn(&CPU, lowest_12_bits);
-                break;
-            case 0x3000:
-                _3xkk(&CPU, upper_byte_low_nibble, low_byte);
-                break;
-            case 0x4000:
-                _4xkk(&CPU, upper_byte_low_nibble, low_byte);
-                break;
-            case 0x5000:
-                _5xy0(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                break;
-            case 0x6000:
-                _6xkk(&CPU, upper_byte_low_nibble, low_byte);
-                break;
-            case 0x7000:
-                _7xkk(&CPU, upper_byte_low_nibble, low_byte);
-                break;
-            case 0x8000:
-                switch (opcode & 0x000F) {
-                    case 0x0000:
-                        _8xy0(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                        break;
-                    case 0x0001:
-                        _8xy1(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                        break;
-                    case 0x0002:
-                        _8xy2(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                        break;
-                    case 0x0003:
-                        _8xy3(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                        break;
-                    case 0x0004:
-                        _8xy4(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                        break;
-                    case 0x0005:
-                        _8xy5(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                        break;
-                    case 0x0006:
-                        _8xy6(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                        break;
-                    case 0x0007:
-                        _8xy7(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                        break;
-                    case 0x000E:
-                        _8xyE(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                        break;
-                }
-                break;
-            case 0x9000:
-                _9xy0(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                break;
-            case 0xA000:
-                _Annn(&CPU, lowest_12_bits);
-                break;
-            case 0xB000:
-                _Bnnn(&CPU, lowest_12_bits);
-                break;
-            case 0xC000:
-                _Cxkk(&CPU, upper_byte_low_nibble, low_byte);
-                break;
-            case 0xD000:
-                _Dxyn(&CPU, upper_byte_low_nibble, low_byte_upper_nibble);
-                break;
-            case 0xE000:
-                switch (opcode & 0x00FF) {
-                    case 0x009E:
-                        _Ex9E(&CPU, upper_byte_low_nibble);
-                        break;
-                    case 0x00A1:
-                        _ExA1(&CPU, upper_byte_low_nibble);
-                        break;
-                }
-                break;
-            case 0xF000:
-                switch (opcode & 0x00FF) {
-                    case 0x0007:
-                        _Fx07(&CPU, upper_byte_low_nibble);
-                        break;
-                    case 0x000A:
-                        _Fx0A(&CPU, upper_byte_low_nibble);
-                        break;
-                    case 0x0015:
-                        _Fx15(&CPU, upper_byte_low_nibble);
-                        break;
-                    case 0x0018:
-                        _Fx18(&CPU, upper_byte_low_nibble);
-                        break;
-                    case 0x001E:
-                        _Fx1E(&CPU, upper_byte_low_nibble);
-                        break;
-                    case 0x0029:
-                        _Fx29(&CPU, upper_byte_low_nibble);
-                        break;
-                    case 0x0033:
-                        _Fx33(&CPU, upper_byte_low_nibble);
-                        break;
-                    case 0x0055:
-                        _Fx55(&CPU, upper_byte_low_nibble);
-                        break;
-                    case 0x0065:
-                        _Fx65(&CPU, upper_byte_low_nibble);
-                        break;
-                }
-                break;
-            default:
-                break;
-        }
-
-        // Update the keypad state
-        update_keypad_state(&CPU, win);
-
-        // Clear the color buffer and swap the front and back buffers        
-        glClear(GL_COLOR_BUFFER_BIT);
-        glfwSwapBuffers(win);
+        glfwWaitEvents();
 
+        const frame_slot *slot_ptr = triple_buffer_take(&front.frames_out);
+        if (slot_ptr != NULL) {
+            shown = slot_ptr->display;
+        }
+        // Also redraws the last frame after a resize
+        presenter_frame(&display, shown);
+
+        if (slot_ptr != NULL && slot_ptr->input_sequence > latency.sequence) {
+            double elapsed = now_seconds() - slot_ptr->input_time;
+            latency.sequence = slot_ptr->input_sequence;
+            latency.count++;
+            latency.total += elapsed;
+            if (elapsed > latency.max) {
+                latency.max = elapsed;
+            }
+        }
     }
 
+    atomic_store(&front.stop, 1);
+    input_queue_wake(&front.input);
+    pthread_join(emulation_thread, NULL);
+
+    if (front.log_ptr != NULL) {
+        input_log_write(&log, CPU.cycle_count, log_path);
+        input_log_free(&log);
+    }
+    if (audio_ptr != NULL) {
+        audio_stop(audio_ptr);
+        audio_report(audio_ptr);
+        audio_destroy(audio_ptr);
+    }
+    scheduler_report(&sched);
+    printf("Rewind buffer: %llu frames in %zu bytes\n", (unsigned long long)(rewind.frames - rewind.oldest), rewind.bytes);
+    const presenter_stats *stats = &display.stats;
+    printf("Frames: %llu emulated, %llu taken by the renderer, presented %llu, skipped %llu\n",
+           (unsigned long long)front.frames, (unsigned long long)stats->frames,
+           (unsigned long long)stats->presents, (unsigned long long)stats->skipped_frames);
+    printf("Rows uploaded: %llu\n", (unsigned long long)stats->uploaded_rows);
+    printf("Present time: %.3f ms average, %.3f ms max\n",
+           stats->presents ? stats->present_seconds * 1e3 / stats->presents : 0.0, stats->max_present_seconds * 1e3);
+    printf("Input to photon: %llu events, %.3f ms average, %.3f ms max, %llu dropped\n", (unsigned long long)latency.count,
+           latency.count ? latency.total * 1e3 / latency.count : 0.0, latency.max * 1e3,
+           (unsigned long long)front.input.dropped);
+
+#ifdef CHIP8_TRACE
+    trace_destroy(CPU.trace_ptr);
+#endif
+#ifdef CHIP8_PROFILE
+    if (CPU.profile_ptr != NULL) {
+        profile_write(prof, &CPU, profile_path);
+        profile_destroy(prof);
+    }
+#endif
+    input_queue_free(&front.input);
+    rewind_free(&rewind);
+    presenter_free(&display);
     glfwDestroyWindow(win);
     glfwTerminate();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,486 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "chip8.h"
+#include "quirks.h"
+
+// Opcode handlers shared by every execution engine. They live in a header as static inline
+// functions so each dispatch loop gets its own inlined copy instead of paying for a call per instruction.
+// Straight-line opcodes are split into a _body() doing the work and a handler that also advances the
+// program counter, so engines running whole basic blocks can do that bookkeeping once per block.
+// Handlers whose behaviour depends on the quirk profile take a QUIRK_* set, which callers must pass as a
+// constant so the checks fold away when the handler is inlined.
+
+static inline void _00E0_body(chip8_cpu *cpu_ptr) {
+    memset(cpu_ptr->display, 0, sizeof(cpu_ptr->display));
+    cpu_ptr->dirty_rows = 0xFFFFFFFF;
+}
+
+static inline void _00E0(chip8_cpu *cpu_ptr) {
+    _00E0_body(cpu_ptr);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+// The 16-entry stack wraps around instead of under- or overflowing, the same way the SIMD lanes handle it
+static inline void _00EE(chip8_cpu *cpu_ptr) {
+    cpu_ptr->registers.stack_ptr = (cpu_ptr->registers.stack_ptr - 1) & 0xF;
+    cpu_ptr->registers.program_counter = cpu_ptr->registers.stack[cpu_ptr->registers.stack_ptr];
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _1nnn(chip8_cpu *cpu_ptr, uint16_t lowest_12_bits) {
+    cpu_ptr->registers.program_counter = lowest_12_bits;
+}
+
+static inline void _2nnn(chip8_cpu *cpu_ptr, uint16_t lowest_12_bits) {
+    uint16_t sp = cpu_ptr->registers.stack_ptr & 0xF;
+    cpu_ptr->registers.stack[sp] = cpu_ptr->registers.program_counter;
+    cpu_ptr->registers.stack_ptr = sp + 1;
+    cpu_ptr->registers.program_counter = lowest_12_bits;
+}
+
+static inline void _3xkk(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte) {
+    if (cpu_ptr->registers.V[lower_high_byte] == low_byte) {
+        cpu_ptr->registers.program_counter += 4;
+    } else {
+        cpu_ptr->registers.program_counter += 2;
+    }
+}
+
+static inline void _4xkk(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte) {
+    if (cpu_ptr->registers.V[lower_high_byte] != low_byte) {
+        cpu_ptr->registers.program_counter += 4;
+    } else {
+        cpu_ptr->registers.program_counter += 2;
+    }
+}
+
+static inline void _5xy0(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_lower_byte) {
+    if (cpu_ptr->registers.V[lower_high_byte] == cpu_ptr->registers.V[upper_lower_byte]) {
+        cpu_ptr->registers.program_counter += 4;
+    } else {
+        cpu_ptr->registers.program_counter += 2;
+    }
+}
+
+static inline void _6xkk_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte)
+{
+    cpu_ptr->registers.V[lower_high_byte] = low_byte;
+}
+
+static inline void _6xkk(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte)
+{
+    _6xkk_body(cpu_ptr, lower_high_byte, low_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _7xkk_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte)
+{
+    cpu_ptr->registers.V[lower_high_byte] += low_byte;
+}
+
+static inline void _7xkk(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte)
+{
+    _7xkk_body(cpu_ptr, lower_high_byte, low_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _8xy0_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
+    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.V[upper_low_byte];
+}
+
+static inline void _8xy0(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
+    _8xy0_body(cpu_ptr, lower_high_byte, upper_low_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _8xy1_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, unsigned quirks) {
+    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.V[lower_high_byte] | cpu_ptr->registers.V[upper_low_byte];
+    // The VIP computed logic ops in a routine that left VF clobbered
+    if (quirks & QUIRK_VF_RESET) {
+        cpu_ptr->registers.V[0xF] = 0;
+    }
+}
+
+static inline void _8xy1(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, unsigned quirks) {
+    _8xy1_body(cpu_ptr, lower_high_byte, upper_low_byte, quirks);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _8xy2_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, unsigned quirks) {
+    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.V[lower_high_byte] & cpu_ptr->registers.V[upper_low_byte];
+    if (quirks & QUIRK_VF_RESET) {
+        cpu_ptr->registers.V[0xF] = 0;
+    }
+}
+
+static inline void _8xy2(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, unsigned quirks) {
+    _8xy2_body(cpu_ptr, lower_high_byte, upper_low_byte, quirks);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _8xy3_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, unsigned quirks) {
+    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.V[lower_high_byte] ^ cpu_ptr->registers.V[upper_low_byte];
+    if (quirks & QUIRK_VF_RESET) {
+        cpu_ptr->registers.V[0xF] = 0;
+    }
+}
+
+static inline void _8xy3(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, unsigned quirks) {
+    _8xy3_body(cpu_ptr, lower_high_byte, upper_low_byte, quirks);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _8xy4_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
+    uint16_t sum = cpu_ptr->registers.V[lower_high_byte] + cpu_ptr->registers.V[upper_low_byte];
+    cpu_ptr->registers.V[lower_high_byte] = sum & 0xFF;
+    // VF is written last so the flag wins when x is F
+    cpu_ptr->registers.V[0xF] = sum > 0xFF;
+}
+
+static inline void _8xy4(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
+    _8xy4_body(cpu_ptr, lower_high_byte, upper_low_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _8xy5_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
+    // VF is set when there is no borrow
+    uint8_t not_borrow = cpu_ptr->registers.V[lower_high_byte] >= cpu_ptr->registers.V[upper_low_byte];
+    cpu_ptr->registers.V[lower_high_byte] = (cpu_ptr->registers.V[lower_high_byte] - cpu_ptr->registers.V[upper_low_byte]) & 0xFF;
+    cpu_ptr->registers.V[0xF] = not_borrow;
+}
+
+static inline void _8xy5(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
+    _8xy5_body(cpu_ptr, lower_high_byte, upper_low_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _8xy6_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, unsigned quirks) {
+    uint8_t value = cpu_ptr->registers.V[quirks & QUIRK_SHIFT_VY ? upper_low_byte : lower_high_byte];
+    cpu_ptr->registers.V[lower_high_byte] = value >> 1;
+    cpu_ptr->registers.V[0xF] = value & 0b1;
+}
+
+static inline void _8xy6(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, unsigned quirks) {
+    _8xy6_body(cpu_ptr, lower_high_byte, upper_low_byte, quirks);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _8xy7_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
+    uint8_t not_borrow = cpu_ptr->registers.V[upper_low_byte] >= cpu_ptr->registers.V[lower_high_byte];
+    cpu_ptr->registers.V[lower_high_byte] = (cpu_ptr->registers.V[upper_low_byte] - cpu_ptr->registers.V[lower_high_byte]) & 0xFF;
+    cpu_ptr->registers.V[0xF] = not_borrow;
+}
+
+static inline void _8xy7(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte) {
+    _8xy7_body(cpu_ptr, lower_high_byte, upper_low_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _8xyE_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, unsigned quirks) {
+    uint8_t value = cpu_ptr->registers.V[quirks & QUIRK_SHIFT_VY ? upper_low_byte : lower_high_byte];
+    cpu_ptr->registers.V[lower_high_byte] = (value << 1) & 0xFF;
+    cpu_ptr->registers.V[0xF] = value >> 7;
+}
+
+static inline void _8xyE(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, unsigned quirks) {
+    _8xyE_body(cpu_ptr, lower_high_byte, upper_low_byte, quirks);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _9xy0(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_lower_byte)
+{
+    if (cpu_ptr->registers.V[lower_high_byte] != cpu_ptr->registers.V[upper_lower_byte])
+    {
+        cpu_ptr->registers.program_counter += 4;
+    } else {
+        cpu_ptr->registers.program_counter += 2;
+    }
+}
+
+static inline void _Annn_body(chip8_cpu *cpu_ptr, uint16_t lowest_12_bits)
+{
+    cpu_ptr->registers.I = lowest_12_bits;
+}
+
+static inline void _Annn(chip8_cpu *cpu_ptr, uint16_t lowest_12_bits)
+{
+    _Annn_body(cpu_ptr, lowest_12_bits);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _Bnnn(chip8_cpu *cpu_ptr, uint16_t lowest_12_bits, unsigned quirks)
+{
+    // SUPER-CHIP takes the offset register from the top nibble of the address, Bxnn
+    uint8_t offset = cpu_ptr->registers.V[quirks & QUIRK_JUMP_VX ? lowest_12_bits >> 8 : 0x0];
+    cpu_ptr->registers.program_counter = lowest_12_bits + offset;
+}
+
+static inline void _Cxkk_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte) {
+    // xorshift32 on the instance's own state, the same seed always draws the same numbers
+    uint32_t state = cpu_ptr->registers.rng;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    cpu_ptr->registers.rng = state;
+    cpu_ptr->registers.V[lower_high_byte] = (state & 0xFF) & low_byte;
+}
+
+static inline void _Cxkk(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t low_byte) {
+    _Cxkk_body(cpu_ptr, lower_high_byte, low_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+// A sprite byte placed in a row word at the given column, the part past the right edge is cut off or wraps around
+static inline uint64_t sprite_row(uint8_t byte, uint8_t column, unsigned quirks) {
+    uint64_t bits = (uint64_t)byte << 56;
+    if (quirks & QUIRK_WRAP_SPRITES) {
+        return (bits >> column) | (bits << ((64 - column) & 63));
+    }
+    return bits >> column;
+}
+
+static inline void _Dxyn_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, uint8_t lowest_nibble,
+                              unsigned quirks) {
+    // The start position wraps around the screen, the sprite itself is clipped at the right and bottom edges
+    // unless the profile wraps it too
+    uint8_t column = cpu_ptr->registers.V[lower_high_byte] & 63;
+    uint8_t row = cpu_ptr->registers.V[upper_low_byte] & 31;
+    uint8_t rows = (quirks & QUIRK_WRAP_SPRITES) || row + lowest_nibble <= 32 ? lowest_nibble : 32 - row;
+    uint64_t collision = 0;
+
+    for (uint8_t i = 0; i < rows; i++) {
+        // Each sprite byte becomes a whole row word, so drawing it is one XOR
+        uint8_t y = (row + i) & 31;
+        uint64_t sprite = sprite_row(cpu_ptr->memory[(cpu_ptr->registers.I + i) & 0xFFF], column, quirks);
+        collision |= cpu_ptr->display[y] & sprite;
+        cpu_ptr->display[y] ^= sprite;
+        cpu_ptr->dirty_rows |= (uint32_t)(sprite != 0) << y;
+    }
+    cpu_ptr->registers.V[0xF] = collision != 0;
+}
+
+static inline void _Dxyn(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, uint8_t upper_low_byte, uint8_t lowest_nibble, unsigned quirks) {
+    _Dxyn_body(cpu_ptr, lower_high_byte, upper_low_byte, lowest_nibble, quirks);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _Ex9E(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    if ((cpu_ptr->keys >> (cpu_ptr->registers.V[lower_high_byte] & 0xF)) & 1) {
+        cpu_ptr->registers.program_counter += 4;
+    } else {
+        cpu_ptr->registers.program_counter += 2;
+    }
+}
+
+static inline void _ExA1(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    if (!((cpu_ptr->keys >> (cpu_ptr->registers.V[lower_high_byte] & 0xF)) & 1)) {
+        cpu_ptr->registers.program_counter += 4;
+    } else {
+        cpu_ptr->registers.program_counter += 2;
+    }
+}
+
+static inline void _Fx07_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    cpu_ptr->registers.V[lower_high_byte] = cpu_ptr->registers.delay_timer;
+}
+
+static inline void _Fx07(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    _Fx07_body(cpu_ptr, lower_high_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _Fx0A(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    // Waits for a key to be pressed and released, like the COSMAC VIP. The program counter stays here
+    // until then, so every engine just executes the instruction again.
+    uint16_t released = cpu_ptr->key_wait_pressed & ~cpu_ptr->keys;
+
+    if (cpu_ptr->key_wait && released) {
+        cpu_ptr->registers.V[lower_high_byte] = __builtin_ctz(released);
+        cpu_ptr->key_wait = 0;
+        cpu_ptr->key_wait_pressed = 0;
+        cpu_ptr->registers.program_counter += 2;
+        return;
+    }
+    cpu_ptr->key_wait = 1;
+    cpu_ptr->key_wait_pressed |= cpu_ptr->keys;
+}
+
+static inline void _Fx15_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    cpu_ptr->registers.delay_timer = cpu_ptr->registers.V[lower_high_byte];
+}
+
+static inline void _Fx15(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    _Fx15_body(cpu_ptr, lower_high_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _Fx18_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    cpu_ptr->registers.sound_timer = cpu_ptr->registers.V[lower_high_byte];
+}
+
+static inline void _Fx18(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    _Fx18_body(cpu_ptr, lower_high_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _Fx1E_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    cpu_ptr->registers.I = cpu_ptr->registers.I + cpu_ptr->registers.V[lower_high_byte];
+}
+
+static inline void _Fx1E(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    _Fx1E_body(cpu_ptr, lower_high_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _Fx29_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    // Only the low nibble selects a digit of the font
+    cpu_ptr->registers.I = 5 * (cpu_ptr->registers.V[lower_high_byte] & 0xF);
+}
+
+static inline void _Fx29(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    _Fx29_body(cpu_ptr, lower_high_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+// Marks the pages a store to [address, address + length) touches, a store spans at most two of them
+static inline void mark_dirty_pages(chip8_cpu *cpu_ptr, uint16_t address, uint16_t length) {
+    cpu_ptr->dirty_pages |= 1u << ((address >> 8) & 15);
+    cpu_ptr->dirty_pages |= 1u << (((address + length - 1) >> 8) & 15);
+}
+
+static inline void _Fx33_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    uint8_t value = cpu_ptr->registers.V[lower_high_byte];
+    mark_dirty_pages(cpu_ptr, cpu_ptr->registers.I, 3);
+    // I may point anywhere after Fx1E, accesses wrap around the 4 KB address space like the fetches do
+    cpu_ptr->memory[cpu_ptr->registers.I & 0xFFF] = value / 100;
+    cpu_ptr->memory[(cpu_ptr->registers.I + 1) & 0xFFF] = (value % 100) / 10;
+    cpu_ptr->memory[(cpu_ptr->registers.I + 2) & 0xFFF] = value % 10;
+}
+
+static inline void _Fx33(chip8_cpu *cpu_ptr, uint8_t lower_high_byte) {
+    _Fx33_body(cpu_ptr, lower_high_byte);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+// Fx55 and Fx65 copy V0 through Vx
+static inline void _Fx55_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, unsigned quirks) {
+    mark_dirty_pages(cpu_ptr, cpu_ptr->registers.I, lower_high_byte + 1);
+    for (int i = 0; i <= lower_high_byte; i++) {
+        cpu_ptr->memory[(cpu_ptr->registers.I + i) & 0xFFF] = cpu_ptr->registers.V[i];
+    }
+    if (quirks & QUIRK_INCREMENT_I) {
+        cpu_ptr->registers.I += lower_high_byte + 1;
+    }
+}
+
+static inline void _Fx55(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, unsigned quirks) {
+    _Fx55_body(cpu_ptr, lower_high_byte, quirks);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+static inline void _Fx65_body(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, unsigned quirks) {
+    for (int i = 0; i <= lower_high_byte; i++) {
+        cpu_ptr->registers.V[i] = cpu_ptr->memory[(cpu_ptr->registers.I + i) & 0xFFF];
+    }
+    if (quirks & QUIRK_INCREMENT_I) {
+        cpu_ptr->registers.I += lower_high_byte + 1;
+    }
+}
+
+static inline void _Fx65(chip8_cpu *cpu_ptr, uint8_t lower_high_byte, unsigned quirks) {
+    _Fx65_body(cpu_ptr, lower_high_byte, quirks);
+    cpu_ptr->registers.program_counter += 2;
+}
+
+// Identifies which handler an opcode maps to, OP_INVALID covers opcodes the interpreter ignores
+typedef enum {
+    OP_INVALID,
+    OP_00E0, OP_00EE, OP_1nnn, OP_2nnn, OP_3xkk, OP_4xkk, OP_5xy0, OP_6xkk, OP_7xkk,
+    OP_8xy0, OP_8xy1, OP_8xy2, OP_8xy3, OP_8xy4, OP_8xy5, OP_8xy6, OP_8xy7, OP_8xyE,
+    OP_9xy0, OP_Annn, OP_Bnnn, OP_Cxkk, OP_Dxyn, OP_Ex9E, OP_ExA1,
+    OP_Fx07, OP_Fx0A, OP_Fx15, OP_Fx18, OP_Fx1E, OP_Fx29, OP_Fx33, OP_Fx55, OP_Fx65,
+    OP_COUNT,
+    // Variants specialize_opcode() substitutes when a quirk is set, decode_opcode() never returns them
+    OP_8xy1_VF = OP_COUNT, OP_8xy2_VF, OP_8xy3_VF, OP_8xy6_VY, OP_8xyE_VY, OP_Bxnn, OP_Dxyn_WRAP, OP_Fx55_I, OP_Fx65_I,
+    OP_SPECIALIZED_COUNT
+} opcode_id;
+
+// Same decoding tree as execute_instruction(), for engines that decode once and dispatch many times
+static inline opcode_id decode_opcode(uint16_t opcode) {
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            switch (opcode & 0x000F) {
+                case 0x0000: return OP_00E0;
+                case 0x000E: return OP_00EE;
+            }
+            break;
+        case 0x1000: return OP_1nnn;
+        case 0x2000: return OP_2nnn;
+        case 0x3000: return OP_3xkk;
+        case 0x4000: return OP_4xkk;
+        case 0x5000: return OP_5xy0;
+        case 0x6000: return OP_6xkk;
+        case 0x7000: return OP_7xkk;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0000: return OP_8xy0;
+                case 0x0001: return OP_8xy1;
+                case 0x0002: return OP_8xy2;
+                case 0x0003: return OP_8xy3;
+                case 0x0004: return OP_8xy4;
+                case 0x0005: return OP_8xy5;
+                case 0x0006: return OP_8xy6;
+                case 0x0007: return OP_8xy7;
+                case 0x000E: return OP_8xyE;
+            }
+            break;
+        case 0x9000: return OP_9xy0;
+        case 0xA000: return OP_Annn;
+        case 0xB000: return OP_Bnnn;
+        case 0xC000: return OP_Cxkk;
+        case 0xD000: return OP_Dxyn;
+        case 0xE000:
+            switch (opcode & 0x00FF) {
+                case 0x009E: return OP_Ex9E;
+                case 0x00A1: return OP_ExA1;
+            }
+            break;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0007: return OP_Fx07;
+                case 0x000A: return OP_Fx0A;
+                case 0x0015: return OP_Fx15;
+                case 0x0018: return OP_Fx18;
+                case 0x001E: return OP_Fx1E;
+                case 0x0029: return OP_Fx29;
+                case 0x0033: return OP_Fx33;
+                case 0x0055: return OP_Fx55;
+                case 0x0065: return OP_Fx65;
+            }
+            break;
+    }
+    return OP_INVALID;
+}
+
+// For engines that decode once: picks the handler variant an opcode runs as under a quirk set, so the
+// quirks are resolved when the instruction is decoded instead of every time it executes
+static inline opcode_id specialize_opcode(opcode_id id, unsigned quirks) {
+    switch (id) {
+        case OP_8xy1: return quirks & QUIRK_VF_RESET ? OP_8xy1_VF : id;
+        case OP_8xy2: return quirks & QUIRK_VF_RESET ? OP_8xy2_VF : id;
+        case OP_8xy3: return quirks & QUIRK_VF_RESET ? OP_8xy3_VF : id;
+        case OP_8xy6: return quirks & QUIRK_SHIFT_VY ? OP_8xy6_VY : id;
+        case OP_8xyE: return quirks & QUIRK_SHIFT_VY ? OP_8xyE_VY : id;
+        case OP_Bnnn: return quirks & QUIRK_JUMP_VX ? OP_Bxnn : id;
+        case OP_Dxyn: return quirks & QUIRK_WRAP_SPRITES ? OP_Dxyn_WRAP : id;
+        case OP_Fx55: return quirks & QUIRK_INCREMENT_I ? OP_Fx55_I : id;
+        case OP_Fx65: return quirks & QUIRK_INCREMENT_I ? OP_Fx65_I : id;
+        default: return id;
+    }
+}
+
+#endif
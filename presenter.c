@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "presenter.h"
+#include "timing.h"
+
+int presenter_init(presenter *presenter_ptr, GLFWwindow *window_ptr) {
+    memset(presenter_ptr, 0, sizeof(*presenter_ptr));
+    presenter_ptr->window_ptr = window_ptr;
+    presenter_ptr->stale_rows = 0xFFFFFFFF; // The texture starts out undefined
+
+    glGenTextures(1, &presenter_ptr->texture);
+    if (presenter_ptr->texture == 0) {
+        printf("Failed to create the display texture.\n");
+        return -1;
+    }
+    glBindTexture(GL_TEXTURE_2D, presenter_ptr->texture);
+    // Nearest filtering keeps the pixels sharp when the texture is scaled up to the window
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 64, 32, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glEnable(GL_TEXTURE_2D);
+    return 0;
+}
+
+void presenter_free(presenter *presenter_ptr) {
+    glDeleteTextures(1, &presenter_ptr->texture);
+    presenter_ptr->texture = 0;
+}
+
+// Sends every run of consecutive dirty rows with a single sub-image update
+static void upload_dirty_rows(presenter *presenter_ptr, const uint64_t display[32], uint64_t dirty) {
+    uint8_t rgb[32 * 64 * 3];
+
+    while (dirty != 0) {
+        int first = __builtin_ctzll(dirty);
+        int count = __builtin_ctzll(~(dirty >> first));
+        for (int row = first; row < first + count; row++) {
+            display_row_to_rgb(display[row], rgb + row * 64 * 3);
+            presenter_ptr->shown[row] = display[row];
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, 64, count, GL_RGB, GL_UNSIGNED_BYTE, rgb + first * 64 * 3);
+        presenter_ptr->stats.uploaded_rows += count;
+        dirty &= ~((((uint64_t)1 << count) - 1) << first);
+    }
+}
+
+void presenter_frame(presenter *presenter_ptr, const uint64_t display[32]) {
+    uint32_t dirty = presenter_ptr->stale_rows;
+    int width, height;
+
+    presenter_ptr->stats.frames++;
+    for (int row = 0; row < 32; row++) {
+        dirty |= (uint32_t)(display[row] != presenter_ptr->shown[row]) << row;
+    }
+    glfwGetFramebufferSize(presenter_ptr->window_ptr, &width, &height);
+    if (dirty == 0 && width == presenter_ptr->width && height == presenter_ptr->height) {
+        presenter_ptr->stats.skipped_frames++;
+        return;
+    }
+
+    double start = now_seconds();
+    upload_dirty_rows(presenter_ptr, display, dirty);
+    presenter_ptr->stale_rows = 0;
+
+    // One textured quad over the whole window, texture row 0 is the top of the screen
+    presenter_ptr->width = width;
+    presenter_ptr->height = height;
+    glViewport(0, 0, width, height);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0.0f, 1.0f);
+    glVertex2f(-1.0f, -1.0f);
+    glTexCoord2f(1.0f, 1.0f);
+    glVertex2f(1.0f, -1.0f);
+    glTexCoord2f(1.0f, 0.0f);
+    glVertex2f(1.0f, 1.0f);
+    glTexCoord2f(0.0f, 0.0f);
+    glVertex2f(-1.0f, 1.0f);
+    glEnd();
+    glfwSwapBuffers(presenter_ptr->window_ptr);
+
+    double elapsed = now_seconds() - start;
+    presenter_ptr->stats.presents++;
+    presenter_ptr->stats.present_seconds += elapsed;
+    presenter_ptr->stats.last_present_seconds = elapsed;
+    if (elapsed > presenter_ptr->stats.max_present_seconds) {
+        presenter_ptr->stats.max_present_seconds = elapsed;
+    }
+}
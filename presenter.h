@@ -0,0 +1,41 @@
+#ifndef PRESENTER_H
+#define PRESENTER_H
+
+#include <stdint.h>
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include "chip8.h"
+
+// Window size in host pixels for each CHIP-8 pixel
+#define PRESENTER_SCALE 10
+
+typedef struct {
+    uint64_t frames; // Host frames presenter_frame() was called for
+    uint64_t presents; // Frames that were drawn and swapped
+    uint64_t skipped_frames; // Frames where nothing changed, the previous image stays on screen
+    uint64_t uploaded_rows; // Framebuffer rows sent to the texture
+    double present_seconds; // Total time spent uploading, drawing and swapping
+    double last_present_seconds;
+    double max_present_seconds;
+} presenter_stats;
+
+typedef struct {
+    GLFWwindow *window_ptr;
+    GLuint texture;
+    int width, height; // Framebuffer size the last frame was drawn at
+    uint64_t shown[32]; // Rows as they are in the texture
+    uint32_t stale_rows; // Rows the texture doesn't hold yet, whatever shown[] says
+    presenter_stats stats;
+} presenter;
+
+// Creates the 64 x 32 texture the framebuffer is uploaded into, the window's context must be current.
+// Returns 0 on success and -1 on failure.
+int presenter_init(presenter *presenter_ptr, GLFWwindow *window_ptr);
+void presenter_free(presenter *presenter_ptr);
+
+// Called once per host frame: uploads the rows that differ from the last frame shown and presents the frame,
+// or skips the frame entirely when neither the framebuffer nor the window size changed.
+// Frames may be dropped between calls, so the rows are compared instead of trusting the CPU's dirty_rows.
+void presenter_frame(presenter *presenter_ptr, const uint64_t display[32]);
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "chip8.h"
+#include "disasm.h"
+#include "profile.h"
+#include "timing.h"
+
+// Older C libraries only have the kernel's name for the thread a timer signals
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// Rows printed in the hottest-address table
+#define PROFILE_TOP_ADDRESSES 20
+
+static const char *opcode_names[OP_COUNT] = {
+    "invalid",
+    "_00E0", "_00EE", "_1nnn", "_2nnn", "_3xkk", "_4xkk", "_5xy0", "_6xkk", "_7xkk",
+    "_8xy0", "_8xy1", "_8xy2", "_8xy3", "_8xy4", "_8xy5", "_8xy6", "_8xy7", "_8xyE",
+    "_9xy0", "_Annn", "_Bnnn", "_Cxkk", "_Dxyn", "_Ex9E", "_ExA1",
+    "_Fx07", "_Fx0A", "_Fx15", "_Fx18", "_Fx1E", "_Fx29", "_Fx33", "_Fx55", "_Fx65",
+};
+
+static const char *section_names[PROFILE_SECTION_COUNT] = { "dispatch", "draw", "input", "handoff", "present", "idle" };
+
+static profile *sampled_profile;
+static volatile sig_atomic_t report_pending;
+
+// Every timer signals the thread whose CPU time it counts, with the section that thread samples into.
+// CPU clock timers are only checked on the kernel's scheduler tick, expirations missed in between are overruns.
+static void on_sample(int signal_number, siginfo_t *info_ptr, void *context) {
+    profile *profile_ptr = sampled_profile;
+    if (profile_ptr == NULL) {
+        return;
+    }
+
+    int section = info_ptr->si_value.sival_int;
+    uint64_t weight = 1 + (info_ptr->si_overrun > 0 ? info_ptr->si_overrun : 0);
+    if (section != PROFILE_ENTERED) {
+        profile_ptr->samples[section][OP_INVALID] += weight;
+        return;
+    }
+    opcode_id id = decode_opcode(profile_ptr->opcode);
+    section = profile_ptr->section;
+    if (section == PROFILE_DISPATCH && (id == OP_Dxyn || id == OP_00E0)) {
+        section = PROFILE_DRAW;
+    }
+    profile_ptr->samples[section][id] += weight;
+}
+
+static void on_report_request(int signal_number) {
+    report_pending = 1;
+}
+
+profile *profile_create(void) {
+    struct sigaction action;
+    profile *profile_ptr = calloc(1, sizeof(profile));
+
+    if (profile_ptr == NULL) {
+        return NULL;
+    }
+    sampled_profile = profile_ptr;
+
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    action.sa_sigaction = on_sample;
+    if (sigaction(SIGPROF, &action, NULL) != 0) {
+        printf("Failed to install the profiling signal handler.\n");
+        sampled_profile = NULL;
+        free(profile_ptr);
+        return NULL;
+    }
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = on_report_request;
+    sigaction(SIGUSR1, &action, NULL);
+    return profile_ptr;
+}
+
+int profile_sample_thread(profile *profile_ptr, int section) {
+    struct sigevent event;
+    struct itimerspec interval = { { 0, PROFILE_SAMPLE_USEC * 1000 }, { 0, PROFILE_SAMPLE_USEC * 1000 } };
+    int index = atomic_fetch_add(&profile_ptr->thread_count, 1);
+
+    if (index >= PROFILE_MAX_THREADS) {
+        atomic_fetch_sub(&profile_ptr->thread_count, 1);
+        printf("Too many threads to profile.\n");
+        return -1;
+    }
+    // A per-thread CPU clock instead of the process-wide ITIMER_PROF: the signal goes to the thread that used the
+    // time, so one thread's work is never sampled as another's section
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_value.sival_int = section;
+    event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &profile_ptr->timers[index]) != 0) {
+        printf("Failed to create the profiling timer.\n");
+        profile_ptr->timers[index] = NULL;
+        return -1;
+    }
+    if (timer_settime(profile_ptr->timers[index], 0, &interval, NULL) != 0) {
+        printf("Failed to start the profiling timer.\n");
+        return -1;
+    }
+    return 0;
+}
+
+void profile_enter(profile *profile_ptr, profile_section section) {
+    if (profile_ptr == NULL) {
+        return;
+    }
+    if (section == PROFILE_IDLE && profile_ptr->section != PROFILE_IDLE) {
+        profile_ptr->idle_start = now_seconds();
+    } else if (section != PROFILE_IDLE && profile_ptr->section == PROFILE_IDLE) {
+        // Whole samples of sleep, so idle compares with the sections the timers sampled
+        double samples = (now_seconds() - profile_ptr->idle_start) * 1e6 / PROFILE_SAMPLE_USEC + profile_ptr->idle_carry;
+        profile_ptr->samples[PROFILE_IDLE][OP_INVALID] += (uint64_t)samples;
+        profile_ptr->idle_carry = samples - (uint64_t)samples;
+    }
+    profile_ptr->section = section;
+}
+
+void profile_destroy(profile *profile_ptr) {
+    if (profile_ptr == NULL) {
+        return;
+    }
+    for (int i = 0; i < profile_ptr->thread_count && i < PROFILE_MAX_THREADS; i++) {
+        if (profile_ptr->timers[i] != NULL) {
+            timer_delete(profile_ptr->timers[i]);
+        }
+    }
+    signal(SIGPROF, SIG_IGN);
+    if (sampled_profile == profile_ptr) {
+        sampled_profile = NULL;
+    }
+    free(profile_ptr);
+}
+
+int profile_report_requested(void) {
+    if (!report_pending) {
+        return 0;
+    }
+    report_pending = 0;
+    return 1;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0.0;
+}
+
+// Groups the raw opcode counts by handler
+static void handler_counts(const profile *profile_ptr, uint64_t counts[OP_COUNT]) {
+    memset(counts, 0, OP_COUNT * sizeof(uint64_t));
+    for (uint32_t opcode = 0; opcode < 65536; opcode++) {
+        counts[decode_opcode(opcode)] += profile_ptr->opcode_counts[opcode];
+    }
+}
+
+static void write_text(const profile *profile_ptr, const chip8_cpu *cpu_ptr, FILE *file_ptr) {
+    uint64_t instructions = 0, samples = 0, section_samples[PROFILE_SECTION_COUNT] = {0}, counts[OP_COUNT];
+    int order[OP_COUNT];
+
+    handler_counts(profile_ptr, counts);
+    for (int id = 0; id < OP_COUNT; id++) {
+        instructions += counts[id];
+        order[id] = id;
+        for (int section = 0; section < PROFILE_SECTION_COUNT; section++) {
+            section_samples[section] += profile_ptr->samples[section][id];
+        }
+    }
+    for (int section = 0; section < PROFILE_SECTION_COUNT; section++) {
+        samples += section_samples[section];
+    }
+
+    fprintf(file_ptr, "Instructions: %llu\n", (unsigned long long)instructions);
+    fprintf(file_ptr, "Samples: %llu (every %d us of CPU time of each thread, idle counts %d us asleep as one)\n\n",
+            (unsigned long long)samples, PROFILE_SAMPLE_USEC, PROFILE_SAMPLE_USEC);
+    fprintf(file_ptr, "Time by section:\n");
+    for (int section = 0; section < PROFILE_SECTION_COUNT; section++) {
+        fprintf(file_ptr, "  %-10s %8llu  %5.1f%%\n", section_names[section],
+                (unsigned long long)section_samples[section], percent(section_samples[section], samples));
+    }
+
+    // Few enough opcodes for an insertion sort by count
+    for (int i = 1; i < OP_COUNT; i++) {
+        for (int j = i; j > 0 && counts[order[j]] > counts[order[j - 1]]; j--) {
+            int swap = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = swap;
+        }
+    }
+    fprintf(file_ptr, "\nInstructions by handler:\n");
+    for (int i = 0; i < OP_COUNT && counts[order[i]] > 0; i++) {
+        uint64_t count = counts[order[i]];
+        fprintf(file_ptr, "  %-8s %12llu  %5.1f%%\n", opcode_names[order[i]], (unsigned long long)count,
+                percent(count, instructions));
+    }
+
+    // Repeatedly picks the hottest address not printed yet, the table is short
+    fprintf(file_ptr, "\nHottest addresses:\n");
+    uint64_t previous = UINT64_MAX;
+    int previous_address = -1;
+    for (int row = 0; row < PROFILE_TOP_ADDRESSES; row++) {
+        int best = -1;
+        for (int address = 0; address < 4096; address++) {
+            uint64_t hits = profile_ptr->pc_hits[address];
+            int after_previous = hits < previous || (hits == previous && address > previous_address);
+            if (hits > 0 && after_previous && (best < 0 || hits > profile_ptr->pc_hits[best])) {
+                best = address;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        char text[32];
+        uint16_t opcode = (cpu_ptr->memory[best] << 8) | cpu_ptr->memory[(best + 1) & 0xFFF];
+        disassemble(opcode, text, sizeof(text));
+        fprintf(file_ptr, "  0x%03X %12llu  %5.1f%%  %s\n", best, (unsigned long long)profile_ptr->pc_hits[best],
+                percent(profile_ptr->pc_hits[best], instructions), text);
+        previous = profile_ptr->pc_hits[best];
+        previous_address = best;
+    }
+}
+
+// One "chip8;section;handler count" line per stack, the format flamegraph.pl and speedscope read.
+// Without any samples the instruction counts are written instead.
+static void write_collapsed(const profile *profile_ptr, FILE *file_ptr) {
+    uint64_t samples = 0, counts[OP_COUNT];
+
+    handler_counts(profile_ptr, counts);
+    for (int section = 0; section < PROFILE_SECTION_COUNT; section++) {
+        for (int id = 0; id < OP_COUNT; id++) {
+            samples += profile_ptr->samples[section][id];
+        }
+    }
+
+    for (int section = 0; section < PROFILE_SECTION_COUNT; section++) {
+        uint64_t outside = 0;
+        for (int id = 0; id < OP_COUNT; id++) {
+            uint64_t count = samples ? profile_ptr->samples[section][id] : 0;
+            if (!samples && section == PROFILE_DISPATCH) {
+                count = counts[id];
+            }
+            // Only dispatch and draw samples are inside an instruction, the others get one frame per section
+            if (section != PROFILE_DISPATCH && section != PROFILE_DRAW) {
+                outside += count;
+            } else if (count > 0) {
+                fprintf(file_ptr, "chip8;%s;%s %llu\n", section_names[section], opcode_names[id], (unsigned long long)count);
+            }
+        }
+        if (outside > 0) {
+            fprintf(file_ptr, "chip8;%s %llu\n", section_names[section], (unsigned long long)outside);
+        }
+    }
+}
+
+int profile_write(const profile *profile_ptr, const chip8_cpu *cpu_ptr, const char *path) {
+    char folded_path[4096];
+    FILE *text_ptr = fopen(path, "w");
+
+    snprintf(folded_path, sizeof(folded_path), "%s.folded", path);
+    FILE *folded_ptr = fopen(folded_path, "w");
+    if (text_ptr == NULL || folded_ptr == NULL) {
+        printf("Failed to create the profile report %s.\n", text_ptr == NULL ? path : folded_path);
+        if (text_ptr != NULL) {
+            fclose(text_ptr);
+        }
+        if (folded_ptr != NULL) {
+            fclose(folded_ptr);
+        }
+        return -1;
+    }
+
+    write_text(profile_ptr, cpu_ptr, text_ptr);
+    write_collapsed(profile_ptr, folded_ptr);
+    fclose(text_ptr);
+    fclose(folded_ptr);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "chip8.h"
+#include "opcodes.h"
+
+// Profiling is compiled in with -DCHIP8_PROFILE. Without it the hook in the interpreter expands to nothing.
+
+// Host CPU time of a thread between two samples of where it is
+#define PROFILE_SAMPLE_USEC 1000
+// Threads that can sample into one profile, the frontend has two
+#define PROFILE_MAX_THREADS 4
+
+typedef enum {
+    PROFILE_DISPATCH, // Executing instructions
+    PROFILE_DRAW, // Executing 00E0 and Dxyn, told apart from dispatch by the sampled opcode
+    PROFILE_INPUT, // Handling window and key events
+    PROFILE_HANDOFF, // Handing the finished frame to the render thread
+    PROFILE_PRESENT, // Render thread: uploading, drawing and swapping frames, and receiving window events
+    PROFILE_IDLE, // Asleep until the next frame or key, measured in wall time since it uses no CPU
+    PROFILE_SECTION_COUNT
+} profile_section;
+
+// Passed to profile_sample_thread() by the thread running the CPU, which marks its sections with profile_enter()
+#define PROFILE_ENTERED PROFILE_SECTION_COUNT
+
+typedef struct profile {
+    // Counted by raw opcode so the hot path doesn't decode, reports group them by handler
+    uint64_t opcode_counts[65536];
+    uint64_t pc_hits[4096];
+    uint64_t samples[PROFILE_SECTION_COUNT][OP_COUNT]; // Timer samples by section and the handler being executed
+    volatile sig_atomic_t section; // Where the thread running the CPU is now, read by the sampling signal handler
+    volatile sig_atomic_t opcode; // Opcode being executed
+    timer_t timers[PROFILE_MAX_THREADS]; // One per sampled thread, counting that thread's CPU time only
+    atomic_int thread_count;
+    double idle_start; // now_seconds() when the thread running the CPU went to sleep
+    double idle_carry; // Sleep shorter than a sample, carried over to the next one
+} profile;
+
+// Allocates a profile and installs the signal handlers, threads start sampling with profile_sample_thread().
+// Only one profile samples at a time. SIGUSR1 asks for a report, see profile_report_requested().
+// Returns NULL on failure.
+profile *profile_create(void);
+
+// Starts sampling the CPU time of the calling thread. The thread running the CPU passes PROFILE_ENTERED, its
+// samples go to the section it last entered and the handler it executes. Any other thread passes the section all
+// of its samples belong to, so its work is never charged to what the CPU thread happens to be doing.
+// Returns 0 on success and -1 on failure.
+int profile_sample_thread(profile *profile_ptr, int section);
+
+// Stops sampling and frees the profile
+void profile_destroy(profile *profile_ptr);
+
+// Marks what the thread running the CPU does from now on. Time in PROFILE_IDLE is added up from the clock when
+// the thread leaves it, a sleeping thread is never sampled.
+void profile_enter(profile *profile_ptr, profile_section section);
+
+// True once after SIGUSR1 was received
+int profile_report_requested(void);
+
+// Writes the text report to path and the samples in collapsed-stack format to path.folded,
+// the CPU's memory is used to disassemble the hottest addresses. Returns 0 on success and -1 on failure.
+int profile_write(const profile *profile_ptr, const chip8_cpu *cpu_ptr, const char *path);
+
+static inline void profile_instruction(profile *profile_ptr, uint16_t program_counter, uint16_t opcode) {
+    profile_ptr->opcode_counts[opcode]++;
+    profile_ptr->pc_hits[program_counter & 0xFFF]++;
+    profile_ptr->opcode = opcode;
+}
+
+#ifdef CHIP8_PROFILE
+#define PROFILE_INSTRUCTION(cpu_ptr, opcode) \
+    do { \
+        if ((cpu_ptr)->profile_ptr != NULL) { \
+            profile_instruction((cpu_ptr)->profile_ptr, (cpu_ptr)->registers.program_counter, (opcode)); \
+        } \
+    } while (0)
+// Marks what the host does next, for the frontends
+#define PROFILE_ENTER(cpu_ptr, section) profile_enter((cpu_ptr)->profile_ptr, (section))
+#else
+#define PROFILE_INSTRUCTION(cpu_ptr, opcode) do { } while (0)
+#define PROFILE_ENTER(cpu_ptr, section) do { } while (0)
+#endif
+
+#endif
@@ -0,0 +1,27 @@
+#include <string.h>
+#include "quirks.h"
+
+int quirks_parse(const char *name, quirk_profile *profile_ptr) {
+    // Catalogs written before there were profiles say "default"
+    if (strcmp(name, "chip8") == 0 || strcmp(name, "default") == 0) {
+        *profile_ptr = QUIRKS_CHIP8;
+    } else if (strcmp(name, "schip") == 0) {
+        *profile_ptr = QUIRKS_SCHIP;
+    } else if (strcmp(name, "xochip") == 0) {
+        *profile_ptr = QUIRKS_XOCHIP;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *quirks_name(quirk_profile profile) {
+    switch (profile) {
+        case QUIRKS_SCHIP:
+            return "schip";
+        case QUIRKS_XOCHIP:
+            return "xochip";
+        default:
+            return "chip8";
+    }
+}
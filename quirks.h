@@ -0,0 +1,39 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+// Behaviours the CHIP-8 variants disagree on. Handlers take a set of them as a parameter that is a
+// compile-time constant at every call site, so each instantiated dispatch loop has only one behaviour built in.
+#define QUIRK_VF_RESET 0x01 // 8xy1, 8xy2 and 8xy3 clear VF
+#define QUIRK_SHIFT_VY 0x02 // 8xy6 and 8xyE shift Vy into Vx, otherwise Vx is shifted in place
+#define QUIRK_INCREMENT_I 0x04 // Fx55 and Fx65 leave I pointing after the last register they copied
+#define QUIRK_JUMP_VX 0x08 // Bxnn jumps to xnn + Vx, otherwise Bnnn jumps to nnn + V0
+#define QUIRK_WRAP_SPRITES 0x10 // Sprites wrap around the screen edges, otherwise they are clipped
+
+// Quirk sets of the supported profiles
+#define QUIRK_SET_CHIP8 (QUIRK_VF_RESET | QUIRK_SHIFT_VY | QUIRK_INCREMENT_I) // COSMAC VIP interpreter
+#define QUIRK_SET_SCHIP (QUIRK_JUMP_VX) // SUPER-CHIP 1.1 on the HP48
+#define QUIRK_SET_XOCHIP (QUIRK_SHIFT_VY | QUIRK_INCREMENT_I | QUIRK_WRAP_SPRITES) // Octo
+
+typedef enum {
+    QUIRKS_CHIP8,
+    QUIRKS_SCHIP,
+    QUIRKS_XOCHIP,
+    QUIRKS_COUNT
+} quirk_profile;
+
+// Parses "chip8", "schip" or "xochip", returns 0 on success and -1 on an unknown name
+int quirks_parse(const char *name, quirk_profile *profile_ptr);
+const char *quirks_name(quirk_profile profile);
+
+static inline unsigned quirk_set(quirk_profile profile) {
+    switch (profile) {
+        case QUIRKS_SCHIP:
+            return QUIRK_SET_SCHIP;
+        case QUIRKS_XOCHIP:
+            return QUIRK_SET_XOCHIP;
+        default:
+            return QUIRK_SET_CHIP8;
+    }
+}
+
+#endif
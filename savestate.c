@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "chip8.h"
+#include "savestate.h"
+
+#define SAVESTATE_MAGIC "C8ST"
+#define SAVESTATE_VERSION 3
+
+static inline uint8_t *put16(uint8_t *out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+    return out + 2;
+}
+
+static inline uint8_t *put32(uint8_t *out, uint32_t value) {
+    out = put16(out, value & 0xFFFF);
+    return put16(out, value >> 16);
+}
+
+static inline uint8_t *put64(uint8_t *out, uint64_t value) {
+    out = put32(out, value & 0xFFFFFFFF);
+    return put32(out, value >> 32);
+}
+
+static inline uint16_t get16(const uint8_t **in) {
+    uint16_t value = (*in)[0] | ((*in)[1] << 8);
+    *in += 2;
+    return value;
+}
+
+static inline uint32_t get32(const uint8_t **in) {
+    uint32_t low = get16(in);
+    return low | ((uint32_t)get16(in) << 16);
+}
+
+static inline uint64_t get64(const uint8_t **in) {
+    uint64_t low = get32(in);
+    return low | ((uint64_t)get32(in) << 32);
+}
+
+void snapshot_save(const chip8_cpu *cpu_ptr, uint8_t snapshot[SNAPSHOT_SIZE]) {
+    const cpu_registers *r = &cpu_ptr->registers;
+    uint8_t *out = snapshot;
+
+    memcpy(out, cpu_ptr->memory, sizeof(cpu_ptr->memory));
+    out += sizeof(cpu_ptr->memory);
+    for (int row = 0; row < 32; row++) {
+        out = put64(out, cpu_ptr->display[row]);
+    }
+    memcpy(out, r->V, sizeof(r->V));
+    out += sizeof(r->V);
+    *out++ = r->delay_timer;
+    *out++ = r->sound_timer;
+    out = put16(out, r->I);
+    out = put16(out, r->program_counter);
+    for (int i = 0; i < 16; i++) {
+        out = put16(out, r->stack[i]);
+    }
+    out = put16(out, r->stack_ptr);
+    out = put32(out, r->rng);
+    out = put16(out, cpu_ptr->keys);
+    out = put16(out, cpu_ptr->key_wait_pressed);
+    *out++ = cpu_ptr->key_wait;
+    out = put64(out, cpu_ptr->cycle_count);
+    out = put32(out, cpu_ptr->clock_hz);
+    out = put32(out, cpu_ptr->timer_phase);
+    *out = cpu_ptr->quirks;
+}
+
+void snapshot_load(chip8_cpu *cpu_ptr, const uint8_t snapshot[SNAPSHOT_SIZE]) {
+    cpu_registers *r = &cpu_ptr->registers;
+    const uint8_t *in = snapshot;
+
+    memcpy(cpu_ptr->memory, in, sizeof(cpu_ptr->memory));
+    in += sizeof(cpu_ptr->memory);
+    for (int row = 0; row < 32; row++) {
+        cpu_ptr->display[row] = get64(&in);
+    }
+    memcpy(r->V, in, sizeof(r->V));
+    in += sizeof(r->V);
+    r->delay_timer = *in++;
+    r->sound_timer = *in++;
+    r->I = get16(&in);
+    r->program_counter = get16(&in);
+    for (int i = 0; i < 16; i++) {
+        r->stack[i] = get16(&in);
+    }
+    r->stack_ptr = get16(&in);
+    r->rng = get32(&in);
+    if (r->rng == 0) {
+        r->rng = 1; // xorshift would only ever draw zeros
+    }
+    cpu_ptr->keys = get16(&in);
+    cpu_ptr->key_wait_pressed = get16(&in);
+    cpu_ptr->key_wait = *in++;
+    cpu_ptr->cycle_count = get64(&in);
+    set_clock_hz(cpu_ptr, get32(&in));
+    cpu_ptr->timer_phase = get32(&in) % cpu_ptr->clock_hz;
+    set_quirks(cpu_ptr, *in);
+    cpu_ptr->dirty_rows = 0xFFFFFFFF;
+    cpu_ptr->dirty_pages = 0xFFFF; // Nothing is known about how memory relates to a golden image
+}
+
+int savestate_write(const chip8_cpu *cpu_ptr, const char *path) {
+    uint8_t snapshot[SNAPSHOT_SIZE], header[8];
+    FILE *file_ptr = fopen(path, "wb");
+
+    if (file_ptr == NULL) {
+        printf("Failed to create save state %s.\n", path);
+        return -1;
+    }
+
+    memcpy(header, SAVESTATE_MAGIC, 4);
+    put32(header + 4, SAVESTATE_VERSION);
+    snapshot_save(cpu_ptr, snapshot);
+    int written = fwrite(header, 1, sizeof(header), file_ptr) == sizeof(header) &&
+                  fwrite(snapshot, 1, sizeof(snapshot), file_ptr) == sizeof(snapshot);
+    if (fclose(file_ptr) != 0 || !written) {
+        printf("Failed to write save state %s.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int savestate_read(chip8_cpu *cpu_ptr, const char *path) {
+    uint8_t snapshot[SNAPSHOT_SIZE], header[8];
+    FILE *file_ptr = fopen(path, "rb");
+
+    if (file_ptr == NULL) {
+        printf("Failed to open save state %s.\n", path);
+        return -1;
+    }
+
+    int complete = fread(header, 1, sizeof(header), file_ptr) == sizeof(header) &&
+                   fread(snapshot, 1, sizeof(snapshot), file_ptr) == sizeof(snapshot);
+    fclose(file_ptr);
+    const uint8_t *version = header + 4;
+    if (!complete || memcmp(header, SAVESTATE_MAGIC, 4) != 0 || get32(&version) != SAVESTATE_VERSION) {
+        printf("%s is not a compatible save state.\n", path);
+        return -1;
+    }
+
+    snapshot_load(cpu_ptr, snapshot);
+    return 0;
+}
+
+// Deltas are a sequence of (zero run, literal run, literal bytes) with LEB128 run lengths.
+// Worst case is one pair per two bytes, each with one-byte runs.
+#define DELTA_MAX_SIZE (SNAPSHOT_SIZE / 2 * 3 + 8)
+
+static inline uint8_t *put_varint(uint8_t *out, uint32_t value) {
+    while (value >= 0x80) {
+        *out++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+static inline uint32_t get_varint(const uint8_t **in) {
+    uint32_t value = 0;
+    int shift = 0;
+    while (**in & 0x80) {
+        value |= (uint32_t)(*(*in)++ & 0x7F) << shift;
+        shift += 7;
+    }
+    return value | ((uint32_t)*(*in)++ << shift);
+}
+
+// Encodes snapshot XOR base, returns the encoded size
+static size_t delta_encode(const uint8_t *snapshot, const uint8_t *base, uint8_t *out) {
+    uint8_t *start = out;
+    size_t i = 0;
+
+    while (i < SNAPSHOT_SIZE) {
+        size_t zeros = i;
+        // Most of the snapshot is unchanged, skip it a word at a time
+        while (zeros + 8 <= SNAPSHOT_SIZE) {
+            uint64_t a, b;
+            memcpy(&a, snapshot + zeros, 8);
+            memcpy(&b, base + zeros, 8);
+            if (a != b) {
+                break;
+            }
+            zeros += 8;
+        }
+        while (zeros < SNAPSHOT_SIZE && snapshot[zeros] == base[zeros]) {
+            zeros++;
+        }
+        size_t literals = zeros;
+        while (literals < SNAPSHOT_SIZE && snapshot[literals] != base[literals]) {
+            literals++;
+        }
+
+        out = put_varint(out, zeros - i);
+        out = put_varint(out, literals - zeros);
+        for (size_t j = zeros; j < literals; j++) {
+            *out++ = snapshot[j] ^ base[j];
+        }
+        i = literals;
+    }
+    return out - start;
+}
+
+static void delta_decode(const uint8_t *in, size_t size, const uint8_t *base, uint8_t *snapshot) {
+    const uint8_t *end = in + size;
+    size_t i = 0;
+
+    memcpy(snapshot, base, SNAPSHOT_SIZE);
+    while (in < end) {
+        i += get_varint(&in);
+        uint32_t literals = get_varint(&in);
+        for (uint32_t j = 0; j < literals; j++) {
+            snapshot[i++] ^= *in++;
+        }
+    }
+}
+
+int rewind_init(rewind_buffer *rewind_ptr, size_t frames) {
+    memset(rewind_ptr, 0, sizeof(*rewind_ptr));
+    rewind_ptr->capacity = (frames + REWIND_KEYFRAME_INTERVAL - 1) / REWIND_KEYFRAME_INTERVAL * REWIND_KEYFRAME_INTERVAL;
+    if (rewind_ptr->capacity == 0) {
+        rewind_ptr->capacity = REWIND_KEYFRAME_INTERVAL;
+    }
+    rewind_ptr->entries = calloc(rewind_ptr->capacity, sizeof(rewind_entry));
+    return rewind_ptr->entries != NULL ? 0 : -1;
+}
+
+void rewind_free(rewind_buffer *rewind_ptr) {
+    for (size_t i = 0; i < rewind_ptr->capacity; i++) {
+        free(rewind_ptr->entries[i].data);
+    }
+    free(rewind_ptr->entries);
+    memset(rewind_ptr, 0, sizeof(*rewind_ptr));
+}
+
+int rewind_push(rewind_buffer *rewind_ptr, const chip8_cpu *cpu_ptr) {
+    static const uint8_t zero[SNAPSHOT_SIZE];
+    uint8_t encoded[DELTA_MAX_SIZE];
+    uint64_t frame = rewind_ptr->frames;
+    rewind_entry *entry_ptr = &rewind_ptr->entries[frame % rewind_ptr->capacity];
+    int keyframe = frame % REWIND_KEYFRAME_INTERVAL == 0;
+
+    snapshot_save(cpu_ptr, rewind_ptr->snapshot);
+    size_t size = delta_encode(rewind_ptr->snapshot, keyframe ? zero : rewind_ptr->keyframe, encoded);
+    if (size > entry_ptr->capacity) {
+        uint8_t *data = realloc(entry_ptr->data, size);
+        if (data == NULL) {
+            return -1;
+        }
+        entry_ptr->data = data;
+        entry_ptr->capacity = size;
+    }
+    memcpy(entry_ptr->data, encoded, size);
+    rewind_ptr->bytes += size;
+    rewind_ptr->bytes -= entry_ptr->size;
+    entry_ptr->size = size;
+    if (keyframe) {
+        memcpy(rewind_ptr->keyframe, rewind_ptr->snapshot, SNAPSHOT_SIZE);
+    }
+
+    // Overwriting a keyframe makes the rest of its group undecodable, the oldest frame moves to the next group
+    rewind_ptr->frames = frame + 1;
+    if (rewind_ptr->frames - rewind_ptr->oldest > rewind_ptr->capacity) {
+        rewind_ptr->oldest += REWIND_KEYFRAME_INTERVAL;
+    }
+    return 0;
+}
+
+int rewind_drop(rewind_buffer *rewind_ptr) {
+    if (rewind_ptr->frames == rewind_ptr->oldest) {
+        return -1;
+    }
+
+    rewind_entry *entry_ptr = &rewind_ptr->entries[--rewind_ptr->frames % rewind_ptr->capacity];
+    rewind_ptr->bytes -= entry_ptr->size;
+    entry_ptr->size = 0;
+    return 0;
+}
+
+int rewind_pop(rewind_buffer *rewind_ptr, chip8_cpu *cpu_ptr) {
+    static const uint8_t zero[SNAPSHOT_SIZE];
+
+    if (rewind_ptr->frames == rewind_ptr->oldest) {
+        return -1;
+    }
+
+    uint64_t frame = rewind_ptr->frames - 1;
+    uint64_t key = frame - frame % REWIND_KEYFRAME_INTERVAL;
+    const rewind_entry *key_ptr = &rewind_ptr->entries[key % rewind_ptr->capacity];
+    const rewind_entry *entry_ptr = &rewind_ptr->entries[frame % rewind_ptr->capacity];
+
+    // The keyframe is decoded again so the frames pushed after the pop find it as their base
+    delta_decode(key_ptr->data, key_ptr->size, zero, rewind_ptr->keyframe);
+    if (frame == key) {
+        memcpy(rewind_ptr->snapshot, rewind_ptr->keyframe, SNAPSHOT_SIZE);
+    } else {
+        delta_decode(entry_ptr->data, entry_ptr->size, rewind_ptr->keyframe, rewind_ptr->snapshot);
+    }
+    snapshot_load(cpu_ptr, rewind_ptr->snapshot);
+    return rewind_drop(rewind_ptr);
+}
@@ -0,0 +1,55 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chip8.h"
+
+// Serialized machine state: memory, display rows, registers, stack, random state, keypad, cycle counter, clock
+// and quirk profile, in a fixed little-endian layout so snapshots compare and compress byte by byte
+#define SNAPSHOT_SIZE (4096 + 32 * 8 + 16 + 2 + 2 * 2 + 16 * 2 + 2 + 4 + 2 * 2 + 1 + 8 + 4 + 4 + 1)
+
+// Every REWIND_KEYFRAME_INTERVAL frames the rewind buffer stores a frame against zero instead of
+// against the previous keyframe, so any frame decodes from at most two entries
+#define REWIND_KEYFRAME_INTERVAL 60
+
+void snapshot_save(const chip8_cpu *cpu_ptr, uint8_t snapshot[SNAPSHOT_SIZE]);
+
+// Restores a snapshot, the whole display is marked dirty. Engines must be reset afterwards.
+void snapshot_load(chip8_cpu *cpu_ptr, const uint8_t snapshot[SNAPSHOT_SIZE]);
+
+// Save state files: a magic and version header followed by a snapshot. Return 0 on success and -1 on failure.
+int savestate_write(const chip8_cpu *cpu_ptr, const char *path);
+int savestate_read(chip8_cpu *cpu_ptr, const char *path);
+
+// One frame of the rewind ring, XOR against its base and run-length encoded
+typedef struct {
+    uint8_t *data;
+    uint32_t size, capacity; // Buffers are reused when the ring wraps, they only grow
+} rewind_entry;
+
+typedef struct {
+    rewind_entry *entries;
+    size_t capacity; // Frames kept, a multiple of REWIND_KEYFRAME_INTERVAL
+    uint64_t frames; // Index of the next frame pushed
+    uint64_t oldest; // Oldest frame that can still be restored
+    size_t bytes; // Encoded bytes currently held by the ring
+    uint8_t keyframe[SNAPSHOT_SIZE]; // Decoded keyframe of the group being recorded
+    uint8_t snapshot[SNAPSHOT_SIZE];
+} rewind_buffer;
+
+// Allocates a ring holding at least the given number of frames, returns 0 on success and -1 on failure
+int rewind_init(rewind_buffer *rewind_ptr, size_t frames);
+void rewind_free(rewind_buffer *rewind_ptr);
+
+// Records the state after a frame, overwriting the oldest frames once the ring is full.
+// Returns 0 on success and -1 if an entry could not be allocated.
+int rewind_push(rewind_buffer *rewind_ptr, const chip8_cpu *cpu_ptr);
+
+// Restores the newest recorded frame and drops it from the ring, returns 0 on success and -1 when empty
+int rewind_pop(rewind_buffer *rewind_ptr, chip8_cpu *cpu_ptr);
+
+// Drops the newest recorded frame without restoring it, returns 0 on success and -1 when empty
+int rewind_drop(rewind_buffer *rewind_ptr);
+
+#endif
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "scheduler.h"
+#include "timing.h"
+
+void scheduler_init(scheduler *scheduler_ptr, int realtime) {
+    memset(scheduler_ptr, 0, sizeof(*scheduler_ptr));
+    scheduler_ptr->frame_seconds = 1.0 / SCHEDULER_FRAME_HZ;
+    scheduler_ptr->start_wall = now_seconds();
+    scheduler_ptr->start_cpu = process_cpu_seconds();
+    scheduler_set_realtime(scheduler_ptr, realtime);
+}
+
+void scheduler_set_realtime(scheduler *scheduler_ptr, int realtime) {
+    scheduler_ptr->realtime = realtime;
+    scheduler_ptr->next_frame = now_seconds();
+}
+
+int scheduler_due_frames(scheduler *scheduler_ptr) {
+    double now = now_seconds();
+    int due = 0;
+
+    if (!scheduler_ptr->realtime) {
+        scheduler_ptr->next_frame = now + scheduler_ptr->frame_seconds;
+        scheduler_ptr->frames++;
+        return 1;
+    }
+
+    while (scheduler_ptr->next_frame <= now) {
+        if (due == SCHEDULER_MAX_CATCHUP) {
+            // Too far behind, forget the rest of the stall and restart the clock from now
+            uint64_t missed = (uint64_t)((now - scheduler_ptr->next_frame) / scheduler_ptr->frame_seconds) + 1;
+            scheduler_ptr->dropped_frames += missed;
+            scheduler_ptr->next_frame += missed * scheduler_ptr->frame_seconds;
+            break;
+        }
+        scheduler_ptr->next_frame += scheduler_ptr->frame_seconds;
+        due++;
+    }
+    scheduler_ptr->frames += due;
+    return due;
+}
+
+void scheduler_wait(scheduler *scheduler_ptr) {
+    if (!scheduler_ptr->realtime) {
+        return;
+    }
+
+    sleep_until(scheduler_ptr->next_frame);
+    double late = now_seconds() - scheduler_ptr->next_frame;
+    scheduler_ptr->wakeups++;
+    scheduler_ptr->jitter_total += late;
+    if (late > scheduler_ptr->jitter_max) {
+        scheduler_ptr->jitter_max = late;
+    }
+}
+
+void scheduler_report(const scheduler *scheduler_ptr) {
+    double wall = now_seconds() - scheduler_ptr->start_wall;
+    double cpu = process_cpu_seconds() - scheduler_ptr->start_cpu;
+
+    printf("Emulated frames: %llu (%llu dropped)\n", (unsigned long long)scheduler_ptr->frames,
+           (unsigned long long)scheduler_ptr->dropped_frames);
+    if (scheduler_ptr->wakeups > 0) {
+        printf("Wakeup jitter: %.3f ms average, %.3f ms max\n",
+               scheduler_ptr->jitter_total * 1e3 / scheduler_ptr->wakeups, scheduler_ptr->jitter_max * 1e3);
+    }
+    printf("Host CPU usage: %.1f%% of one core\n", wall > 0.0 ? 100.0 * cpu / wall : 0.0);
+}
@@ -0,0 +1,38 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+// Emulated frames per second, one timer tick each
+#define SCHEDULER_FRAME_HZ 60
+// A stall longer than this many frames is dropped instead of caught up, so the emulation doesn't fast-forward
+#define SCHEDULER_MAX_CATCHUP 4
+
+typedef struct {
+    int realtime; // 0 runs unthrottled, one host frame's worth of wall time per iteration
+    double frame_seconds;
+    double next_frame; // Deadline of the next emulated frame, in now_seconds() time
+    // Counters
+    uint64_t frames; // Frames handed out by scheduler_due_frames(), one per host frame when unthrottled
+    uint64_t dropped_frames; // Frames skipped after a stall longer than SCHEDULER_MAX_CATCHUP
+    uint64_t wakeups;
+    double jitter_total, jitter_max; // How late the host woke up after a deadline, in seconds
+    double start_wall, start_cpu;
+} scheduler;
+
+void scheduler_init(scheduler *scheduler_ptr, int realtime);
+
+// Switches between real-time and unthrottled pacing, the emulated clock restarts from now
+void scheduler_set_realtime(scheduler *scheduler_ptr, int realtime);
+
+// Fixed timestep: returns how many emulated frames are due at the current host time. After a stall the
+// missed frames are caught up, at most SCHEDULER_MAX_CATCHUP at once. Unthrottled mode always returns 1.
+int scheduler_due_frames(scheduler *scheduler_ptr);
+
+// Sleeps until the next frame is due and records the wakeup jitter, returns immediately when unthrottled
+void scheduler_wait(scheduler *scheduler_ptr);
+
+// Prints the frame counters, the wakeup jitter and the host CPU usage since scheduler_init()
+void scheduler_report(const scheduler *scheduler_ptr);
+
+#endif
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "stream.h"
+#include "timing.h"
+
+int stream_open(frame_stream *stream_ptr, const char *path, uint32_t keyframe_interval) {
+    struct sockaddr_un address;
+
+    memset(stream_ptr, 0, sizeof(*stream_ptr));
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Socket path %s is too long.\n", path);
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    strcpy(stream_ptr->path, path);
+    stream_ptr->keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+
+    stream_ptr->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (stream_ptr->listen_fd < 0) {
+        printf("Failed to create the stream socket.\n");
+        return -1;
+    }
+    unlink(path);
+    if (bind(stream_ptr->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(stream_ptr->listen_fd, STREAM_MAX_CLIENTS) != 0) {
+        printf("Failed to listen on %s.\n", path);
+        close(stream_ptr->listen_fd);
+        return -1;
+    }
+    return 0;
+}
+
+void stream_close(frame_stream *stream_ptr) {
+    for (int i = 0; i < stream_ptr->client_count; i++) {
+        close(stream_ptr->clients[i].fd);
+    }
+    stream_ptr->client_count = 0;
+    close(stream_ptr->listen_fd);
+    unlink(stream_ptr->path);
+}
+
+// Sends pass MSG_DONTWAIT, so the accepted sockets themselves can stay blocking
+static void accept_clients(frame_stream *stream_ptr) {
+    int fd;
+
+    while (stream_ptr->client_count < STREAM_MAX_CLIENTS &&
+           (fd = accept(stream_ptr->listen_fd, NULL, NULL)) >= 0) {
+        stream_client *client_ptr = &stream_ptr->clients[stream_ptr->client_count++];
+        client_ptr->fd = fd;
+        client_ptr->needs_keyframe = 1;
+        stream_ptr->stats.attached++;
+    }
+}
+
+size_t stream_encode(const uint64_t display[32], const uint64_t *previous, uint8_t payload[STREAM_MAX_PAYLOAD]) {
+    uint8_t bytes[256];
+    size_t size = 0;
+
+    for (int row = 0; row < 32; row++) {
+        uint64_t bits = previous != NULL ? display[row] ^ previous[row] : display[row];
+        for (int i = 0; i < 8; i++) {
+            bytes[row * 8 + i] = bits >> (56 - 8 * i);
+        }
+    }
+    for (int i = 0; i < 256;) {
+        int run = 0;
+        if (bytes[i] == 0) {
+            while (i + run < 256 && run < 128 && bytes[i + run] == 0) {
+                run++;
+            }
+            payload[size++] = run - 1;
+        } else {
+            // A literal ends at two zero bytes in a row, a single zero costs less inside it than as a run
+            while (i + run < 256 && run < 128 &&
+                   (bytes[i + run] != 0 || (i + run + 1 < 256 && bytes[i + run + 1] != 0))) {
+                run++;
+            }
+            payload[size++] = 127 + run;
+            memcpy(payload + size, bytes + i, run);
+            size += run;
+        }
+        i += run;
+    }
+    return size;
+}
+
+uint32_t stream_checksum(const uint64_t display[32]) {
+    uint64_t sum = 0xcbf29ce484222325ULL;
+
+    for (int row = 0; row < 32; row++) {
+        sum = (sum ^ display[row]) * 0x100000001b3ULL;
+    }
+    return (uint32_t)(sum ^ sum >> 32);
+}
+
+int stream_decode(const uint8_t *payload, size_t size, stream_message_type type, uint64_t display[32]) {
+    uint8_t bytes[256];
+    size_t used = 0;
+    int filled = 0;
+
+    while (used < size) {
+        uint8_t control = payload[used++];
+        int run = control < 128 ? control + 1 : control - 127;
+        if (filled + run > 256 || (control >= 128 && used + run > size)) {
+            return -1;
+        }
+        if (control < 128) {
+            memset(bytes + filled, 0, run);
+        } else {
+            memcpy(bytes + filled, payload + used, run);
+            used += run;
+        }
+        filled += run;
+    }
+    if (filled != 256) {
+        return -1;
+    }
+    for (int row = 0; row < 32; row++) {
+        uint64_t bits = 0;
+        for (int i = 0; i < 8; i++) {
+            bits = bits << 8 | bytes[row * 8 + i];
+        }
+        display[row] = type == STREAM_DELTA ? display[row] ^ bits : bits;
+    }
+    return 0;
+}
+
+static size_t build_message(frame_stream *stream_ptr, const uint64_t display[32], stream_message_type type,
+                            uint8_t message[STREAM_MAX_MESSAGE]) {
+    double start = now_seconds();
+    size_t size = stream_encode(display, type == STREAM_DELTA ? stream_ptr->previous : NULL,
+                                message + STREAM_HEADER_SIZE);
+    stream_ptr->stats.encode_seconds += now_seconds() - start;
+
+    message[0] = type;
+    message[1] = 0;
+    message[2] = size & 0xFF;
+    message[3] = size >> 8;
+    uint32_t checksum = stream_checksum(display);
+    for (int i = 0; i < 4; i++) {
+        message[4 + i] = stream_ptr->frame_number >> (8 * i);
+        message[8 + i] = checksum >> (8 * i);
+    }
+    return STREAM_HEADER_SIZE + size;
+}
+
+void stream_publish(frame_stream *stream_ptr, const uint64_t display[32]) {
+    uint8_t delta[STREAM_MAX_MESSAGE], keyframe[STREAM_MAX_MESSAGE];
+    size_t delta_size = 0, keyframe_size = 0;
+    int needs_keyframe = 0;
+
+    stream_ptr->frame_number++;
+    stream_ptr->stats.frames++;
+    double now = now_seconds();
+    if (now >= stream_ptr->next_accept) {
+        accept_clients(stream_ptr);
+        stream_ptr->next_accept = now + STREAM_ACCEPT_SECONDS;
+    }
+    if (stream_ptr->client_count == 0) {
+        return;
+    }
+    for (int i = 0; i < stream_ptr->client_count; i++) {
+        needs_keyframe += stream_ptr->clients[i].needs_keyframe;
+    }
+    int changed = memcmp(display, stream_ptr->previous, sizeof(stream_ptr->previous)) != 0;
+    if (!changed && !needs_keyframe) {
+        return;
+    }
+
+    // Keyframes on schedule go to everyone and only count changed frames, a client that joined or missed a
+    // frame gets one on its own. Clients that are up to date get nothing for an unchanged frame.
+    int all_keyframes = 0;
+    if (changed) {
+        all_keyframes = ++stream_ptr->since_keyframe >= stream_ptr->keyframe_interval;
+        if (all_keyframes) {
+            stream_ptr->since_keyframe = 0;
+        }
+        stream_ptr->stats.sent++;
+    }
+    if (all_keyframes || needs_keyframe) {
+        keyframe_size = build_message(stream_ptr, display, STREAM_KEYFRAME, keyframe);
+        stream_ptr->stats.keyframes++;
+    }
+    if (changed && !all_keyframes && needs_keyframe < stream_ptr->client_count) {
+        delta_size = build_message(stream_ptr, display, STREAM_DELTA, delta);
+    }
+
+    for (int i = 0; i < stream_ptr->client_count;) {
+        stream_client *client_ptr = &stream_ptr->clients[i];
+        int use_keyframe = all_keyframes || client_ptr->needs_keyframe;
+        const uint8_t *message = use_keyframe ? keyframe : delta;
+        size_t size = use_keyframe ? keyframe_size : delta_size;
+
+        if (size == 0) {
+            i++;
+            continue;
+        }
+        // Sequenced packets are sent whole or not at all
+        if (send(client_ptr->fd, message, size, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)size) {
+            client_ptr->needs_keyframe = 0;
+            stream_ptr->stats.messages++;
+            stream_ptr->stats.bytes += size;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            client_ptr->needs_keyframe = 1;
+            stream_ptr->stats.dropped++;
+        } else {
+            close(client_ptr->fd);
+            *client_ptr = stream_ptr->clients[--stream_ptr->client_count];
+            stream_ptr->stats.detached++;
+            continue;
+        }
+        i++;
+    }
+    memcpy(stream_ptr->previous, display, sizeof(stream_ptr->previous));
+}
+
+void stream_report(const frame_stream *stream_ptr) {
+    const stream_stats *stats_ptr = &stream_ptr->stats;
+    uint64_t sent = stats_ptr->sent;
+
+    printf("Stream: %llu frames, %llu sent (%llu keyframes), %llu messages dropped\n",
+           (unsigned long long)stats_ptr->frames, (unsigned long long)sent, (unsigned long long)stats_ptr->keyframes,
+           (unsigned long long)stats_ptr->dropped);
+    printf("Stream clients: %llu attached, %llu detached\n", (unsigned long long)stats_ptr->attached,
+           (unsigned long long)stats_ptr->detached);
+    printf("Stream bandwidth: %llu bytes, %.1f bytes per message\n", (unsigned long long)stats_ptr->bytes,
+           stats_ptr->messages ? (double)stats_ptr->bytes / stats_ptr->messages : 0.0);
+    printf("Stream encode time: %.3f us per frame sent\n", sent ? stats_ptr->encode_seconds * 1e6 / sent : 0.0);
+}
@@ -0,0 +1,77 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STREAM_MAX_CLIENTS 16
+#define STREAM_DEFAULT_KEYFRAME_INTERVAL 60
+// Seconds between two checks for clients waiting to attach, so a fast run doesn't pay a syscall per frame
+#define STREAM_ACCEPT_SECONDS 0.01
+
+// A message is a header followed by an RLE payload that decodes to the 256 bytes of a framebuffer, row by row
+// with the leftmost pixel in the top bit of each row's first byte. A keyframe payload is the framebuffer itself,
+// a delta payload is its XOR with the previous frame the client was sent.
+// Header: type, a zero byte, the payload size, the emulated frame number and the stream_checksum() of the frame,
+// all little-endian. The checksum lets a client verify the picture its deltas built up.
+#define STREAM_HEADER_SIZE 12
+// Control bytes 0 to 127 stand for 1 to 128 zero bytes, 128 to 255 for 1 to 128 literal bytes that follow
+#define STREAM_MAX_PAYLOAD (256 + 2)
+#define STREAM_MAX_MESSAGE (STREAM_HEADER_SIZE + STREAM_MAX_PAYLOAD)
+
+typedef enum { STREAM_KEYFRAME = 'K', STREAM_DELTA = 'D' } stream_message_type;
+
+typedef struct {
+    uint64_t frames; // Frames handed to stream_publish()
+    uint64_t sent; // Changed frames sent to the attached clients
+    uint64_t keyframes; // Scheduled ones and the ones sent to resynchronize a client
+    uint64_t messages; // Messages written, one per client a frame was sent to
+    uint64_t bytes; // Bytes written to all clients
+    uint64_t dropped; // Messages lost to a full socket, the client resynchronizes with a keyframe
+    uint64_t attached, detached; // Clients that connected and went away
+    double encode_seconds;
+} stream_stats;
+
+typedef struct {
+    int fd;
+    int needs_keyframe; // Just attached, or missed a frame the next delta would build on
+} stream_client;
+
+// Publishes the frames of one instance to the clients of a Unix-domain socket. Owned by the thread running the
+// instance: publishing never blocks, clients attach and detach while it runs.
+typedef struct {
+    int listen_fd;
+    char path[108];
+    stream_client clients[STREAM_MAX_CLIENTS];
+    int client_count;
+    uint32_t keyframe_interval; // Every this many changed frames is a keyframe for all clients
+    uint32_t since_keyframe;
+    uint32_t frame_number;
+    double next_accept; // now_seconds() time of the next check for clients
+    uint64_t previous[32]; // Last frame sent, the base of the next delta
+    stream_stats stats;
+} frame_stream;
+
+// Listens on a SOCK_SEQPACKET socket at path, replacing a stale one. Returns 0 on success and -1 on failure.
+int stream_open(frame_stream *stream_ptr, const char *path, uint32_t keyframe_interval);
+
+// Disconnects the clients, which read the end of the stream, and removes the socket
+void stream_close(frame_stream *stream_ptr);
+
+// Sends the frame to every client if it changed, or as a keyframe to the clients that need one. Cheap when
+// nothing is attached: the frame is only encoded for clients.
+void stream_publish(frame_stream *stream_ptr, const uint64_t display[32]);
+
+// Encodes display XOR previous, or display itself when previous is NULL, and returns the payload size
+size_t stream_encode(const uint64_t display[32], const uint64_t *previous, uint8_t payload[STREAM_MAX_PAYLOAD]);
+
+// 32-bit checksum of a framebuffer, cheap enough to send with every frame
+uint32_t stream_checksum(const uint64_t display[32]);
+
+// Decodes a payload into a framebuffer, XORing it into display for a delta. Returns -1 when it is malformed.
+int stream_decode(const uint8_t *payload, size_t size, stream_message_type type, uint64_t display[32]);
+
+// Prints the counters: bandwidth and encode time per frame sent
+void stream_report(const frame_stream *stream_ptr);
+
+#endif
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "chip8.h"
+#include "stream.h"
+#include "timing.h"
+
+// Reference client of the frame stream: attaches to a headless run, decodes the messages back into a framebuffer
+// and checks the checksum of every frame against the picture the deltas built up.
+
+static void usage(const char *program) {
+    printf("Usage: %s [-w seconds] [-n frames] [-p] socket\n", program);
+    printf("  -w  keep trying to attach for the given seconds while the server starts (default 5)\n");
+    printf("  -n  detach after the given number of frames instead of at the end of the stream\n");
+    printf("  -p  print the last decoded frame\n");
+}
+
+static int attach(const char *path, double wait_seconds) {
+    struct sockaddr_un address;
+    double deadline = now_seconds() + wait_seconds;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        printf("Socket path %s is too long.\n", path);
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    for (;;) {
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        if (fd < 0) {
+            printf("Failed to create a socket.\n");
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+            return fd;
+        }
+        close(fd);
+        if (now_seconds() >= deadline) {
+            printf("Failed to attach to %s.\n", path);
+            return -1;
+        }
+        sleep_until(now_seconds() + 0.01);
+    }
+}
+
+static uint32_t read_u32(const uint8_t *bytes) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static void print_display(const uint64_t display[32]) {
+    for (int row = 0; row < 32; row++) {
+        char line[65];
+        for (int column = 0; column < 64; column++) {
+            line[column] = (display[row] >> (63 - column)) & 1 ? '#' : '.';
+        }
+        line[64] = '\0';
+        printf("%s\n", line);
+    }
+}
+
+int main(int argc, char **argv) {
+    double wait_seconds = 5.0;
+    uint64_t limit = 0;
+    int print = 0, option;
+
+    while ((option = getopt(argc, argv, "w:n:ph")) != -1) {
+        switch (option) {
+            case 'w':
+                wait_seconds = atof(optarg);
+                break;
+            case 'n':
+                limit = strtoull(optarg, NULL, 0);
+                break;
+            case 'p':
+                print = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return option == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    int fd = attach(argv[optind], wait_seconds);
+    if (fd < 0) {
+        return -1;
+    }
+
+    static chip8_cpu cpu;
+    uint8_t message[STREAM_MAX_MESSAGE];
+    uint64_t frames = 0, keyframes = 0, bytes = 0, mismatches = 0;
+    uint32_t last_frame = 0;
+    int status = 0;
+    ssize_t size;
+    while ((limit == 0 || frames < limit) && (size = recv(fd, message, sizeof(message), 0)) > 0) {
+        stream_message_type type = message[0];
+        size_t payload_size = message[2] | message[3] << 8;
+
+        if (size < STREAM_HEADER_SIZE || (type != STREAM_KEYFRAME && type != STREAM_DELTA) ||
+            payload_size != (size_t)size - STREAM_HEADER_SIZE || (type == STREAM_DELTA && frames == 0)) {
+            printf("Malformed message after %llu frames.\n", (unsigned long long)frames);
+            status = -1;
+            break;
+        }
+        last_frame = read_u32(message + 4);
+        if (stream_decode(message + STREAM_HEADER_SIZE, payload_size, type, cpu.display) != 0) {
+            printf("Malformed payload in frame %u.\n", last_frame);
+            status = -1;
+            break;
+        }
+        if (stream_checksum(cpu.display) != read_u32(message + 8)) {
+            printf("Frame %u decoded to the wrong picture.\n", last_frame);
+            mismatches++;
+        }
+        keyframes += type == STREAM_KEYFRAME;
+        frames++;
+        bytes += size;
+    }
+    close(fd);
+
+    printf("Frames: %llu (%llu keyframes, %llu deltas), last frame %u\n", (unsigned long long)frames,
+           (unsigned long long)keyframes, (unsigned long long)(frames - keyframes), last_frame);
+    printf("Bytes received: %llu, %.1f per frame\n", (unsigned long long)bytes, frames ? (double)bytes / frames : 0.0);
+    printf("Checksum mismatches: %llu\n", (unsigned long long)mismatches);
+    printf("Final display: %016llx\n", (unsigned long long)display_hash(&cpu));
+    if (print) {
+        print_display(cpu.display);
+    }
+    return status == 0 && mismatches == 0 && frames > 0 ? 0 : -1;
+}
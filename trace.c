@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+
+// Records written to the file with one fwrite
+#define TRACE_FLUSH_BATCH 1024
+
+static void put_record(uint8_t *out, const trace_record *record_ptr) {
+    out[0] = record_ptr->program_counter & 0xFF;
+    out[1] = record_ptr->program_counter >> 8;
+    out[2] = record_ptr->opcode & 0xFF;
+    out[3] = record_ptr->opcode >> 8;
+    out[4] = record_ptr->I & 0xFF;
+    out[5] = record_ptr->I >> 8;
+    out[6] = record_ptr->reg;
+    out[7] = record_ptr->value;
+}
+
+static void *flush_main(void *arg) {
+    trace_ring *ring_ptr = arg;
+    uint8_t buffer[TRACE_FLUSH_BATCH * TRACE_RECORD_BYTES];
+    uint64_t tail = atomic_load_explicit(&ring_ptr->tail, memory_order_relaxed);
+
+    for (;;) {
+        // Read stop first, so the records appended before it was set are still drained
+        int stopping = atomic_load_explicit(&ring_ptr->stop, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&ring_ptr->head, memory_order_acquire);
+
+        if (head == tail) {
+            if (stopping) {
+                break;
+            }
+            struct timespec pause = { 0, 1000000 };
+            nanosleep(&pause, NULL);
+            continue;
+        }
+
+        size_t count = 0;
+        while (tail + count < head && count < TRACE_FLUSH_BATCH) {
+            put_record(buffer + count * TRACE_RECORD_BYTES, &ring_ptr->records[(tail + count) & (TRACE_RING_RECORDS - 1)]);
+            count++;
+        }
+        // The slots are handed back before the write so the emulation thread never waits on the disk
+        tail += count;
+        atomic_store_explicit(&ring_ptr->tail, tail, memory_order_release);
+        fwrite(buffer, TRACE_RECORD_BYTES, count, ring_ptr->file_ptr);
+    }
+
+    return NULL;
+}
+
+trace_ring *trace_create(const char *path) {
+    trace_ring *ring_ptr = calloc(1, sizeof(trace_ring));
+
+    if (ring_ptr == NULL) {
+        return NULL;
+    }
+    if (path == NULL) {
+        return ring_ptr;
+    }
+
+    ring_ptr->file_ptr = fopen(path, "wb");
+    if (ring_ptr->file_ptr == NULL) {
+        printf("Failed to create trace file %s.\n", path);
+        free(ring_ptr);
+        return NULL;
+    }
+    uint8_t header[8] = { TRACE_MAGIC[0], TRACE_MAGIC[1], TRACE_MAGIC[2], TRACE_MAGIC[3], TRACE_VERSION, TRACE_RECORD_BYTES, 0, 0 };
+    fwrite(header, 1, sizeof(header), ring_ptr->file_ptr);
+    if (pthread_create(&ring_ptr->thread, NULL, flush_main, ring_ptr) != 0) {
+        printf("Failed to start the trace flush thread.\n");
+        fclose(ring_ptr->file_ptr);
+        free(ring_ptr);
+        return NULL;
+    }
+    return ring_ptr;
+}
+
+void trace_destroy(trace_ring *ring_ptr) {
+    if (ring_ptr == NULL) {
+        return;
+    }
+    if (ring_ptr->file_ptr != NULL) {
+        atomic_store_explicit(&ring_ptr->stop, 1, memory_order_release);
+        pthread_join(ring_ptr->thread, NULL);
+        fclose(ring_ptr->file_ptr);
+        if (ring_ptr->dropped > 0) {
+            printf("Trace dropped %llu records, the flush thread could not keep up.\n",
+                   (unsigned long long)ring_ptr->dropped);
+        }
+    }
+    free(ring_ptr);
+}
+
+size_t trace_latest(const trace_ring *ring_ptr, trace_record *records, size_t count) {
+    uint64_t head = atomic_load_explicit(&ring_ptr->head, memory_order_acquire);
+    uint64_t available = head < TRACE_RING_RECORDS ? head : TRACE_RING_RECORDS;
+
+    if (count > available) {
+        count = available;
+    }
+    for (size_t i = 0; i < count; i++) {
+        records[i] = ring_ptr->records[(head - count + i) & (TRACE_RING_RECORDS - 1)];
+    }
+    return count;
+}
+
+int trace_read_header(FILE *file_ptr) {
+    uint8_t header[8];
+
+    if (fread(header, 1, sizeof(header), file_ptr) != sizeof(header) || memcmp(header, TRACE_MAGIC, 4) != 0 ||
+        header[4] != TRACE_VERSION || header[5] != TRACE_RECORD_BYTES) {
+        return -1;
+    }
+    return 0;
+}
+
+int trace_read_record(FILE *file_ptr, trace_record *record_ptr) {
+    uint8_t in[TRACE_RECORD_BYTES];
+
+    if (fread(in, 1, sizeof(in), file_ptr) != sizeof(in)) {
+        return -1;
+    }
+    record_ptr->program_counter = in[0] | (in[1] << 8);
+    record_ptr->opcode = in[2] | (in[3] << 8);
+    record_ptr->I = in[4] | (in[5] << 8);
+    record_ptr->reg = in[6];
+    record_ptr->value = in[7];
+    return 0;
+}
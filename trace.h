@@ -0,0 +1,103 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "chip8.h"
+
+// Execution tracing is compiled in with -DCHIP8_TRACE. Without it the hooks in the interpreter expand to nothing.
+
+#define TRACE_RING_RECORDS (1 << 16) // Must be a power of two
+#define TRACE_NO_REGISTER 0xFF
+#define TRACE_MAGIC "C8TR"
+#define TRACE_VERSION 1
+#define TRACE_RECORD_BYTES 8 // Size of a record in a trace file, fields in little-endian order
+
+typedef struct {
+    uint16_t program_counter, opcode, I; // I after the instruction
+    uint8_t reg; // V register the instruction changed, TRACE_NO_REGISTER when none did
+    uint8_t value; // New value of that register
+} trace_record;
+
+// Single-producer single-consumer ring: the emulation thread appends, the flush thread consumes
+typedef struct trace_ring {
+    trace_record records[TRACE_RING_RECORDS];
+    _Atomic uint64_t head; // Records appended so far
+    _Atomic uint64_t tail; // Records written to the file so far
+    uint64_t dropped; // Records lost because the flush thread was a whole ring behind
+    FILE *file_ptr; // NULL when the ring only keeps the newest records in memory
+    pthread_t thread;
+    _Atomic int stop;
+} trace_ring;
+
+// Creates a ring. With a path, a background thread streams the records to that file, otherwise the
+// newest TRACE_RING_RECORDS records are kept in memory. Returns NULL on failure.
+trace_ring *trace_create(const char *path);
+
+// Stops the flush thread once every record is written, then frees the ring
+void trace_destroy(trace_ring *ring_ptr);
+
+// Copies up to count of the newest records, oldest first, and returns how many were copied
+size_t trace_latest(const trace_ring *ring_ptr, trace_record *records, size_t count);
+
+// Checks the header of a trace file, returns 0 on success and -1 if it is not a trace
+int trace_read_header(FILE *file_ptr);
+
+// Reads the next record of a trace file, returns 0 on success and -1 at the end
+int trace_read_record(FILE *file_ptr, trace_record *record_ptr);
+
+static inline void trace_instruction(trace_ring *ring_ptr, const chip8_cpu *cpu_ptr, uint16_t program_counter,
+                                     uint16_t opcode, const uint8_t V_before[16]) {
+    uint64_t head = atomic_load_explicit(&ring_ptr->head, memory_order_relaxed);
+
+    if (ring_ptr->file_ptr != NULL &&
+        head - atomic_load_explicit(&ring_ptr->tail, memory_order_acquire) == TRACE_RING_RECORDS) {
+        ring_ptr->dropped++;
+        return;
+    }
+
+    trace_record *record_ptr = &ring_ptr->records[head & (TRACE_RING_RECORDS - 1)];
+    record_ptr->program_counter = program_counter;
+    record_ptr->opcode = opcode;
+    record_ptr->I = cpu_ptr->registers.I;
+    record_ptr->reg = TRACE_NO_REGISTER;
+    record_ptr->value = 0;
+    // Vx is the usual destination, a flag-only change shows up as VF
+    uint8_t x = (opcode & 0x0F00) >> 8;
+    if (cpu_ptr->registers.V[x] != V_before[x]) {
+        record_ptr->reg = x;
+    } else {
+        for (uint8_t i = 0; i < 16; i++) {
+            if (cpu_ptr->registers.V[i] != V_before[i]) {
+                record_ptr->reg = i;
+                break;
+            }
+        }
+    }
+    if (record_ptr->reg != TRACE_NO_REGISTER) {
+        record_ptr->value = cpu_ptr->registers.V[record_ptr->reg];
+    }
+    atomic_store_explicit(&ring_ptr->head, head + 1, memory_order_release);
+}
+
+#ifdef CHIP8_TRACE
+// Placed around the execution of one instruction, records it when the CPU has a trace ring attached
+#define TRACE_BEFORE(cpu_ptr) \
+    uint16_t trace_program_counter = (cpu_ptr)->registers.program_counter; \
+    uint8_t trace_V[16]; \
+    memcpy(trace_V, (cpu_ptr)->registers.V, sizeof(trace_V))
+#define TRACE_AFTER(cpu_ptr, opcode) \
+    do { \
+        if ((cpu_ptr)->trace_ptr != NULL) { \
+            trace_instruction((cpu_ptr)->trace_ptr, (cpu_ptr), trace_program_counter, (opcode), trace_V); \
+        } \
+    } while (0)
+#else
+#define TRACE_BEFORE(cpu_ptr) do { } while (0)
+#define TRACE_AFTER(cpu_ptr, opcode) do { } while (0)
+#endif
+
+#endif
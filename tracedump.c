@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "trace.h"
+#include "disasm.h"
+
+// Prints a binary trace file as one disassembled instruction per line
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        printf("Usage: %s trace-file\n", argv[0]);
+        return -1;
+    }
+
+    FILE *file_ptr = fopen(argv[1], "rb");
+    if (file_ptr == NULL) {
+        printf("Failed to open trace %s.\n", argv[1]);
+        return -1;
+    }
+    if (trace_read_header(file_ptr) != 0) {
+        printf("%s is not a trace file.\n", argv[1]);
+        fclose(file_ptr);
+        return -1;
+    }
+
+    trace_record record;
+    unsigned long long index = 0;
+    char text[32];
+    while (trace_read_record(file_ptr, &record) == 0) {
+        disassemble(record.opcode, text, sizeof(text));
+        printf("%10llu  %03X  %04X  %-16s I=%03X", index++, record.program_counter, record.opcode, text, record.I);
+        if (record.reg != TRACE_NO_REGISTER) {
+            printf("  V%X=%02X", record.reg, record.value);
+        }
+        printf("\n");
+    }
+
+    fclose(file_ptr);
+    return 0;
+}